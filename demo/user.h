@@ -88,6 +88,7 @@ int string_serialize(void * key, char * value, uint16_t * len)
 int string_deserialize(void * key, char * value, uint16_t len)
 {
     memcpy(key, value, len);
+    ((char *) key)[len] = '\0';
 
     return 0;
 }
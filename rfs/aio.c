@@ -0,0 +1,372 @@
+#include "aio.h"
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+typedef struct {
+    int            fd;
+    int            write;
+    struct iovec * iov;
+    int            iovcnt;
+    uint64_t       offset;
+    void *         data;
+} stAioTask;
+
+struct _stAio {
+    int      engine;
+    uint32_t depth;
+    uint32_t inflight;   //已提交还未被aio_reap取走的请求数
+
+    //AIO_ENGINE_URING
+    int      ring_fd;
+    void *   sq_ptr;
+    size_t   sq_size;
+    void *   cq_ptr;
+    size_t   cq_size;
+    struct io_uring_sqe * sqes;
+    size_t   sqes_size;
+    uint32_t * sq_head;
+    uint32_t * sq_tail;
+    uint32_t * sq_mask;
+    uint32_t * sq_array;
+    uint32_t * cq_head;
+    uint32_t * cq_tail;
+    uint32_t * cq_mask;
+    struct io_uring_cqe * cqes;
+    uint32_t   to_submit; //已放入sq还没有io_uring_enter的请求数
+
+    //AIO_ENGINE_THREAD, pending和done都是容量为depth的环形队列
+    pthread_mutex_t lock;
+    pthread_cond_t  pending_cond;
+    pthread_cond_t  done_cond;
+    stAioTask  *    pending;
+    uint32_t        pending_head;
+    uint32_t        pending_cnt;
+    stAioEvent *    done;
+    uint32_t        done_head;
+    uint32_t        done_cnt;
+    pthread_t  *    threads;
+    uint16_t        thread_num;
+    int             stop;
+};
+
+static int _uring_setup(uint32_t entries, struct io_uring_params * p)
+{
+    return (int) syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int _uring_enter(int fd, uint32_t to_submit, uint32_t min_complete, uint32_t flags)
+{
+    return (int) syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int _uring_init(stAio * aio)
+{
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+
+    aio->ring_fd = _uring_setup(aio->depth, &p);
+    if (aio->ring_fd < 0)
+        return -1;
+
+    aio->sq_size = p.sq_off.array + p.sq_entries * sizeof(uint32_t);
+    aio->cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if (aio->cq_size > aio->sq_size) aio->sq_size = aio->cq_size;
+        aio->cq_size = 0;
+    }
+
+    aio->sq_ptr = mmap(NULL, aio->sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, aio->ring_fd, IORING_OFF_SQ_RING);
+    if (aio->sq_ptr == MAP_FAILED)
+        goto fail_sq;
+
+    aio->cq_ptr = aio->sq_ptr;
+    if (aio->cq_size != 0)
+    {
+        aio->cq_ptr = mmap(NULL, aio->cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, aio->ring_fd, IORING_OFF_CQ_RING);
+        if (aio->cq_ptr == MAP_FAILED)
+            goto fail_cq;
+    }
+
+    aio->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    aio->sqes = mmap(NULL, aio->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, aio->ring_fd, IORING_OFF_SQES);
+    if (aio->sqes == MAP_FAILED)
+        goto fail_sqes;
+
+    char * sq = (char *) aio->sq_ptr;
+    aio->sq_head  = (uint32_t *) (sq + p.sq_off.head);
+    aio->sq_tail  = (uint32_t *) (sq + p.sq_off.tail);
+    aio->sq_mask  = (uint32_t *) (sq + p.sq_off.ring_mask);
+    aio->sq_array = (uint32_t *) (sq + p.sq_off.array);
+
+    char * cq = (char *) aio->cq_ptr;
+    aio->cq_head  = (uint32_t *) (cq + p.cq_off.head);
+    aio->cq_tail  = (uint32_t *) (cq + p.cq_off.tail);
+    aio->cq_mask  = (uint32_t *) (cq + p.cq_off.ring_mask);
+    aio->cqes     = (struct io_uring_cqe *) (cq + p.cq_off.cqes);
+
+    return 0;
+
+fail_sqes:
+    if (aio->cq_size != 0)
+        munmap(aio->cq_ptr, aio->cq_size);
+fail_cq:
+    munmap(aio->sq_ptr, aio->sq_size);
+fail_sq:
+    close(aio->ring_fd);
+    return -1;
+}
+
+static void _uring_fini(stAio * aio)
+{
+    munmap(aio->sqes, aio->sqes_size);
+    if (aio->cq_size != 0)
+        munmap(aio->cq_ptr, aio->cq_size);
+    munmap(aio->sq_ptr, aio->sq_size);
+    close(aio->ring_fd);
+}
+
+static int _uring_submit(stAio * aio, stAioTask * task)
+{
+    uint32_t tail = *aio->sq_tail;
+    uint32_t idx  = tail & *aio->sq_mask;
+
+    struct io_uring_sqe * sqe = aio->sqes + idx;
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode    = task->write ? IORING_OP_WRITEV : IORING_OP_READV;
+    sqe->fd        = task->fd;
+    sqe->addr      = (uint64_t) (uintptr_t) task->iov;
+    sqe->len       = task->iovcnt;
+    sqe->off       = task->offset;
+    sqe->user_data = (uint64_t) (uintptr_t) task->data;
+
+    aio->sq_array[idx] = idx;
+    __atomic_store_n(aio->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ++aio->to_submit;
+
+    //提交失败的留到_uring_reap中再提交
+    int ret = _uring_enter(aio->ring_fd, aio->to_submit, 0, 0);
+    if (ret > 0)
+        aio->to_submit -= ret;
+
+    return 0;
+}
+
+static int _uring_reap(stAio * aio, uint32_t want, stAioEvent * events, uint32_t max)
+{
+    uint32_t n = 0;
+    while (1)
+    {
+        uint32_t head = *aio->cq_head;
+        uint32_t tail = __atomic_load_n(aio->cq_tail, __ATOMIC_ACQUIRE);
+        for (; head != tail && n < max; ++head, ++n)
+        {
+            struct io_uring_cqe * cqe = aio->cqes + (head & *aio->cq_mask);
+            events[n].data = (void *) (uintptr_t) cqe->user_data;
+            events[n].res  = cqe->res;
+        }
+        __atomic_store_n(aio->cq_head, head, __ATOMIC_RELEASE);
+
+        if (n >= want && aio->to_submit == 0)
+            break;
+
+        uint32_t flags = (n < want) ? IORING_ENTER_GETEVENTS : 0;
+        int ret = _uring_enter(aio->ring_fd, aio->to_submit, (n < want) ? want - n : 0, flags);
+        if (ret < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        aio->to_submit -= ret;
+    }
+
+    return n;
+}
+
+static void * _worker(void * arg)
+{
+    stAio * aio = (stAio *) arg;
+
+    pthread_mutex_lock(&aio->lock);
+    while (1)
+    {
+        while (!aio->stop && aio->pending_cnt == 0)
+            pthread_cond_wait(&aio->pending_cond, &aio->lock);
+
+        if (aio->pending_cnt == 0)
+            break;
+
+        stAioTask task = aio->pending[aio->pending_head];
+        aio->pending_head = (aio->pending_head + 1) % aio->depth;
+        --aio->pending_cnt;
+        pthread_mutex_unlock(&aio->lock);
+
+        ssize_t res = task.write ? pwritev(task.fd, task.iov, task.iovcnt, task.offset)
+                                 : preadv(task.fd, task.iov, task.iovcnt, task.offset);
+
+        pthread_mutex_lock(&aio->lock);
+        stAioEvent * event = aio->done + (aio->done_head + aio->done_cnt) % aio->depth;
+        event->data = task.data;
+        event->res  = (res < 0) ? -errno : res;
+        ++aio->done_cnt;
+        pthread_cond_signal(&aio->done_cond);
+    }
+    pthread_mutex_unlock(&aio->lock);
+
+    return NULL;
+}
+
+static int _thread_init(stAio * aio, uint16_t thread_num)
+{
+    aio->pending = calloc(aio->depth, sizeof(stAioTask));
+    aio->done    = calloc(aio->depth, sizeof(stAioEvent));
+    aio->threads = calloc(thread_num, sizeof(pthread_t));
+    if (aio->pending == NULL || aio->done == NULL || aio->threads == NULL)
+        return -1;
+
+    uint16_t i = 0;
+    for (; i < thread_num; ++i)
+    {
+        if (pthread_create(aio->threads + i, NULL, _worker, aio) != 0)
+            return -1;
+        aio->thread_num = i + 1;
+    }
+
+    return 0;
+}
+
+static void _thread_fini(stAio * aio)
+{
+    pthread_mutex_lock(&aio->lock);
+    aio->stop = 1;
+    pthread_cond_broadcast(&aio->pending_cond);
+    pthread_mutex_unlock(&aio->lock);
+
+    uint16_t i = 0;
+    for (; i < aio->thread_num; ++i)
+        pthread_join(aio->threads[i], NULL);
+
+    free(aio->threads);
+    free(aio->pending);
+    free(aio->done);
+}
+
+stAio * aio_create(int engine, uint32_t depth, uint16_t thread_num)
+{
+    assert(depth > 0);
+
+    stAio * aio = calloc(1, sizeof(stAio));
+    if (aio == NULL)
+        return NULL;
+
+    aio->depth  = depth;
+    aio->engine = AIO_ENGINE_THREAD;
+    pthread_mutex_init(&aio->lock, NULL);
+    pthread_cond_init(&aio->pending_cond, NULL);
+    pthread_cond_init(&aio->done_cond, NULL);
+
+    if (engine == AIO_ENGINE_URING && _uring_init(aio) == 0)
+    {
+        aio->engine = AIO_ENGINE_URING;
+        return aio;
+    }
+
+    if (_thread_init(aio, thread_num ? thread_num : 1) != 0)
+    {
+        aio_destroy(aio);
+        return NULL;
+    }
+
+    return aio;
+}
+
+int aio_destroy(stAio * aio)
+{
+    assert(aio != NULL);
+
+    if (aio->engine == AIO_ENGINE_URING)
+        _uring_fini(aio);
+    else
+        _thread_fini(aio);
+
+    pthread_cond_destroy(&aio->done_cond);
+    pthread_cond_destroy(&aio->pending_cond);
+    pthread_mutex_destroy(&aio->lock);
+    free(aio);
+
+    return 0;
+}
+
+int aio_engine(stAio * aio)
+{
+    return aio->engine;
+}
+
+uint32_t aio_inflight(stAio * aio)
+{
+    return aio->inflight;
+}
+
+int aio_submit(stAio * aio, int fd, int write, struct iovec * iov, int iovcnt, uint64_t offset, void * data)
+{
+    assert(aio != NULL);
+
+    if (aio->inflight >= aio->depth)
+        return -1;
+
+    stAioTask task = { fd, write, iov, iovcnt, offset, data };
+
+    if (aio->engine == AIO_ENGINE_URING)
+        _uring_submit(aio, &task);
+    else
+    {
+        pthread_mutex_lock(&aio->lock);
+        aio->pending[(aio->pending_head + aio->pending_cnt) % aio->depth] = task;
+        ++aio->pending_cnt;
+        pthread_cond_signal(&aio->pending_cond);
+        pthread_mutex_unlock(&aio->lock);
+    }
+
+    ++aio->inflight;
+    return 0;
+}
+
+int aio_reap(stAio * aio, uint32_t min_complete, stAioEvent * events, uint32_t max)
+{
+    assert(aio != NULL);
+
+    uint32_t want = min_complete;
+    if (want > aio->inflight) want = aio->inflight;
+    if (want > max) want = max;
+
+    int n = 0;
+    if (aio->engine == AIO_ENGINE_URING)
+        n = _uring_reap(aio, want, events, max);
+    else
+    {
+        pthread_mutex_lock(&aio->lock);
+        while (aio->done_cnt < want)
+            pthread_cond_wait(&aio->done_cond, &aio->lock);
+
+        for (; n < (int) max && aio->done_cnt > 0; ++n)
+        {
+            events[n] = aio->done[aio->done_head];
+            aio->done_head = (aio->done_head + 1) % aio->depth;
+            --aio->done_cnt;
+        }
+        pthread_mutex_unlock(&aio->lock);
+    }
+
+    if (n > 0)
+        aio->inflight -= n;
+
+    return n;
+}
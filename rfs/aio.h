@@ -0,0 +1,33 @@
+#ifndef  AIO_INC
+#define  AIO_INC
+
+#include <stdint.h>
+#include <sys/uio.h>
+
+//异步定位读写: 优先使用io_uring, 不可用时退化为线程池执行preadv/pwritev
+
+enum {
+    AIO_ENGINE_URING  = 0, //io_uring, 创建失败时自动退化为AIO_ENGINE_THREAD
+    AIO_ENGINE_THREAD = 1, //线程池
+};
+
+typedef struct {
+    void *  data; //aio_submit时传入的data
+    int64_t res;  //读写的字节数, <0表示失败(-errno)
+} stAioEvent;
+
+struct _stAio;
+typedef struct _stAio stAio;
+
+stAio * aio_create(int engine, uint32_t depth, uint16_t thread_num);
+int aio_destroy(stAio * aio);
+int aio_engine(stAio * aio);
+uint32_t aio_inflight(stAio * aio);
+
+//iov在完成之前必须保持有效; 已有depth个请求未完成时返回-1
+int aio_submit(stAio * aio, int fd, int write, struct iovec * iov, int iovcnt, uint64_t offset, void * data);
+
+//至少等到min_complete个请求完成(不超过未完成的请求数), 最多取出max个, 返回取出的个数
+int aio_reap(stAio * aio, uint32_t min_complete, stAioEvent * events, uint32_t max);
+
+#endif
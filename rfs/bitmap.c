@@ -0,0 +1,222 @@
+#include "bitmap.h"
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#define BM_MAX_LEVEL (6) //64^6个元素, 足够uint32_t
+
+struct _stBitmap {
+    uint32_t   bit_count;
+    uint32_t   set_count;
+    int        level_num;
+    uint32_t   entry_num[BM_MAX_LEVEL]; //每层的位数, 第l层的位数是第l-1层的字数
+    uint64_t * full[BM_MAX_LEVEL];      //第l层的一位表示第l-1层的一个字全为1, full[0]是元素本身
+    uint64_t * nonempty[BM_MAX_LEVEL];  //第l层的一位表示第l-1层的一个字不为0, nonempty[0] == full[0]
+};
+
+static inline uint32_t _word_num(uint32_t entries)
+{
+    return (entries + 63) / 64;
+}
+
+//第0层最后一个字中不存在的位不会被置1, 字全满时的值要去掉这些位
+static inline uint64_t _full_mask(stBitmap * pbm, uint32_t word)
+{
+    uint32_t rest = pbm->bit_count - word * 64;
+    return (rest >= 64) ? ~0ULL : ((1ULL << rest) - 1);
+}
+
+stBitmap * bm_create(uint32_t bit_count)
+{
+    assert(bit_count > 0);
+
+    stBitmap * pbm = calloc(1, sizeof(stBitmap));
+    if (pbm == NULL)
+        return NULL;
+
+    pbm->bit_count = bit_count;
+
+    uint32_t entries = bit_count;
+    int l = 0;
+    for (; l < BM_MAX_LEVEL; ++l)
+    {
+        pbm->entry_num[l] = entries;
+        pbm->full[l] = malloc(_word_num(entries) * sizeof(uint64_t));
+        pbm->nonempty[l] = (l == 0) ? pbm->full[0] : malloc(_word_num(entries) * sizeof(uint64_t));
+        pbm->level_num = l + 1;
+
+        if (pbm->full[l] == NULL || pbm->nonempty[l] == NULL)
+        {
+            bm_destroy(pbm);
+            return NULL;
+        }
+
+        if (_word_num(entries) == 1)
+            break;
+        entries = _word_num(entries);
+    }
+
+    bm_clear_all(pbm);
+    return pbm;
+}
+
+int bm_destroy(stBitmap * pbm)
+{
+    assert(pbm != NULL);
+
+    int l = 0;
+    for (; l < pbm->level_num; ++l)
+    {
+        if (l > 0)
+            free(pbm->nonempty[l]);
+        free(pbm->full[l]);
+    }
+    free(pbm);
+
+    return 0;
+}
+
+void bm_clear_all(stBitmap * pbm)
+{
+    int l = 0;
+    for (; l < pbm->level_num; ++l)
+    {
+        uint32_t words = _word_num(pbm->entry_num[l]);
+        memset(pbm->full[l], 0, words * sizeof(uint64_t));
+        if (l == 0)
+            continue;
+
+        memset(pbm->nonempty[l], 0, words * sizeof(uint64_t));
+
+        //汇总层最后一个字中不存在的位视为全满, 查找0时不会走到
+        uint32_t rest = pbm->entry_num[l] % 64;
+        if (rest != 0)
+            pbm->full[l][words - 1] = ~0ULL << rest;
+    }
+
+    pbm->set_count = 0;
+}
+
+int bm_set(stBitmap * pbm, uint32_t idx)
+{
+    assert(idx < pbm->bit_count);
+
+    uint32_t word = idx / 64;
+    uint64_t bit  = 1ULL << (idx % 64);
+    if (pbm->full[0][word] & bit)
+        return -1;
+
+    int was_empty = (pbm->full[0][word] == 0);
+    pbm->full[0][word] |= bit;
+    ++pbm->set_count;
+
+    uint32_t pos = word;
+    int l = 1;
+    for (; was_empty && l < pbm->level_num; ++l, pos /= 64)
+    {
+        uint64_t * w = pbm->nonempty[l] + pos / 64;
+        was_empty = (*w == 0);
+        *w |= 1ULL << (pos % 64);
+    }
+
+    if (pbm->full[0][word] != _full_mask(pbm, word))
+        return 0;
+
+    for (pos = word, l = 1; l < pbm->level_num; ++l, pos /= 64)
+    {
+        uint64_t * w = pbm->full[l] + pos / 64;
+        *w |= 1ULL << (pos % 64);
+        if (*w != ~0ULL)
+            break;
+    }
+
+    return 0;
+}
+
+int bm_clear(stBitmap * pbm, uint32_t idx)
+{
+    assert(idx < pbm->bit_count);
+
+    uint32_t word = idx / 64;
+    uint64_t bit  = 1ULL << (idx % 64);
+    if (!(pbm->full[0][word] & bit))
+        return -1;
+
+    int was_full = (pbm->full[0][word] == _full_mask(pbm, word));
+    pbm->full[0][word] &= ~bit;
+    --pbm->set_count;
+
+    uint32_t pos = word;
+    int l = 1;
+    for (; was_full && l < pbm->level_num; ++l, pos /= 64)
+    {
+        uint64_t * w = pbm->full[l] + pos / 64;
+        was_full = (*w == ~0ULL);
+        *w &= ~(1ULL << (pos % 64));
+    }
+
+    if (pbm->full[0][word] != 0)
+        return 0;
+
+    for (pos = word, l = 1; l < pbm->level_num; ++l, pos /= 64)
+    {
+        uint64_t * w = pbm->nonempty[l] + pos / 64;
+        *w &= ~(1ULL << (pos % 64));
+        if (*w != 0)
+            break;
+    }
+
+    return 0;
+}
+
+int bm_test(stBitmap * pbm, uint32_t idx)
+{
+    assert(idx < pbm->bit_count);
+    return (pbm->full[0][idx / 64] >> (idx % 64)) & 1;
+}
+
+//在第level层找>=pos的第一个有效位(zero时找full中的0, 否则找nonempty中的1)
+//当前字中没有时到上一层找下一个字, 每层只看一个字
+static int64_t _next(stBitmap * pbm, int level, uint64_t pos, int zero)
+{
+    uint64_t ** tree = zero ? pbm->full : pbm->nonempty;
+    uint32_t entries = pbm->entry_num[level];
+
+    while (pos < entries)
+    {
+        uint64_t word = pos / 64;
+        uint64_t bits = zero ? ~tree[level][word] : tree[level][word];
+        bits &= ~0ULL << (pos % 64);
+
+        if (bits != 0)
+        {
+            uint64_t found = word * 64 + __builtin_ctzll(bits);
+            return (found < entries) ? (int64_t) found : -1;
+        }
+
+        if (level + 1 >= pbm->level_num)
+            return -1;
+
+        int64_t next_word = _next(pbm, level + 1, word + 1, zero);
+        if (next_word < 0)
+            return -1;
+        pos = (uint64_t) next_word * 64;
+    }
+
+    return -1;
+}
+
+int64_t bm_next_zero(stBitmap * pbm, uint32_t from)
+{
+    return _next(pbm, 0, from, 1);
+}
+
+int64_t bm_next_set(stBitmap * pbm, uint32_t from)
+{
+    return _next(pbm, 0, from, 0);
+}
+
+uint32_t bm_count(stBitmap * pbm)
+{
+    return pbm->set_count;
+}
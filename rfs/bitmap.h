@@ -0,0 +1,28 @@
+#ifndef  BITMAP_INC
+#define  BITMAP_INC
+
+#include <stdint.h>
+
+//分层位图: 第0层每位表示一个元素, 上一层的每位汇总下一层的一个64位字(是否全满, 是否非空)
+//查找第一个为0或为1的位只需每层看一个字, 每个元素只占1位多一点的内存
+
+struct _stBitmap;
+typedef struct _stBitmap stBitmap;
+
+//创建时所有位都为0
+stBitmap * bm_create(uint32_t bit_count);
+int bm_destroy(stBitmap * pbm);
+void bm_clear_all(stBitmap * pbm);
+
+//位已经是1(或0)时返回-1
+int bm_set(stBitmap * pbm, uint32_t idx);
+int bm_clear(stBitmap * pbm, uint32_t idx);
+int bm_test(stBitmap * pbm, uint32_t idx);
+
+//返回>=from的第一个为0(或1)的位, 没有时返回-1
+int64_t bm_next_zero(stBitmap * pbm, uint32_t from);
+int64_t bm_next_set(stBitmap * pbm, uint32_t from);
+
+uint32_t bm_count(stBitmap * pbm); //为1的位数
+
+#endif
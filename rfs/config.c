@@ -1,4 +1,5 @@
 #include "config.h"
+#include "aio.h"
 
 #define WORKING_DIR         "/data/rfs/"
 #define FILE_NAME_FORMAT    "rfs_$(file_type)_$(file_no)_$(grid_num)_$(grid_size).bin"
@@ -37,6 +38,22 @@ stUserConfig g_default_user_config = {
     DELETE_OLD_DATA,
     1,
     1,
-    1
+    1,
+    IO_ENGINE_PIO,
+    MSYNC_NONE,
+    AIO_ENGINE_URING,
+    64,
+    4,
+    WAL_OFF,
+    64*1024*1024,
+    1,
+    4,
+    1,
+    0,
+    30,
+    64*1024,
+    0,
+    0,
+    0,
 };
 
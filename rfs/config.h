@@ -18,6 +18,28 @@ enum {
     IGNORE_NEW_DATA = 4, //忽略新数据
 };
 
+//数据文件的读写方式
+enum {
+    IO_ENGINE_PIO   = 0, //pread/pwrite(v)按偏移读写文件描述符
+    IO_ENGINE_MMAP  = 1, //mmap映射整个数据文件, 直接在映射区上读写; 映射前给整个文件分配磁盘空间
+    IO_ENGINE_DIRECT = 2, //同IO_ENGINE_PIO, 但整块读写格子时用O_DIRECT, 不占用page cache
+                          //文件头补齐到4KB, 格子大小不是4KB整数倍的文件类型仍走page cache
+};
+
+//IO_ENGINE_MMAP下写数据后的msync策略
+enum {
+    MSYNC_NONE  = 0, //不主动msync, 由内核回写脏页
+    MSYNC_ASYNC = 1, //每次写后对写入的页执行msync(MS_ASYNC)
+    MSYNC_SYNC  = 2, //每次写后对写入的页执行msync(MS_SYNC), 返回时数据已落盘
+};
+
+//预写日志(工作目录下的rfs.wal)的落盘方式
+enum {
+    WAL_OFF   = 0, //不写日志, rfs_set挪动数据时靠auto_repair处理重复的key
+    WAL_SYNC  = 1, //每次写操作返回前日志已落盘, 同时进行的写操作共用一次fdatasync
+    WAL_ASYNC = 2, //日志攒够一批或调用rfs_sync时才落盘, 掉电时丢失最后一批写操作
+};
+
 //stUserConfig: 在程序启动前可以根据需要修改参数
 typedef struct {
     uint8_t auto_repair;           //rfs库中存在两个一样的key时,rfs库执行的操作
@@ -26,6 +48,24 @@ typedef struct {
                                    //      且有更小类型的文件可以存储下新数据
     uint8_t check_key_when_get;    //rfs_get时比较key和根据index_map得到的文件中的key是否一致
     uint8_t check_key_when_set;    //rfs_set时比较key和根据index_map得到的文件中的key是否一致
+    uint8_t io_engine;             //数据文件的读写方式, IO_ENGINE_*
+    uint8_t msync_policy;          //io_engine为IO_ENGINE_MMAP时的msync策略, MSYNC_*
+    uint8_t async_engine;          //rfs_get_async/rfs_set_async使用的异步IO方式, AIO_ENGINE_*(见aio.h)
+    uint16_t async_depth;          //最多同时进行的异步请求数
+    uint8_t async_thread_num;      //io_uring不可用时退化为线程池的线程数
+    uint8_t wal_mode;              //预写日志的落盘方式, WAL_*
+    uint32_t wal_checkpoint_size;  //日志超过这个长度时把数据文件落盘并清空日志
+    uint8_t index_checkpoint;      //是否把索引写到检查点文件, 启动时加载检查点而不是扫描所有数据文件
+                                   //WAL_SYNC时每次清空日志都写入, 异常退出后加载检查点再按日志补上之后的写操作
+                                   //其余模式只在正常退出(rfs_destroy)时写入, 异常退出后启动时不用检查点, 扫描所有数据文件
+    uint8_t load_thread_num;       //启动时需要扫描数据文件的话, 同时扫描的线程数, 0表示在当前线程中扫描
+    uint8_t verify_checksum_when_get; //rfs_get/rfs_mget/rfs_get_async时校验格子的crc32c; 启动扫描时总是校验
+    uint32_t compress_types;       //按位指定哪些type的value压缩后存储(第t位对应type t), 按压缩后的长度选择文件类型
+    uint8_t compact_threshold;     //rfs_compact搬空已用格子低于这个百分比的文件, 0表示不整理
+    uint32_t punch_hole_size;      //格子不小于这个字节数时, 删除后释放它占的磁盘空间(fallocate PUNCH_HOLE), 0表示不释放; 映射的文件不释放
+    uint8_t evict_when_full;       //hash_table的节点用完时rfs_set/rfs_set_ex/rfs_lset按CLOCK淘汰一个key, 0表示直接失败
+    uint64_t value_cache_size;     //rfs_get在内存中缓存热点value的字节数, 按格子位置缓存, 0表示不缓存
+    uint32_t max_open_fd_num;      //所有数据文件最多保持打开的描述符数, 超过时写接口关掉最久没用的, 用到时再打开; 0表示不限制
 } stUserConfig;
 
 extern stUserConfig g_default_user_config;
@@ -34,7 +74,7 @@ typedef struct {
     char working_dir[256];       //rfs工作目录
     char file_name_format[256];  //文件名的格式
     uint16_t max_file_type_num;  //最多有多少种文件类型
-    uint16_t max_open_file_num;  //每种类型最多允许打开多少文件
+    uint16_t max_open_file_num;  //每种类型预留多少文件的位置, 不够时自动扩展, 每种类型最多65535个文件
     uint32_t file_size;          //单个文件有效数据的大小
     uint32_t base_file_grid_size;//最小类型的文件一个格子占多少字节
     uint16_t grid_size_growth_factor; //第N种类型的文件格子大小是第N-1种的多少倍
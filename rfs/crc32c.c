@@ -0,0 +1,81 @@
+#include "crc32c.h"
+#include <string.h>
+#include <pthread.h>
+
+#define CRC32C_POLY (0x82F63B78) //0x1EDC6F41的反转
+
+static uint32_t       g_crc32c_table[256];
+static pthread_once_t g_crc32c_once = PTHREAD_ONCE_INIT;
+
+typedef uint32_t (* crc32c_func)(uint32_t crc, const uint8_t * p, size_t len);
+static crc32c_func g_crc32c_func;
+
+static uint32_t _crc32c_table(uint32_t crc, const uint8_t * p, size_t len)
+{
+    while (len--)
+        crc = g_crc32c_table[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+
+    return crc;
+}
+
+#if defined(__x86_64__) && defined(__GNUC__)
+//SSE4.2的crc32指令, 每次处理8字节
+__attribute__((target("sse4.2")))
+static uint32_t _crc32c_sse42(uint32_t crc, const uint8_t * p, size_t len)
+{
+    while (len > 0 && ((uintptr_t) p & 7) != 0)
+    {
+        crc = __builtin_ia32_crc32qi(crc, *p++);
+        --len;
+    }
+
+    uint64_t crc64 = crc;
+    for (; len >= 8; len -= 8, p += 8)
+    {
+        uint64_t v;
+        memcpy(&v, p, sizeof(v));
+        crc64 = __builtin_ia32_crc32di(crc64, v);
+    }
+    crc = (uint32_t) crc64;
+
+    while (len--)
+        crc = __builtin_ia32_crc32qi(crc, *p++);
+
+    return crc;
+}
+#endif
+
+static void _crc32c_init(void)
+{
+    uint32_t i = 0;
+    for (; i < 256; ++i)
+    {
+        uint32_t crc = i;
+        int k = 0;
+        for (; k < 8; ++k)
+            crc = (crc & 1) ? (crc >> 1) ^ CRC32C_POLY : (crc >> 1);
+        g_crc32c_table[i] = crc;
+    }
+
+    g_crc32c_func = _crc32c_table;
+
+#if defined(__x86_64__) && defined(__GNUC__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.2"))
+        g_crc32c_func = _crc32c_sse42;
+#endif
+}
+
+uint32_t crc32c(uint32_t crc, const void * buf, size_t len)
+{
+    pthread_once(&g_crc32c_once, _crc32c_init);
+
+    return ~g_crc32c_func(~crc, (const uint8_t *) buf, len);
+}
+
+uint32_t crc32c_sw(uint32_t crc, const void * buf, size_t len)
+{
+    pthread_once(&g_crc32c_once, _crc32c_init);
+
+    return ~_crc32c_table(~crc, (const uint8_t *) buf, len);
+}
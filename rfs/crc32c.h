@@ -0,0 +1,14 @@
+#ifndef  CRC32C_INC
+#define  CRC32C_INC
+
+#include <stdint.h>
+#include <stddef.h>
+
+//CRC-32C(Castagnoli), 可以分段计算: crc = crc32c(crc32c(0, a, alen), b, blen)
+//CPU支持SSE4.2时使用crc32指令, 否则查表
+uint32_t crc32c(uint32_t crc, const void * buf, size_t len);
+
+//总是查表计算, 用于校验crc32c的结果
+uint32_t crc32c_sw(uint32_t crc, const void * buf, size_t len);
+
+#endif
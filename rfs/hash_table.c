@@ -5,16 +5,17 @@
 #include <assert.h>
 #include <stdio.h>
 
+//[63-48]:file_type,[47-32]:file_no,[31-0]:grid_idx
 int64_t index_to_int64(stIndex * index)
 {
-    return ((index->file.file_type << 24) + (index->file.file_no << 16) + (index->grid_idx));
+    return (((int64_t) index->file.file_type << 48) | ((int64_t) index->file.file_no << 32) | index->grid_idx);
 }
 
 int int64_to_index(int64_t i, stIndex * index)
 {
-    index->file.file_type = (i & 0xFF000000) >> 24;
-    index->file.file_no   = (i & 0x00FF0000) >> 16;
-    index->grid_idx       = i & 0x0000FFFF;
+    index->file.file_type = (i >> 48) & 0xFFFF;
+    index->file.file_no   = (i >> 32) & 0xFFFF;
+    index->grid_idx       = i & 0xFFFFFFFF;
 
     return 0;
 }
@@ -30,6 +31,7 @@ typedef struct _stNode {
     struct _stNode * next;
     stKey   key;
     stIndex value;
+    uint8_t referenced;  //hashtable_get找到时置1, hashtable_clock_next经过时清0
 } stNode;
 
 typedef struct {
@@ -40,6 +42,7 @@ typedef struct {
     uint32_t node_num;
     stSinglyList * list;
     stNode * nodes;
+    uint32_t hand;       //hashtable_clock_next下一个要看的节点
 } stNodePool;
 
 struct _stHashTable {
@@ -116,21 +119,29 @@ int hashtable_get(stHashTable * hash_table, void * key, stIndex * index, void **
     uint32_t hash = (callback->hash(key) % hash_table->list_num);
     stLinkList * p = hash_table->lists + hash;
 
+    //多个线程可以同时查找, 不能用hash_table->private_data
+    char buf[MAX_KEY_LEN+1];
+
     stNode * node = p->head;
     for (; node != NULL; node = node->next)
     {
         if (node->key.type != callback->type(key))
             continue;
 
-        if (callback->deserialize(hash_table->private_data, node->key.key, node->key.len) != 0)
+        if (callback->deserialize(buf, node->key.key, node->key.len) != 0)
             continue;
+        buf[node->key.len] = '\0';
 
-        if (callback->cmp(hash_table->private_data, key) != 0)
+        if (callback->cmp(buf, key) != 0)
             continue;
 
         if (index != NULL) *index = node->value;
         if (ctx != NULL) *ctx = node;
 
+        //已经置位时不再写, 热点key不会在各线程之间来回同步缓存行
+        if (!node->referenced)
+            node->referenced = 1;
+
         return 0;
     }
 
@@ -159,6 +170,7 @@ int hashtable_set(stHashTable * hash_table, void * key, stIndex * index, stKeyCa
 
     node->key.type = callback->type(key);
     node->value = *index;
+    node->referenced = 0; //新的key没有被访问过, 一直不访问时先被淘汰
 
     uint32_t hash  = (callback->hash(key) % hash_table->list_num);
     stLinkList * p = hash_table->lists + hash;
@@ -216,6 +228,64 @@ int hashtable_next(stHashTable * hash_table, int32_t * idx, uint8_t * type, char
     return -1;
 }
 
+int hashtable_next_entry(stHashTable * hash_table, int32_t * idx, uint8_t * type, char * key, uint16_t * klen, stIndex * index)
+{
+    stNodePool * pool = hash_table->pool;
+
+    int32_t i = *idx + 1;
+    for (; i < pool->node_num; ++i)
+    {
+        stNode * node = pool->nodes + i;
+
+        if (node->key.type == 0)
+            continue;
+
+        memcpy(key, node->key.key, node->key.len);
+        *type  = node->key.type;
+        *klen  = node->key.len;
+        *index = node->value;
+        *idx   = i;
+        return 0;
+    }
+
+    return -1;
+}
+
+int hashtable_full(stHashTable * hash_table)
+{
+    return sl_peek_idle_idx(hash_table->pool->list) < 0;
+}
+
+int hashtable_clock_next(stHashTable * hash_table, uint8_t * type, char * key, uint16_t * klen, stIndex * index)
+{
+    stNodePool * pool = hash_table->pool;
+
+    //第一圈清掉所有访问位, 第二圈一定能找到
+    uint64_t step = 0;
+    for (; step < 2 * (uint64_t) pool->node_num; ++step)
+    {
+        stNode * node = pool->nodes + pool->hand;
+        pool->hand = (pool->hand + 1) % pool->node_num;
+
+        if (node->key.type == 0)
+            continue;
+
+        if (node->referenced)
+        {
+            node->referenced = 0;
+            continue;
+        }
+
+        memcpy(key, node->key.key, node->key.len);
+        *type  = node->key.type;
+        *klen  = node->key.len;
+        *index = node->value;
+        return 0;
+    }
+
+    return -1;
+}
+
 int hashtable_print(stHashTable * hash_table, stKeyCallback * callbacks)
 {
     uint8_t printed = 0;
@@ -22,6 +22,7 @@ typedef struct {
     int      (* print)       (void * key, char * out);
     int      (* cmp)       (void * key1, void * key); 
     int      (* serialize)   (void * key, char * value, uint16_t * vlen); 
+    //把serialize的结果还原成完整的key, 字符串等需要结尾的key要自己补上, rfs不会替它补'\0'; key的空间为MAX_KEY_LEN+1字节
     int      (* deserialize) (void * key, char * value, uint16_t vlen); 
 } stKeyCallback;
 
@@ -34,7 +35,14 @@ int hashtable_set(stHashTable * hash_table, void * key, stIndex * index, stKeyCa
 int hashtable_get(stHashTable * hash_table, void * key, stIndex * index, void **ctx, stKeyCallback * callback);
 int hashtable_del(stHashTable * hash_table, void * key, stKeyCallback * callback);
 int hashtable_next(stHashTable * hash_table, int32_t * idx, uint8_t * type, char *key, uint16_t * klen, stKeyCallback * callbacks);
+//同hashtable_next, 但取出的是序列化后的key和它的index
+int hashtable_next_entry(stHashTable * hash_table, int32_t * idx, uint8_t * type, char * key, uint16_t * klen, stIndex * index);
 int hashtable_print(stHashTable * hash_table, stKeyCallback * callbacks);
 
+//节点用完时返回1
+int hashtable_full(stHashTable * hash_table);
+//按CLOCK取出一个最近没有被hashtable_get找到过的key(序列化后)和它的index, 同时清掉经过的节点的访问位, 没有key时返回-1
+int hashtable_clock_next(stHashTable * hash_table, uint8_t * type, char * key, uint16_t * klen, stIndex * index);
+
 #endif
 
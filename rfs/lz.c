@@ -0,0 +1,194 @@
+#include "lz.h"
+#include <string.h>
+
+#define LZ_MIN_MATCH  (4)
+#define LZ_MAX_OFFSET (65535)
+#define LZ_HASH_BITS  (12)
+#define LZ_SKIP_SHIFT (6)  //连续找不到匹配时逐渐加大步长, 不可压缩的数据也能很快处理完
+
+static inline uint32_t _lz_read32(const uint8_t * p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32_t _lz_hash(uint32_t v)
+{
+    return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+//写入长度扩展, len已减去15
+static uint8_t * _lz_put_len(uint8_t * op, uint8_t * oend, uint32_t len)
+{
+    for (; len >= 255; len -= 255)
+    {
+        if (op >= oend)
+            return NULL;
+        *op++ = 255;
+    }
+
+    if (op >= oend)
+        return NULL;
+    *op++ = len;
+
+    return op;
+}
+
+//写入一个sequence, match_len为0表示最后一个sequence
+static uint8_t * _lz_put_seq(uint8_t * op, uint8_t * oend, const uint8_t * lit, uint32_t lit_len, uint32_t offset, uint32_t match_len)
+{
+    if (op >= oend)
+        return NULL;
+
+    uint8_t * token = op++;
+    *token = ((lit_len >= 15) ? 15 : lit_len) << 4;
+    if (lit_len >= 15 && (op = _lz_put_len(op, oend, lit_len - 15)) == NULL)
+        return NULL;
+
+    if (oend - op < lit_len)
+        return NULL;
+    memcpy(op, lit, lit_len);
+    op += lit_len;
+
+    if (match_len == 0)
+        return op;
+
+    if (oend - op < 2)
+        return NULL;
+    op[0] = offset & 0xFF;
+    op[1] = offset >> 8;
+    op += 2;
+
+    uint32_t len = match_len - LZ_MIN_MATCH;
+    *token |= (len >= 15) ? 15 : len;
+    if (len >= 15 && (op = _lz_put_len(op, oend, len - 15)) == NULL)
+        return NULL;
+
+    return op;
+}
+
+int lz_compress(const char * src, uint32_t slen, char * dst, uint32_t dcap)
+{
+    const uint8_t * base   = (const uint8_t *) src;
+    const uint8_t * ip     = base;
+    const uint8_t * anchor = base;
+    const uint8_t * iend   = base + slen;
+
+    uint8_t * op   = (uint8_t *) dst;
+    uint8_t * oend = op + dcap;
+
+    //位置+1, 0表示空
+    uint32_t table[1 << LZ_HASH_BITS];
+    memset(table, 0, sizeof(table));
+
+    while (slen >= LZ_MIN_MATCH && ip <= iend - LZ_MIN_MATCH)
+    {
+        uint32_t v = _lz_read32(ip);
+        uint32_t h = _lz_hash(v);
+        uint32_t cand = table[h];
+        table[h] = ip - base + 1;
+
+        if (cand != 0)
+        {
+            const uint8_t * ref = base + cand - 1;
+            if (ip - ref <= LZ_MAX_OFFSET && _lz_read32(ref) == v)
+            {
+                const uint8_t * mp = ip + LZ_MIN_MATCH;
+                const uint8_t * rp = ref + LZ_MIN_MATCH;
+                while (mp < iend && *mp == *rp)
+                {
+                    ++mp;
+                    ++rp;
+                }
+
+                op = _lz_put_seq(op, oend, anchor, ip - anchor, ip - ref, mp - ip);
+                if (op == NULL)
+                    return -1;
+
+                ip = anchor = mp;
+                continue;
+            }
+        }
+
+        ip += 1 + ((ip - anchor) >> LZ_SKIP_SHIFT);
+    }
+
+    op = _lz_put_seq(op, oend, anchor, iend - anchor, 0, 0);
+    if (op == NULL)
+        return -1;
+
+    return op - (uint8_t *) dst;
+}
+
+//读取长度扩展, 加到len上
+static const uint8_t * _lz_get_len(const uint8_t * ip, const uint8_t * iend, uint32_t * len)
+{
+    uint8_t b = 255;
+    while (b == 255)
+    {
+        if (ip >= iend)
+            return NULL;
+        b = *ip++;
+        *len += b;
+    }
+
+    return ip;
+}
+
+int lz_decompress(const char * src, uint32_t slen, char * dst, uint32_t dcap)
+{
+    const uint8_t * ip   = (const uint8_t *) src;
+    const uint8_t * iend = ip + slen;
+
+    uint8_t * op   = (uint8_t *) dst;
+    uint8_t * oend = op + dcap;
+
+    while (ip < iend)
+    {
+        uint8_t token = *ip++;
+
+        uint32_t len = token >> 4;
+        if (len == 15 && (ip = _lz_get_len(ip, iend, &len)) == NULL)
+            return -1;
+
+        if (iend - ip < len || oend - op < len)
+            return -1;
+        memcpy(op, ip, len);
+        op += len;
+        ip += len;
+
+        //最后一个sequence
+        if (ip == iend)
+            break;
+
+        if (iend - ip < 2)
+            return -1;
+        uint32_t offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > op - (uint8_t *) dst)
+            return -1;
+
+        len = token & 15;
+        if (len == 15 && (ip = _lz_get_len(ip, iend, &len)) == NULL)
+            return -1;
+        len += LZ_MIN_MATCH;
+
+        if (oend - op < len)
+            return -1;
+
+        //offset小于len时匹配和输出重叠, 只能逐字节复制
+        const uint8_t * ref = op - offset;
+        if (offset >= len)
+            memcpy(op, ref, len);
+        else
+        {
+            uint32_t i = 0;
+            for (; i < len; ++i)
+                op[i] = ref[i];
+        }
+        op += len;
+    }
+
+    return op - (uint8_t *) dst;
+}
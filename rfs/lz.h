@@ -0,0 +1,17 @@
+#ifndef  LZ_INC
+#define  LZ_INC
+
+#include <stdint.h>
+
+//LZ77系列的快速压缩, 格式与LZ4的block格式相同:
+//sequence: token | literal长度扩展 | literals | offset(2字节, 小端) | match长度扩展
+//token高4位是literal长度, 低4位是match长度-4, 等于15时后面跟着若干字节的扩展(255表示还有);
+//最后一个sequence只有literals
+
+//压缩slen字节的src到dst, 返回压缩后的长度; 超过dcap时返回-1
+int lz_compress(const char * src, uint32_t slen, char * dst, uint32_t dcap);
+
+//解压, 返回解压后的长度; 数据不对或超过dcap时返回-1
+int lz_decompress(const char * src, uint32_t slen, char * dst, uint32_t dcap);
+
+#endif
@@ -1,5 +1,11 @@
 #include "rfs.h"
-#include "doubly_list.h"
+#include "bitmap.h"
+#include "timing_wheel.h"
+#include "value_cache.h"
+#include "aio.h"
+#include "wal.h"
+#include "crc32c.h"
+#include "lz.h"
 #include "config.h"
 #include <stdio.h>
 #include <string.h>
@@ -12,27 +18,37 @@
 #include <time.h>
 #include <errno.h>
 #include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sys/syscall.h>
 
 #define MIN(a, b) (((a) < (b)) ? (a) : (b))
 #define CHK_RET(x) do { if (x != 0) return -1; } while (0)
 
 typedef struct {
-    FILE *         fp;
+    int            fd;             //未打开或被描述符缓存关掉时为-1, 读写前用_file_fd取, 用完_file_put
     char           path[256];
-    stDoublyList * grids_translist;
+    stBitmap     * grids_bitmap;   //1表示格子已用
+    char *         map;            //IO_ENGINE_MMAP时整个文件的映射, 否则为NULL
+    uint8_t        no_compact;     //有大value的段, rfs_compact不搬这个文件
+    uint32_t       pins;           //指向映射的rfs_view个数, 不为0时rfs_compact不删除这个文件
+    int            dfd;            //IO_ENGINE_DIRECT时以O_DIRECT打开的同一个文件, 用于整块读写格子, 否则为-1, 与fd一起打开和关闭
+    stFile         file;           //自己的类型和编号
+    stFile         lru_prev;       //max_open_fd_num不为0时, 已打开的文件按最近使用排成链表
+    stFile         lru_next;
+    uint32_t       fd_refs;        //_file_fd取走还没有_file_put的次数, 不为0时描述符缓存不关它
+    uint32_t       gen;            //这个位置的文件被删除(rfs_compact搬空后释放等)时加1, 与之后新建的同编号文件区分开
 } stFileInfo;
 
-enum {
-    grpIdle = 0,
-    grpUsed = 1,
-    grpCount
-};
-
 typedef struct {
     uint16_t file_type;
     uint16_t file_no;
     uint32_t grid_num;
     uint32_t grid_size;
+    uint32_t data_offset; //第一个格子的偏移, 0表示sizeof(stFileHeader)(旧版本的文件)
 } _stFileHeader;
 
 typedef struct {
@@ -42,8 +58,22 @@ typedef struct {
     };
 } stFileHeader;
 
+#define GRID_MAGIC (0x5247) //"GR"
+
+#define GRID_FLAG_CRC        (0x01) //crc有效
+#define GRID_FLAG_COMPRESSED (0x02) //value是lz_compress压缩后的数据, 压缩前的长度为raw_len
+#define GRID_FLAG_LARGE      (0x04) //value是stLargeHeader, 真正的value在各段中
+#define GRID_FLAG_PART       (0x08) //大value的一段
+
 typedef struct {
     uint32_t write_time;
+    uint16_t magic;      //GRID_MAGIC, 旧版本的格子头没有初始化, magic不对时以下字段无效
+    uint8_t  flags;      //GRID_FLAG_*
+    uint8_t  reserved;
+    uint64_t lsn;        //最后一次写这个格子的操作的序号, 日志补写时据此跳过已写过的格子
+    uint32_t crc;        //type, klen, key, vlen, value的crc32c
+    uint16_t raw_len;    //GRID_FLAG_COMPRESSED时value压缩前的长度
+    uint32_t expire_time; //rfs_set_ex设置的过期时间, 0表示不过期
 } _stGridHeader;
 
 typedef struct {
@@ -60,21 +90,72 @@ typedef struct {
    | stFileHeader |    grid    |    grid    |    ......   |    gird    |
    +-------------------------------------------------------------------+
    -> gird_size <-     
+   第一个格子从data_offset开始, IO_ENGINE_DIRECT时stFileHeader之后补0到DIRECT_ALIGN
 
    +------+
    | grid |                          
    +-------------------------------------------------+      
    | stGridHeader | type | klen | key | vlen | value |
    +-------------------------------------------------+      
+
+   大value(rfs_lset)拆成多段, 每段占最大文件类型的一个格子, type和klen为0, 加载时当作空格子:
+   +------+
+   | part |
+   +----------------------------------------+
+   | stGridHeader | 0 | 0 | value中的一段 |
+   +----------------------------------------+
+   key所在的格子照常写入, value为stLargeHeader和各段的stIndex
 */
 
+//大value的key所在格子中的value, 后面跟着part_num个stIndex
+typedef struct {
+    uint32_t len;        //value的总长度
+    uint32_t part_num;
+} stLargeHeader;
+
+//大value的key所在格子及其各段的位置, 加载时据此占住各段的格子
+typedef struct {
+    uint64_t  head;      //index_to_int64(key所在的格子), LARGE_EMPTY表示空位
+    uint32_t  part_num;
+    stIndex * parts;
+} stLargeObj;
+
+//开放寻址, 线性探测
+typedef struct {
+    stLargeObj * slots;
+    uint32_t     cap;    //2的幂
+    uint32_t     num;
+} stLargeMap;
+
 typedef struct {
     uint16_t max_opened_file_no;
     uint32_t grid_num;
     uint32_t grid_size;
-    stFileInfo * file_info_array;
+    stFileInfo * file_info_array; //按file_no下标, 不够时_grow_files扩展, 只在独占rfs时扩展
+    uint32_t file_cap;            //file_info_array的长度
+    //分配格子时取free_files中的第一个文件, 没有时打开opened_files中第一个为0的文件
+    //加载完成后才创建, 加载时扫描线程并发地占格子
+    stBitmap * opened_files;
+    stBitmap * free_files; //已打开, 有空闲格子且不在被rfs_compact搬空
+    uint32_t data_offset;  //第一个格子在文件中的偏移, IO_ENGINE_DIRECT时文件头补齐到DIRECT_ALIGN
 } stFileTypeMng;
 
+//读接口可以并发, 各线程用自己的缓冲区代替private_data和batch_data
+typedef struct _stScratch {
+    struct _stScratch * next;
+    rfs               * pfs;    //线程退出时从pfs->scratches中摘下
+    char              * grid;   //大小为最大的grid_size
+    char              * batch;  //大小为batch_size
+} stScratch;
+
+//写操作放开pfs->lock等日志落盘时, 它要写的key; 同一个key的其他写操作等它完成
+typedef struct _stPending {
+    struct _stPending * next;
+    uint8_t             type;
+    uint16_t            klen;
+    const char        * kbuf;   //序列化后的key
+} stPending;
+
 struct _rfs 
 {
     stSysConfig     sys_config;
@@ -83,259 +164,151 @@ struct _rfs
     stKeyCallback * user_callbacks;
     stHashTable   * hash_table;
     stFileTypeMng * type_mng_array;
+    long            page_size;
 
     char          * private_data;
+    char          * batch_data;   //rfs_mget合并读的缓冲区, 大小为batch_size
+    uint32_t        batch_size;
+    char          * zero_data;    //rfs_mset合并写时填充格子空隙, 大小为最大的grid_size
+    char          * direct_data;  //IO_ENGINE_DIRECT时拼接要整块写入的格子, 按DIRECT_ALIGN对齐, 大小为最大的grid_size
+
+    stAio         * aio;          //第一次调用rfs_*_async时创建
+    stAioEvent    * aio_events;
+    struct _stAsyncReq * async_writes; //未完成的rfs_set_async
+    uint32_t        async_logging; //rfs_set_async中等日志落盘, 还没有提交的请求数
+
+    stWal         * wal;          //wal_mode为WAL_OFF时为NULL
+    stLargeMap      large;        //所有大value的各段
+    uint8_t         compacting;   //rfs_compact正在搬空compact_file, 此时不在其中分配格子
+    stFile          compact_file;
+    uint64_t        max_lsn;      //已分配的最大lsn, 不写日志时也用于区分重复key的新旧
+    stTimingWheel * timers;       //带过期时间的格子, data为index_to_int64, 到期后由rfs_expire检查并删除
+    stRfsStat       stat;
+    stValueCache  * value_cache;  //value_cache_size为0时为NULL
+
+    pthread_rwlock_t lock;         //rfs_get/rfs_mget等只读接口共享, 其他接口独占
+    pthread_mutex_t  cache_lock;   //读接口之间互斥地访问value_cache和命中统计
+    pthread_key_t    scratch_key;  //当前线程的stScratch
+    pthread_mutex_t  scratch_lock;
+    stScratch      * scratches;    //所有线程的stScratch, 线程退出时或rfs_destroy时释放
+
+    stPending      * pendings;     //放开lock等日志落盘的写操作涉及的key
+    pthread_mutex_t  pending_lock; //和pending_cond一起等pendings中的key
+    pthread_cond_t   pending_cond;
+
+    pthread_mutex_t  fd_lock;      //读接口之间互斥地打开, 关闭文件和调整fd_lru
+    stFile           fd_lru_head;  //最近使用的文件, LRU_NONE表示没有
+    stFile           fd_lru_tail;  //最久没用的文件, 超过max_open_fd_num时从这里开始关
+    uint32_t         open_fds;     //fd_lru中的文件数
 };
 
-static int _load_file(rfs * pfs, char * file)
-{
-    FILE * fp = fopen(file, "r+");
-    if (fp == NULL)
-    {
-        printf("(%s:%s)\tfailed to open file %s, reason: %s\n",
-                __FILE__, __FUNCTION__, file, strerror(errno));
-        return -1;
-    }
-
-    stFileHeader file_header;
-    fread(&file_header, sizeof(stFileHeader), 1, fp);
-
-    uint16_t file_type = file_header.header.file_type;
-    uint16_t file_no   = file_header.header.file_no;
-    uint32_t grid_num  = file_header.header.grid_num;
-    uint32_t grid_size = file_header.header.grid_size;
-
-    stSysConfig * psc = &pfs->sys_config;
-    if (file_type >= psc->max_file_type_num || file_no >= psc->max_open_file_num)
-    {
-        //TODO log error
-        return -1;
-    }
-
-    stFileTypeMng * pftm = pfs->type_mng_array + file_type;
-
-    if (grid_num != pftm->grid_num || grid_size != pftm->grid_size)
-    {
-        //TODO log error
-        return -1;
-    }
-
-    if (file_no > pftm->max_opened_file_no)
-        pftm->max_opened_file_no = file_no;
-
-    stFileInfo * pfi = pftm->file_info_array + file_no;
-
-    pfi->fp = fp;
-    strncpy(pfi->path, file, strlen(file));
-    if (pfi->grids_translist == NULL)
-    {
-        pfi->grids_translist = dl_create(grpCount, pftm->grid_num);
-        dl_init_group(pfi->grids_translist, grpIdle);
-    }
-
-    stIndex index;
-    index.file.file_type = file_type;
-    index.file.file_no   = file_no;
-
-    fseek(fp, 0, SEEK_END);
-    int64_t length = ftell(fp);
-    if (length == -1)
-    {
-        printf("(%s:%s)\tfailed to ftell file %s, reason: %s\n",
-                __FILE__, __FUNCTION__, file, strerror(errno));
-        return -1;
-    }
-
-    fseek(fp, sizeof(stFileHeader), SEEK_SET);
-
-    char key[MAX_KEY_LEN+1];
-    uint32_t idx = 0;
-    for (; idx < grid_num; ++idx)
-    {
-        uint32_t read_size = MIN((length - sizeof(stFileHeader) - grid_size * idx), grid_size);
-        char * p = pfs->private_data;
-        fread(p, 1, read_size, fp);
-
-        p += sizeof(stGridHeader);
-        uint8_t type = *(uint8_t *) p;
-        if (type == 0 || type >= pfs->type_count)
-            continue;
-        p += sizeof(uint8_t);
+#define BATCH_BUF_SIZE (1024*1024) //rfs_mget一次合并读的最大字节数
+#define COMPRESS_MIN_LEN (64)      //更短的value不压缩
+#define BATCH_MAX_GAP  (32*1024)   //rfs_mget合并读时允许夹带的空闲字节数
 
-        stKeyCallback * cb = pfs->user_callbacks + type;
+#define WAL_FILE_NAME   "rfs.wal"       //工作目录下的日志文件名
+#define INDEX_FILE_NAME "rfs.index"     //工作目录下的索引检查点文件名
+#define INDEX_TMP_NAME  "rfs.index.tmp"
+#define CLEAN_FILE_NAME "rfs.clean"     //正常退出的标记, 有它时检查点才可信
+#define WAL_FLUSH_SIZE (1024*1024) //WAL_ASYNC时攒够这么多字节的日志就落盘
 
-        uint16_t len  = *(uint16_t *) p;
-        if (len == 0)
-            continue;
-        p += sizeof(uint16_t);
+#define GRID_IOV_NUM (6)           //一个格子按文件格式图分成的段数
 
-        if (cb->deserialize(key, p, len) != 0)
-        {
-            //TODO log error
-            continue;
-        }
+#ifndef IOV_MAX
+#define IOV_MAX (1024)
+#endif
 
-        if (len > MAX_KEY_LEN)
-            continue;
+//linux的取值, 没有定义_GNU_SOURCE时unistd.h不提供
+#ifndef FALLOC_FL_PUNCH_HOLE
+#define FALLOC_FL_KEEP_SIZE  (0x01)
+#define FALLOC_FL_PUNCH_HOLE (0x02)
+#endif
 
-        key[len] = '\0';
-        p += len;
+#ifndef SEEK_DATA
+#define SEEK_DATA (3)
+#define SEEK_HOLE (4)
+#endif
 
-#if 0
-        char out[MAX_KEY_LEN+1] = {0};
-        cb->print(key, out);
-        printf("key is %s\n", out);
+//没有定义_GNU_SOURCE时fcntl.h只提供__O_DIRECT
+#ifndef O_DIRECT
+#define O_DIRECT __O_DIRECT
 #endif
 
-        index.grid_idx = idx;
-        if (hashtable_set(pfs->hash_table, key, &index, cb) != 0)
-        {
-            //TODO log error
-            continue;
-        }
+#define DIRECT_ALIGN (4096) //O_DIRECT读写的偏移, 长度和缓冲区地址的对齐字节数
 
-        dl_move_idx(pfi->grids_translist, idx, grpIdle, grpUsed);
+#define MAX_FILE_NUM (UINT16_MAX) //每种类型最多的文件数, file_no不超过MAX_FILE_NUM-1, 循环变量不会溢出
+#define LRU_NONE     (UINT16_MAX) //fd_lru中表示没有文件的file_type
 
-        if (read_size != grid_size)
-            break;
-    }
+//不加锁的接口实现, 对应的rfs_*加锁后调用它们; 内部互相调用时用这些
+static int _rfs_del(rfs * pfs, uint8_t type, void * key, char * info, uint16_t ilen);
+static int _rfs_poll(rfs * pfs, uint32_t min_complete);
+static int _expire_grid(rfs * pfs, stTimer * timer, uint32_t now);
+static int _async_busy(rfs * pfs, uint8_t type, const char * kbuf, uint16_t klen);
+static void _scratch_free(void * arg);
+static stScratch * _scratch(rfs * pfs);
+static void _rfs_free(rfs * pfs);
 
-    return 0;
+static inline uint64_t _grid_offset(stFileTypeMng * pftm, uint32_t grid_idx)
+{
+    return pftm->data_offset + (uint64_t) pftm->grid_size * grid_idx;
 }
 
-static int _rfs_init(rfs * pfs)
+//将数据文件整个映射到内存
+//映射前先给整个文件分配磁盘空间: 稀疏文件在磁盘满时第一次写到没分配的页会收到SIGBUS, 分配失败时在这里返回错误
+static int _map_file(rfs * pfs, stFileTypeMng * pftm, stFileInfo * pfi)
 {
-    char * working_dir = pfs->sys_config.working_dir;
-    char   file[256] = {0};
+    assert(pfi->fd >= 0 && pfi->map == NULL);
 
-    if (access(working_dir, 0) != 0)
+    uint64_t size = _grid_offset(pftm, pftm->grid_num);
+    int fd = pfi->fd;
+
+    int err = posix_fallocate(fd, 0, size);
+    if (err != 0)
     {
-        printf("(%s:%s)\trfs working directory %s does not exist, check your config!!!\n",
-                __FILE__, __FUNCTION__, working_dir);
+        printf("(%s:%s)\tfailed to allocate file %s, reason: %s\n",
+                __FILE__, __FUNCTION__, pfi->path, strerror(err));
         return -1;
     }
 
-    DIR *dir = opendir(working_dir);
-    if (dir == NULL)
+    void * map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED)
     {
-        printf("(%s:%s)\tfailed to open dir %s, reason: %s\n",
-                __FILE__, __FUNCTION__, working_dir, strerror(errno));
+        printf("(%s:%s)\tfailed to mmap file %s, reason: %s\n",
+                __FILE__, __FUNCTION__, pfi->path, strerror(errno));
         return -1;
     }
 
-    struct stat st;
-    struct dirent *ent;
-    while ((ent = readdir(dir)) != NULL)
-    {
-        if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0)
-            continue;
-
-        sprintf(file, "%s/%s", working_dir, ent->d_name);
-
-        stat(file, &st);
-        if (S_ISREG(st.st_mode))
-        {
-            printf("(%s:%s)\tloading file %s\n", __FILE__, __FUNCTION__, file);
-            if (_load_file(pfs, file) != 0)
-            {
-                //TODO log error
-                printf("(%s:%s)\tfailed to load file %s\n", __FILE__, __FUNCTION__, file);
-                continue;
-            }
-            printf("(%s:%s)\tsuccessfully load file %s\n", __FILE__, __FUNCTION__, file);
-        }
-    };
-
+    pfi->map = map;
     return 0;
 }
 
-rfs * rfs_create(stSysConfig sys_config, stUserConfig user_config, uint8_t type_count, stKeyCallback* user_callbacks)
+//按msync_policy将映射区[offset, offset+len)刷回磁盘
+static int _sync_map(rfs * pfs, stFileInfo * pfi, uint64_t offset, uint32_t len)
 {
-    rfs * pfs             = calloc(1, sizeof(rfs));
-    if (pfs == NULL)
-        return NULL;
-
-    pfs->sys_config       = sys_config;
-    pfs->user_config      = user_config;
-    pfs->type_count       = type_count;
-    pfs->user_callbacks   = calloc(type_count, sizeof(stKeyCallback));
-    if (pfs->user_callbacks == NULL)
-        return NULL;
-
-    uint8_t i = 0;
-    for (; i < type_count; ++i)
-        pfs->user_callbacks[i] = user_callbacks[i];
-
-    pfs->hash_table = hashtable_create(sys_config.hashtable_list_num, sys_config.hashtable_node_num);
-    if (pfs->hash_table == NULL)
-        return NULL;
-
-    pfs->type_mng_array = calloc(sys_config.max_file_type_num, sizeof(stFileTypeMng));
-    if (pfs->type_mng_array == NULL)
-        return NULL;
-
-    uint16_t file_type = 0;
-    stFileTypeMng * pftm;
-    for (; file_type < sys_config.max_file_type_num; ++file_type)
-    {
-        pftm = pfs->type_mng_array + file_type;
-
-        pftm->max_opened_file_no = 0;
-        if (file_type == 0)
-            pftm->grid_size = sys_config.base_file_grid_size;
-        else
-        {
-            stFileTypeMng * p_pre_mng = pfs->type_mng_array + file_type - 1;
-            pftm->grid_size = p_pre_mng->grid_size * sys_config.grid_size_growth_factor;
-        }
-        pftm->grid_num = sys_config.file_size / pftm->grid_size;
-        pftm->file_info_array = calloc(sys_config.max_open_file_num, sizeof(stFileInfo));
-    }
-
-    pfs->private_data = calloc(1, pftm->grid_size);
+    uint8_t policy = pfs->user_config.msync_policy;
+    if (policy == MSYNC_NONE)
+        return 0;
 
-    _rfs_init(pfs);
-
-    return pfs;
+    uint64_t begin = offset & ~((uint64_t) pfs->page_size - 1);
+    return msync(pfi->map + begin, offset + len - begin, (policy == MSYNC_SYNC) ? MS_SYNC : MS_ASYNC);
 }
 
-int rfs_destroy(rfs * pfs)
+//整个文件落盘; 描述符被描述符缓存关掉时临时打开, 不占缓存的位置
+static int _sync_file(stFileTypeMng * pftm, stFileInfo * pfi)
 {
-    assert(pfs != NULL);
-
-    free(pfs->user_callbacks);
-    hashtable_destroy(pfs->hash_table);
-
-    uint16_t type = 0;
-    for (; type < pfs->sys_config.max_file_type_num; ++type)
-    {
-        stFileTypeMng * pftm = pfs->type_mng_array + type;
-        if (pftm == NULL)
-            continue;
-
-        uint16_t no = 0;
-        for (; no <= pftm->max_opened_file_no; ++no)
-        {
-            stFileInfo * pfi = pftm->file_info_array + no;
-            if (pfi == NULL)
-                continue;
-
-            if (pfi->fp != NULL)
-                fclose(pfi->fp);
-
-            if (pfi->grids_translist != NULL)
-                dl_destroy(pfi->grids_translist);
+    if (pfi->map != NULL)
+        return msync(pfi->map, _grid_offset(pftm, pftm->grid_num), MS_SYNC);
 
-            free(pfi);
-        }
-        free(pftm);
-    }
-    free(pfs->type_mng_array);
+    if (pfi->fd >= 0)
+        return fdatasync(pfi->fd);
 
-    free(pfs->private_data);
-    free(pfs);
+    int fd = open(pfi->path, O_RDWR);
+    if (fd < 0)
+        return -1;
 
-    return 0;
+    int r = fdatasync(fd);
+    close(fd);
+    return r;
 }
 
 //找到grid_size >= size的最小文件类型
@@ -354,7 +327,7 @@ static int _get_file_type(rfs * pfs, uint16_t start_type, uint32_t size)
     return -1;
 }
 
-static FILE * _create_file(rfs * pfs, uint16_t file_type, uint16_t file_no, uint32_t grid_num, uint32_t grid_size)
+static int _create_file(rfs * pfs, stFileInfo * pfi, uint16_t file_type, uint16_t file_no, uint32_t grid_num, uint32_t grid_size)
 {
     stSysConfig * psc = &pfs->sys_config;
 
@@ -371,336 +344,5454 @@ static FILE * _create_file(rfs * pfs, uint16_t file_type, uint16_t file_no, uint
     strcat (working, pos+strlen(matcher)); \
     sprintf(dst, working, replace); \
     ret = 0; } while (0)
-#define RET_NULL(x) do { if (x != 0) return NULL; } while(0)
 
     int ret = -1;
     TMR(ret, name, name, "$(file_type)", "%d", file_type);
-    RET_NULL(ret);
+    CHK_RET(ret);
 
     TMR(ret, name, name, "$(file_no)",   "%d", file_no);
-    RET_NULL(ret);
+    CHK_RET(ret);
 
     TMR(ret, name, name, "$(grid_num)",  "%d", grid_num);
-    RET_NULL(ret);
+    CHK_RET(ret);
 
     TMR(ret, name, name, "$(grid_size)", "%d", grid_size);
-    RET_NULL(ret);
+    CHK_RET(ret);
 
-#undef RET_NULL
 #undef TMR
 
-    FILE * fp = fopen(name, "w+");
-    if (fp == NULL)
+    int fd = open(name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
     {
         printf("(%s:%s)\tfailed to open file %s, reason: %s\n", 
                 __FILE__, __FUNCTION__, name, strerror(errno));
-        return NULL;
+        return -1;
     }
 
     stFileHeader header;
+    memset(&header, 0, sizeof(header));
     header.header.file_type = file_type;
     header.header.file_no   = file_no;
     header.header.grid_num  = pfs->type_mng_array[file_type].grid_num;
     header.header.grid_size = pfs->type_mng_array[file_type].grid_size;
+    header.header.data_offset = pfs->type_mng_array[file_type].data_offset;
 
-    fwrite(&header, sizeof(header), 1, fp);
-    truncate(name, grid_size * grid_num + sizeof(stFileHeader));
-
-    return fp;
-}
-
-//在[begin_type, end_type]中找到grid_size >= size的最小文件类型, 文件号和格子下标
-static int _get_idx(rfs * pfs, uint16_t begin_type, uint16_t end_type, uint32_t size, uint16_t * file_type, uint16_t * file_no, uint32_t * grid_idx)
-{
-    stSysConfig * psc = &pfs->sys_config;
-
-    int ftype = begin_type;
-    uint16_t fno   = 0;
-    while (1)
+    if (pwrite(fd, &header, sizeof(header), 0) != sizeof(header) 
+            || ftruncate(fd, (uint64_t) grid_size * grid_num + header.header.data_offset) != 0)
     {
-        int new_ftype = _get_file_type(pfs, ftype, size);
-        if (new_ftype != begin_type && new_ftype == ftype)
-            ftype = new_ftype + 1;
-        else ftype = new_ftype;
-
-        if (ftype == -1 || ftype > end_type)
-        {
-            //TODO log error, alert
-            return -1;
-        }
+        printf("(%s:%s)\tfailed to init file %s, reason: %s\n", 
+                __FILE__, __FUNCTION__, name, strerror(errno));
+        close(fd);
+        return -1;
+    }
 
-        stFileTypeMng * pftm = pfs->type_mng_array + ftype;
+    pfi->fd = fd;
+    strncpy(pfi->path, name, sizeof(pfi->path) - 1);
 
-        fno = 0;
-        for (; fno < psc->max_open_file_num; ++fno)
-        {
-            stFileInfo * pfi = pftm->file_info_array + fno;
-            assert(pfi != NULL);
+    return 0;
+}
 
-            if (pfi->fp == NULL)
-            {
-                assert(pfi->grids_translist == NULL);
+//文件在文件集中, 描述符可能被描述符缓存关掉了
+static inline int _file_exists(stFileInfo * pfi)
+{
+    return pfi->grids_bitmap != NULL;
+}
 
-                //TODO log error
-                pfi->fp = _create_file(pfs, ftype, fno, pftm->grid_num, pftm->grid_size);
-                if (pfi->fp == NULL)
-                    return -1;
+//file_info_array至少能放下num个文件, 新的位置都是空的
+static int _grow_files(stFileTypeMng * pftm, uint32_t num)
+{
+    if (num <= pftm->file_cap)
+        return 0;
+    if (num > MAX_FILE_NUM)
+        return -1;
 
-                pfi->grids_translist = dl_create(grpCount, pftm->grid_num);
-                dl_init_group(pfi->grids_translist, grpIdle);
-                if (fno > pftm->max_opened_file_no)
-                    pftm->max_opened_file_no = fno;
-            }
+    uint32_t cap = (pftm->file_cap > 0) ? pftm->file_cap : 1;
+    while (cap < num)
+        cap *= 2;
+    cap = MIN(cap, MAX_FILE_NUM);
 
-            int idx = dl_get_group_head(pfi->grids_translist, grpIdle);
-            if (idx < 0)
-                continue;
+    stFileInfo * array = realloc(pftm->file_info_array, (uint64_t) cap * sizeof(stFileInfo));
+    if (array == NULL)
+        return -1;
 
-            *file_type = ftype;
-            *file_no   = fno;
-            *grid_idx  = (uint32_t) idx;
+    memset(array + pftm->file_cap, 0, (uint64_t) (cap - pftm->file_cap) * sizeof(stFileInfo));
 
-            return 0;
-        }
+    uint32_t no = pftm->file_cap;
+    for (; no < cap; ++no)
+    {
+        array[no].fd  = -1;
+        array[no].dfd = -1;
     }
 
-    return -1;
+    pftm->file_info_array = array;
+    pftm->file_cap        = cap;
+    return 0;
 }
 
-static int _write(rfs * pfs, FILE * fp, uint16_t real_len, stGridHeader * grid_header, uint8_t type, char * key, uint16_t klen, char * value, uint16_t vlen)
+//按文件的状态更新opened_files和free_files
+static void _update_file_bits(rfs * pfs, uint16_t file_type, uint16_t file_no)
 {
-    assert(fp != NULL);
-
-    //TODO optimize, reduce system call num
-
-    char * p = pfs->private_data;
-
-    memcpy(p, grid_header, sizeof(stGridHeader));
-    p += sizeof(stGridHeader);
-
-    memcpy(p, &type, sizeof(uint8_t));
-    p += sizeof(uint8_t);
+    stFileTypeMng * pftm = pfs->type_mng_array + file_type;
+    if (pftm->opened_files == NULL)
+        return;
 
-    memcpy(p, &klen, sizeof(uint16_t));
-    p += sizeof(uint16_t);
+    stFileInfo * pfi = pftm->file_info_array + file_no;
 
-    memcpy(p, key, klen);
-    p += klen;
+    int opened = _file_exists(pfi);
+    int free   = opened && bm_count(pfi->grids_bitmap) < pftm->grid_num
+            && !(pfs->compacting && pfs->compact_file.file_type == file_type && pfs->compact_file.file_no == file_no);
 
-    memcpy(p, &vlen, sizeof(uint16_t));
-    p += sizeof(uint16_t);
+    //位已经是要设置的值时bm_set/bm_clear返回-1, 不用管
+    opened ? bm_set(pftm->opened_files, file_no) : bm_clear(pftm->opened_files, file_no);
+    free   ? bm_set(pftm->free_files, file_no)   : bm_clear(pftm->free_files, file_no);
+}
 
-    memcpy(p, value, vlen);
-    p += vlen;
+//加载完成后按各文件的已用格子数建立opened_files和free_files
+static int _init_file_bits(rfs * pfs)
+{
+    uint16_t type = 0;
+    for (; type < pfs->sys_config.max_file_type_num; ++type)
+    {
+        stFileTypeMng * pftm = pfs->type_mng_array + type;
 
-    assert(p-pfs->private_data == real_len);
+        pftm->opened_files = bm_create(MAX_FILE_NUM);
+        pftm->free_files   = bm_create(MAX_FILE_NUM);
+        if (pftm->opened_files == NULL || pftm->free_files == NULL)
+            return -1;
 
-    uint16_t r = fwrite(pfs->private_data, 1, real_len, fp);
-    if (r == real_len) return 0;
-    else return -1;
+        uint16_t no = 0;
+        for (; no <= pftm->max_opened_file_no; ++no)
+            _update_file_bits(pfs, type, no);
+    }
 
     return 0;
 }
 
-static int _set_grid(rfs * pfs, FILE * fp, uint32_t offset, uint32_t now, uint16_t real_len, uint8_t type, char * key, uint16_t klen, char * value, uint16_t vlen)
+static inline stFileInfo * _file_at(rfs * pfs, stFile file)
 {
-    fseek(fp, offset, SEEK_SET);
+    return pfs->type_mng_array[file.file_type].file_info_array + file.file_no;
+}
 
-    stGridHeader grid_header;
-    if (now != 0)
-        grid_header.header.write_time = now;
+static void _lru_unlink(rfs * pfs, stFileInfo * pfi)
+{
+    if (pfi->lru_prev.file_type != LRU_NONE)
+        _file_at(pfs, pfi->lru_prev)->lru_next = pfi->lru_next;
     else
-        grid_header.header.write_time = time(0);
+        pfs->fd_lru_head = pfi->lru_next;
 
-    return _write(pfs, fp, real_len, &grid_header, type, key, klen, value, vlen);
+    if (pfi->lru_next.file_type != LRU_NONE)
+        _file_at(pfs, pfi->lru_next)->lru_prev = pfi->lru_prev;
+    else
+        pfs->fd_lru_tail = pfi->lru_prev;
 }
 
-static int _del_grid(rfs * pfs, FILE * fp, uint32_t offset)
+static void _lru_push(rfs * pfs, stFileInfo * pfi)
 {
-    fseek(fp, offset + sizeof(stGridHeader), SEEK_SET);
+    pfi->lru_prev.file_type = LRU_NONE;
+    pfi->lru_next           = pfs->fd_lru_head;
 
-    uint32_t empty = 0;
-    uint32_t r = fwrite(&empty, 1, sizeof(uint32_t), fp);
-    if (r == sizeof(uint32_t)) return 0;
-    else return -1;
+    if (pfs->fd_lru_head.file_type != LRU_NONE)
+        _file_at(pfs, pfs->fd_lru_head)->lru_prev = pfi->file;
+    else
+        pfs->fd_lru_tail = pfi->file;
+    pfs->fd_lru_head = pfi->file;
+}
 
-    return 0;
+//格子按块对齐时另外以O_DIRECT打开, 文件系统不支持(如tmpfs)时仍走page cache
+static void _open_direct(rfs * pfs, stFileTypeMng * pftm, stFileInfo * pfi)
+{
+    if (pfs->user_config.io_engine == IO_ENGINE_DIRECT && pfi->dfd < 0
+            && pftm->data_offset % DIRECT_ALIGN == 0 && pftm->grid_size % DIRECT_ALIGN == 0)
+    {
+        pfi->dfd = open(pfi->path, O_RDWR | O_DIRECT);
+        if (pfi->dfd < 0)
+        {
+            printf("(%s:%s)\tfailed to open file %s with O_DIRECT, reason: %s\n",
+                    __FILE__, __FUNCTION__, pfi->path, strerror(errno));
+        }
+    }
 }
 
-int64_t rfs_set(rfs * pfs, uint32_t now, uint8_t type, void * key, char * value, uint16_t vlen, char * info, uint16_t ilen)
+//关掉描述符, IO_ENGINE_MMAP时映射区仍然有效
+static void _close_fd(rfs * pfs, stFileInfo * pfi)
 {
-    stSysConfig  * psc = &pfs->sys_config;
-    stUserConfig * puc = &pfs->user_config;
+    if (pfi->fd < 0)
+        return;
 
-    char kbuf[MAX_KEY_LEN] = {0};
+    close(pfi->fd);
+    if (pfi->dfd >= 0)
+        close(pfi->dfd);
+
+    pfi->fd  = -1;
+    pfi->dfd = -1;
+
+    if (pfs->user_config.max_open_fd_num != 0)
+    {
+        _lru_unlink(pfs, pfi);
+        --pfs->open_fds;
+    }
+}
+
+//登记新打开的描述符, 超过max_open_fd_num时从最久没用的开始关掉没人在用的
+//异步读写的线程池可能还要用描述符, 有未完成的请求时不关; 请求只在独占rfs时提交和取走, 读接口看到的个数不会变
+static void _lru_add(rfs * pfs, stFileInfo * pfi)
+{
+    _lru_push(pfs, pfi);
+    ++pfs->open_fds;
+
+    if (pfs->aio != NULL && aio_inflight(pfs->aio) > 0)
+        return;
+
+    uint32_t limit = pfs->user_config.max_open_fd_num;
+    stFile file = pfs->fd_lru_tail;
+    while (pfs->open_fds > limit && file.file_type != LRU_NONE)
+    {
+        stFileInfo * victim = _file_at(pfs, file);
+        file = victim->lru_prev;
+
+        //与_file_put的release配对, 看到0时读线程对描述符的使用都已结束
+        if (__atomic_load_n(&victim->fd_refs, __ATOMIC_ACQUIRE) == 0)
+            _close_fd(pfs, victim);
+    }
+}
+
+//取文件的描述符, 被描述符缓存关掉时重新打开; 读接口可以并发调用
+//dfd不为NULL时同时取O_DIRECT的描述符; 两个都在fd_lock下取, 调用者只用取到的值, 不再读pfi->fd/dfd
+static int _file_fds(rfs * pfs, stFileInfo * pfi, int * dfd)
+{
+    if (pfs->user_config.max_open_fd_num == 0)
+    {
+        if (dfd != NULL)
+            *dfd = pfi->dfd;
+        return pfi->fd;
+    }
+
+    pthread_mutex_lock(&pfs->fd_lock);
+    __atomic_add_fetch(&pfi->fd_refs, 1, __ATOMIC_RELAXED);
+    if (pfi->fd >= 0)
+    {
+        _lru_unlink(pfs, pfi);
+        _lru_push(pfs, pfi);
+    }
+    else
+    {
+        int fd = open(pfi->path, O_RDWR);
+        if (fd < 0)
+        {
+            printf("(%s:%s)\tfailed to reopen file %s, reason: %s\n",
+                    __FILE__, __FUNCTION__, pfi->path, strerror(errno));
+            __atomic_sub_fetch(&pfi->fd_refs, 1, __ATOMIC_RELAXED);
+            pthread_mutex_unlock(&pfs->fd_lock);
+            return -1;
+        }
+
+        pfi->fd = fd;
+        _open_direct(pfs, pfs->type_mng_array + pfi->file.file_type, pfi);
+        _lru_add(pfs, pfi);
+    }
+
+    int fd = pfi->fd;
+    if (dfd != NULL)
+        *dfd = pfi->dfd;
+    pthread_mutex_unlock(&pfs->fd_lock);
+
+    return fd;
+}
+
+static inline int _file_fd(rfs * pfs, stFileInfo * pfi)
+{
+    return _file_fds(pfs, pfi, NULL);
+}
+
+//用完_file_fd取到的描述符, 之后不能再用它
+static inline void _file_put(rfs * pfs, stFileInfo * pfi)
+{
+    if (pfs->user_config.max_open_fd_num != 0)
+        __atomic_sub_fetch(&pfi->fd_refs, 1, __ATOMIC_RELEASE);
+}
+
+//新打开或新建的文件: 登记到描述符缓存, 创建格子的位图, IO_ENGINE_MMAP时映射整个文件
+//失败时文件已经在描述符缓存中, 由调用者_remove_file或留着按pread/pwrite读写
+static int _init_file(rfs * pfs, stFileTypeMng * pftm, stFileInfo * pfi, uint16_t file_no)
+{
+    //只在独占rfs时打开或新建文件, 不用加fd_lock; 映射完之前不能被关掉
+    pfi->file.file_type = pftm - pfs->type_mng_array;
+    pfi->file.file_no   = file_no;
+    __atomic_add_fetch(&pfi->fd_refs, 1, __ATOMIC_RELAXED);
+    if (pfs->user_config.max_open_fd_num != 0)
+        _lru_add(pfs, pfi);
+
+    if (pfi->grids_bitmap == NULL)
+        pfi->grids_bitmap = bm_create(pftm->grid_num);
+
+    int ret = 0;
+    if (pfi->grids_bitmap == NULL)
+        ret = -1;
+    else if (pfs->user_config.io_engine == IO_ENGINE_MMAP && pfi->map == NULL)
+        ret = _map_file(pfs, pftm, pfi);
+    else
+        _open_direct(pfs, pftm, pfi);
+
+    __atomic_sub_fetch(&pfi->fd_refs, 1, __ATOMIC_RELEASE);
+
+    if (pfi->grids_bitmap != NULL)
+    {
+        if (file_no > pftm->max_opened_file_no)
+            pftm->max_opened_file_no = file_no;
+        _update_file_bits(pfs, pfi->file.file_type, file_no);
+    }
+
+    return ret;
+}
+
+static void _close_file(rfs * pfs, stFileTypeMng * pftm, stFileInfo * pfi)
+{
+    if (pfi->map != NULL)
+        munmap(pfi->map, _grid_offset(pftm, pftm->grid_num));
+
+    pfi->map = NULL;
+    _close_fd(pfs, pfi);
+}
+
+//关闭并删除文件, 它的位置空出来, 之后可以新建同编号的文件
+static int _remove_file(rfs * pfs, stFileTypeMng * pftm, stFileInfo * pfi)
+{
+    uint16_t file_no = pfi - pftm->file_info_array;
+    _close_file(pfs, pftm, pfi);
+
+    int ret = unlink(pfi->path);
+    if (ret != 0)
+    {
+        printf("(%s:%s)\tfailed to remove file %s, reason: %s\n",
+                __FILE__, __FUNCTION__, pfi->path, strerror(errno));
+    }
+
+    if (pfi->grids_bitmap != NULL)
+        bm_destroy(pfi->grids_bitmap);
+    uint32_t gen = pfi->gen;
+    memset(pfi, 0, sizeof(stFileInfo));
+    pfi->fd  = -1;
+    pfi->dfd = -1;
+    pfi->gen = gen + 1;
+    _update_file_bits(pfs, pftm - pfs->type_mng_array, file_no);
+
+    return ret;
+}
+
+//在[begin_type, end_type]中找到grid_size >= size的最小文件类型, 文件号和格子下标
+static int _get_idx(rfs * pfs, uint16_t begin_type, uint16_t end_type, uint32_t size, uint16_t * file_type, uint16_t * file_no, uint32_t * grid_idx)
+{
+    int ftype = _get_file_type(pfs, begin_type, size);
+    for (; ftype != -1 && ftype <= end_type; ++ftype)
+    {
+        stFileTypeMng * pftm = pfs->type_mng_array + ftype;
+        assert(pftm->opened_files != NULL);
+
+        int64_t fno = bm_next_set(pftm->free_files, 0);
+        if (fno < 0)
+        {
+            fno = bm_next_zero(pftm->opened_files, 0);
+            if (fno < 0 || _grow_files(pftm, fno + 1) != 0)
+                continue;
+
+            stFileInfo * pfi = pftm->file_info_array + fno;
+            assert(pfi->fd < 0 && pfi->grids_bitmap == NULL);
+
+            //TODO log error
+            if (_create_file(pfs, pfi, ftype, fno, pftm->grid_num, pftm->grid_size) != 0)
+                return -1;
+
+            //磁盘空间不够映射整个文件等, 新建的文件不留下
+            if (_init_file(pfs, pftm, pfi, fno) != 0)
+            {
+                _remove_file(pfs, pftm, pfi);
+                return -1;
+            }
+        }
+
+        int64_t idx = bm_next_zero(pftm->file_info_array[fno].grids_bitmap, 0);
+        assert(idx >= 0);
+
+        *file_type = ftype;
+        *file_no   = fno;
+        *grid_idx  = (uint32_t) idx;
+
+        return 0;
+    }
+
+    //TODO log error, alert
+    return -1;
+}
+
+static void _init_grid_header(stGridHeader * grid_header, uint32_t now, uint64_t lsn)
+{
+    memset(grid_header, 0, sizeof(stGridHeader));
+    grid_header->header.write_time = (now != 0) ? now : time(0);
+    grid_header->header.magic      = GRID_MAGIC;
+    grid_header->header.lsn        = lsn;
+}
+
+//旧版本写入的格子没有lsn, 视为0
+static inline uint64_t _grid_lsn(stGridHeader * grid_header)
+{
+    return (grid_header->header.magic == GRID_MAGIC) ? grid_header->header.lsn : 0;
+}
+
+static inline uint32_t _grid_expire(stGridHeader * grid_header)
+{
+    return (grid_header->header.magic == GRID_MAGIC) ? grid_header->header.expire_time : 0;
+}
+
+//过期时间已到, now为0时取当前时间
+static inline int _grid_expired(stGridHeader * grid_header, uint32_t now)
+{
+    uint32_t expire = _grid_expire(grid_header);
+    return expire != 0 && expire <= (now ? now : time(0));
+}
+
+//记下带过期时间的格子, 覆盖或删除后留下的旧项到期时由_expire_grid识别出来丢掉
+static inline void _add_timer(rfs * pfs, stIndex * index, uint32_t expire)
+{
+    if (expire != 0 && tw_add(pfs->timers, expire, index_to_int64(index)) != 0)
+        printf("(%s:%s)\tno memory for timer, the key will expire on access only\n", __FILE__, __FUNCTION__);
+}
+
+//参考文件格式图, 把一个格子的各段填到iov中, 返回段数GRID_IOV_NUM
+static int _grid_iov(struct iovec * iov, stGridHeader * grid_header, uint8_t * type, uint16_t * klen, char * key, uint16_t * vlen, char * value)
+{
+    struct iovec grid_iov[] = {
+        { grid_header, sizeof(stGridHeader) },
+        { type,        sizeof(uint8_t)      },
+        { klen,        sizeof(uint16_t)     },
+        { key,         *klen                },
+        { vlen,        sizeof(uint16_t)     },
+        { value,       *vlen                },
+    };
+    memcpy(iov, grid_iov, sizeof(grid_iov));
+
+    return sizeof(grid_iov) / sizeof(grid_iov[0]);
+}
+
+//按_grid_iov填好的各段计算格子的校验和, 写入格子头
+static void _grid_checksum(struct iovec * iov, int iovcnt)
+{
+    stGridHeader * grid_header = (stGridHeader *) iov[0].iov_base;
+
+    uint32_t crc = 0;
+    int i = 1;
+    for (; i < iovcnt; ++i)
+        crc = crc32c(crc, iov[i].iov_base, iov[i].iov_len);
+
+    grid_header->header.crc    = crc;
+    grid_header->header.flags |= GRID_FLAG_CRC;
+}
+
+static inline int _compressible(rfs * pfs, uint8_t type)
+{
+    return type < 32 && (pfs->user_config.compress_types & (1u << type)) != 0;
+}
+
+static inline int _grid_compressed(stGridHeader * grid_header)
+{
+    return grid_header->header.magic == GRID_MAGIC && (grid_header->header.flags & GRID_FLAG_COMPRESSED);
+}
+
+static inline int _grid_large(stGridHeader * grid_header)
+{
+    return grid_header->header.magic == GRID_MAGIC && (grid_header->header.flags & GRID_FLAG_LARGE);
+}
+
+//type需要压缩且压缩后更短时, 把压缩后的value写到zbuf(至少vlen字节), 格子头记下原长度
+//返回要写入格子的value, vlen改为它的长度; 格子大小按压缩后的长度选择
+static char * _compress_value(rfs * pfs, uint8_t type, stGridHeader * grid_header, char * value, uint16_t * vlen, char * zbuf)
+{
+    if (!_compressible(pfs, type) || *vlen < COMPRESS_MIN_LEN)
+        return value;
+
+    int zlen = lz_compress(value, *vlen, zbuf, *vlen - 1);
+    if (zlen < 0)
+        return value;
+
+    grid_header->header.flags  |= GRID_FLAG_COMPRESSED;
+    grid_header->header.raw_len = *vlen;
+    *vlen = zlen;
+
+    return zbuf;
+}
+
+//WAL_OP_DEL日志记录的数据
+static int _del_iov(struct iovec * iov, uint8_t * type, uint16_t * klen, char * key)
+{
+    struct iovec del_iov[] = {
+        { type, sizeof(uint8_t)  },
+        { klen, sizeof(uint16_t) },
+        { key,  *klen            },
+    };
+    memcpy(iov, del_iov, sizeof(del_iov));
+
+    return sizeof(del_iov) / sizeof(del_iov[0]);
+}
+
+static uint32_t _iov_len(struct iovec * iov, int iovcnt)
+{
+    uint32_t len = 0;
+
+    int i = 0;
+    for (; i < iovcnt; ++i)
+        len += iov[i].iov_len;
+
+    return len;
+}
+
+//各段按顺序聚集写入offset开始的len个字节
+static int _write(rfs * pfs, stFileInfo * pfi, uint64_t offset, struct iovec * iov, int iovcnt, uint32_t len)
+{
+    if (pfi->map != NULL)
+    {
+        char * p = pfi->map + offset;
+
+        int i = 0;
+        for (; i < iovcnt; ++i)
+        {
+            memcpy(p, iov[i].iov_base, iov[i].iov_len);
+            p += iov[i].iov_len;
+        }
+
+        assert(p - (pfi->map + offset) == len);
+        return _sync_map(pfs, pfi, offset, len);
+    }
+
+    int dfd = -1;
+    int fd = _file_fds(pfs, pfi, &dfd);
+    if (fd < 0)
+        return -1;
+
+    ssize_t r = 0;
+
+    //O_DIRECT只能整块写, 写入总是从格子开头开始, 格子中len之后的部分没有用, 补0到块边界
+    if (dfd >= 0 && offset % DIRECT_ALIGN == 0)
+    {
+        char * p = pfs->direct_data;
+
+        int i = 0;
+        for (; i < iovcnt; ++i)
+        {
+            memcpy(p, iov[i].iov_base, iov[i].iov_len);
+            p += iov[i].iov_len;
+        }
+
+        uint32_t size = (len + DIRECT_ALIGN - 1) / DIRECT_ALIGN * DIRECT_ALIGN;
+        memset(p, 0, size - len);
+
+        r = (pwrite(dfd, pfs->direct_data, size, offset) == size) ? len : -1;
+    }
+    else
+        r = pwritev(fd, iov, iovcnt, offset);
+
+    _file_put(pfs, pfi);
+    return (r == len) ? 0 : -1;
+}
+
+
+//读整个格子或相邻的多个格子, 有dfd且buf对齐时不经过page cache
+static ssize_t _pread_grids(rfs * pfs, stFileInfo * pfi, char * buf, uint64_t len, uint64_t offset)
+{
+    int dfd = -1;
+    int fd = _file_fds(pfs, pfi, &dfd);
+    if (fd < 0)
+        return -1;
+
+    ssize_t r = (dfd >= 0 && (uintptr_t) buf % DIRECT_ALIGN == 0) ? pread(dfd, buf, len, offset) : pread(fd, buf, len, offset);
+
+    _file_put(pfs, pfi);
+    return r;
+}
+
+static int _read_grid_header(rfs * pfs, stFileInfo * pfi, uint64_t offset, stGridHeader * grid_header)
+{
+    if (pfi->map != NULL)
+    {
+        memcpy(grid_header, pfi->map + offset, sizeof(stGridHeader));
+        return 0;
+    }
+
+    int fd = _file_fd(pfs, pfi);
+    if (fd < 0)
+        return -1;
+
+    ssize_t r = pread(fd, grid_header, sizeof(stGridHeader), offset);
+
+    _file_put(pfs, pfi);
+    return (r == sizeof(stGridHeader)) ? 0 : -1;
+}
+
+static inline stFileTypeMng * _type_mng(rfs * pfs, stIndex * index)
+{
+    return pfs->type_mng_array + index->file.file_type;
+}
+
+static inline stFileInfo * _file_info(rfs * pfs, stIndex * index)
+{
+    return _type_mng(pfs, index)->file_info_array + index->file.file_no;
+}
+
+static inline uint64_t _index_offset(rfs * pfs, stIndex * index)
+{
+    return _grid_offset(_type_mng(pfs, index), index->grid_idx);
+}
+
+//格子不小于punch_hole_size时, 释放格子头和type, klen之后的磁盘空间, 读出来是0
+//映射的文件不释放, 否则之后写到这些页时同样可能因为磁盘满收到SIGBUS
+static void _punch_grid(rfs * pfs, stIndex * index)
+{
+    uint32_t grid_size = _type_mng(pfs, index)->grid_size;
+    uint32_t min_size  = pfs->user_config.punch_hole_size;
+    if (min_size == 0 || grid_size < min_size || _file_info(pfs, index)->map != NULL)
+        return;
+
+    uint64_t page   = pfs->page_size;
+    uint64_t offset = _index_offset(pfs, index);
+    uint64_t begin  = (offset + sizeof(stGridHeader) + sizeof(uint32_t) + page - 1) & ~(page - 1);
+    uint64_t end    = (offset + grid_size) & ~(page - 1);
+    if (end <= begin)
+        return;
+
+    stFileInfo * pfi = _file_info(pfs, index);
+    int fd = _file_fd(pfs, pfi);
+    if (fd < 0)
+        return;
+
+    if (syscall(SYS_fallocate, fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, (off_t) begin, (off_t) (end - begin)) != 0)
+    {
+        printf("(%s:%s)\tfailed to punch hole in file %s, reason: %s\n",
+                __FILE__, __FUNCTION__, pfi->path, strerror(errno));
+        pfs->user_config.punch_hole_size = 0;
+    }
+
+    _file_put(pfs, pfi);
+}
+
+//rfs_get缓存的value, 后面跟着vlen字节解压后的value
+typedef struct {
+    uint32_t expire_time;
+    uint16_t vlen;
+    uint8_t  type;
+} stCachedValue;
+
+//格子被分配, 写入或删除后丢掉缓存中的旧value
+static inline void _uncache(rfs * pfs, stIndex * index)
+{
+    if (pfs->value_cache != NULL)
+    {
+        pthread_mutex_lock(&pfs->cache_lock);
+        vc_del(pfs->value_cache, index_to_int64(index));
+        pthread_mutex_unlock(&pfs->cache_lock);
+    }
+}
+
+//格子头之后的type和klen清零表示格子为空, 格子头记下删除操作的lsn
+static int _del_grid(rfs * pfs, stIndex * index, uint64_t lsn)
+{
+    _uncache(pfs, index);
+
+    stGridHeader grid_header;
+    _init_grid_header(&grid_header, 0, lsn);
+
+    uint32_t empty = 0;
+    struct iovec iov[] = {
+        { &grid_header, sizeof(stGridHeader) },
+        { &empty,       sizeof(uint32_t)     },
+    };
+
+    CHK_RET(_write(pfs, _file_info(pfs, index), _index_offset(pfs, index), iov, 2, sizeof(stGridHeader) + sizeof(uint32_t)));
+    _punch_grid(pfs, index);
+
+    return 0;
+}
+
+static int _mark_used(rfs * pfs, stIndex * index)
+{
+    stFileInfo * pfi = _file_info(pfs, index);
+    CHK_RET(bm_set(pfi->grids_bitmap, index->grid_idx));
+    _uncache(pfs, index);
+    _update_file_bits(pfs, index->file.file_type, index->file.file_no);
+    return 0;
+}
+
+static int _mark_idle(rfs * pfs, stIndex * index)
+{
+    stFileInfo * pfi = _file_info(pfs, index);
+    CHK_RET(bm_clear(pfi->grids_bitmap, index->grid_idx));
+    _uncache(pfs, index);
+    _update_file_bits(pfs, index->file.file_type, index->file.file_no);
+    return 0;
+}
+
+static int _cmp_index(const stIndex * a, const stIndex * b)
+{
+    if (a->file.file_type != b->file.file_type)
+        return (a->file.file_type < b->file.file_type) ? -1 : 1;
+    if (a->file.file_no != b->file.file_no)
+        return (a->file.file_no < b->file.file_no) ? -1 : 1;
+    if (a->grid_idx != b->grid_idx)
+        return (a->grid_idx < b->grid_idx) ? -1 : 1;
+    return 0;
+}
+
+#define LARGE_EMPTY    (UINT64_MAX)
+#define LARGE_MIN_CAP  (64)
+
+static inline uint32_t _large_slot(stLargeMap * map, uint64_t head)
+{
+    return (uint32_t) ((head * 0x9E3779B97F4A7C15ull) >> 32) & (map->cap - 1);
+}
+
+static stLargeObj * _large_find(rfs * pfs, stIndex * index)
+{
+    stLargeMap * map = &pfs->large;
+    if (map->num == 0)
+        return NULL;
+
+    uint64_t head = index_to_int64(index);
+    uint32_t i = _large_slot(map, head);
+    for (; map->slots[i].head != LARGE_EMPTY; i = (i + 1) & (map->cap - 1))
+    {
+        if (map->slots[i].head == head)
+            return map->slots + i;
+    }
+
+    return NULL;
+}
+
+static int _large_grow(stLargeMap * map)
+{
+    uint32_t cap = map->cap ? map->cap * 2 : LARGE_MIN_CAP;
+    stLargeObj * slots = malloc(cap * sizeof(stLargeObj));
+    if (slots == NULL)
+        return -1;
+
+    uint32_t i = 0;
+    for (; i < cap; ++i)
+        slots[i].head = LARGE_EMPTY;
+
+    stLargeObj * old = map->slots;
+    uint32_t old_cap = map->cap;
+    map->slots = slots;
+    map->cap   = cap;
+
+    for (i = 0; i < old_cap; ++i)
+    {
+        if (old[i].head == LARGE_EMPTY)
+            continue;
+
+        uint32_t j = _large_slot(map, old[i].head);
+        while (slots[j].head != LARGE_EMPTY)
+            j = (j + 1) & (cap - 1);
+        slots[j] = old[i];
+    }
+
+    free(old);
+    return 0;
+}
+
+//记下index处的大value的各段, parts由map接管; 失败时释放parts
+static int _large_put(rfs * pfs, stIndex * index, stIndex * parts, uint32_t part_num)
+{
+    stLargeMap * map = &pfs->large;
+
+    stLargeObj * obj = _large_find(pfs, index);
+    if (obj != NULL)
+    {
+        free(obj->parts);
+        obj->parts    = parts;
+        obj->part_num = part_num;
+        return 0;
+    }
+
+    if ((map->num + 1) * 4 > map->cap * 3 && _large_grow(map) != 0)
+    {
+        free(parts);
+        return -1;
+    }
+
+    uint64_t head = index_to_int64(index);
+    uint32_t i = _large_slot(map, head);
+    while (map->slots[i].head != LARGE_EMPTY)
+        i = (i + 1) & (map->cap - 1);
+
+    map->slots[i].head     = head;
+    map->slots[i].part_num = part_num;
+    map->slots[i].parts    = parts;
+    ++map->num;
+
+    return 0;
+}
+
+//删掉index处的记录, 不改变各段格子的占用情况
+static void _large_remove(rfs * pfs, stIndex * index)
+{
+    stLargeMap * map = &pfs->large;
+
+    stLargeObj * obj = _large_find(pfs, index);
+    if (obj == NULL)
+        return;
+
+    free(obj->parts);
+    --map->num;
+
+    //把后面探测链上的元素往前挪, 不需要删除标记
+    uint32_t mask = map->cap - 1;
+    uint32_t i = obj - map->slots;
+    uint32_t j = i;
+    while (1)
+    {
+        map->slots[i].head = LARGE_EMPTY;
+        do
+        {
+            j = (j + 1) & mask;
+            if (map->slots[j].head == LARGE_EMPTY)
+                return;
+        } while (((j - _large_slot(map, map->slots[j].head)) & mask) < ((j - i) & mask));
+
+        map->slots[i] = map->slots[j];
+        i = j;
+    }
+}
+
+//index处原来是大value时放回它的各段
+static void _large_free(rfs * pfs, stIndex * index)
+{
+    stLargeObj * obj = _large_find(pfs, index);
+    if (obj == NULL)
+        return;
+
+    uint32_t i = 0;
+    for (; i < obj->part_num; ++i)
+    {
+        _mark_idle(pfs, obj->parts + i);
+        _punch_grid(pfs, obj->parts + i);
+    }
+
+    _large_remove(pfs, index);
+}
+
+static void _large_clear(rfs * pfs)
+{
+    stLargeMap * map = &pfs->large;
+
+    uint32_t i = 0;
+    for (; i < map->cap; ++i)
+    {
+        if (map->slots[i].head != LARGE_EMPTY)
+            free(map->slots[i].parts);
+    }
+
+    free(map->slots);
+    memset(map, 0, sizeof(stLargeMap));
+}
+
+//每段的格子大小和能放的value字节数
+static inline stFileTypeMng * _part_type_mng(rfs * pfs)
+{
+    return pfs->type_mng_array + pfs->sys_config.max_file_type_num - 1;
+}
+
+static inline uint32_t _part_payload(rfs * pfs)
+{
+    return _part_type_mng(pfs)->grid_size - sizeof(stGridHeader) - sizeof(uint8_t) - sizeof(uint16_t);
+}
+
+
+//解析大value的key所在格子中的value, 返回各段的位置, NULL表示数据不对
+static stIndex * _large_parse(char * value, uint16_t vlen, stLargeHeader * header)
+{
+    if (vlen < sizeof(stLargeHeader))
+        return NULL;
+
+    memcpy(header, value, sizeof(stLargeHeader));
+    if (vlen != sizeof(stLargeHeader) + (uint64_t) header->part_num * sizeof(stIndex))
+        return NULL;
+
+    return (stIndex *) (value + sizeof(stLargeHeader));
+}
+
+//_large_parse并复制各段的位置
+static stIndex * _large_copy_parts(char * value, uint16_t vlen, uint32_t * part_num)
+{
+    stLargeHeader header;
+    stIndex * parts = _large_parse(value, vlen, &header);
+    if (parts == NULL)
+        return NULL;
+
+    stIndex * copy = malloc(header.part_num * sizeof(stIndex) + 1);
+    if (copy != NULL)
+        memcpy(copy, parts, header.part_num * sizeof(stIndex));
+
+    *part_num = header.part_num;
+    return copy;
+}
+
+typedef struct {
+    uint8_t  type;
+    uint16_t klen;
+    char *   key;
+    uint16_t vlen;
+    char *   value;
+} stGridData;
+
+//解析格子, 参考文件格式图; size为grid开始可以读的字节数
+//klen/vlen越界, 或者verify且格子有校验和但对不上时返回-1
+static int _parse_grid(char * grid, uint32_t size, int verify, stGridData * data)
+{
+    char * p   = grid + sizeof(stGridHeader);
+    char * end = grid + size;
+
+    if (p + sizeof(uint8_t) + sizeof(uint16_t) > end)
+        return -1;
+
+    data->type = *(uint8_t *) p;
+    p += sizeof(uint8_t);
+    data->klen = *(uint16_t *) p;
+    p += sizeof(uint16_t);
+
+    if (data->klen > MAX_KEY_LEN || p + data->klen + sizeof(uint16_t) > end)
+        return -1;
+
+    data->key = p;
+    p += data->klen;
+    data->vlen = *(uint16_t *) p;
+    p += sizeof(uint16_t);
+
+    if (p + data->vlen > end)
+        return -1;
+
+    data->value = p;
+    p += data->vlen;
+
+    stGridHeader * grid_header = (stGridHeader *) grid;
+    if (verify && grid_header->header.magic == GRID_MAGIC && (grid_header->header.flags & GRID_FLAG_CRC))
+    {
+        char * begin = grid + sizeof(stGridHeader);
+        if (crc32c(0, begin, p - begin) != grid_header->header.crc)
+            return -1;
+    }
+
+    return 0;
+}
+
+//从格子中取出value
+//解析读到的格子, data.value指向格子中(可能压缩过)的value
+static int _check_value(rfs * pfs, char * grid, uint32_t size, uint8_t type, stGridData * data)
+{
+    if (_parse_grid(grid, size, pfs->user_config.verify_checksum_when_get, data) != 0 || data->type != type)
+    {
+        stGridHeader * grid_header = (stGridHeader *) grid;
+        printf("(%s:%s)\tgrid is corrupted, lsn: %lu\n", __FILE__, __FUNCTION__, _grid_lsn(grid_header));
+        return -1;
+    }
+
+    //大value只能用rfs_lget读, 过期的key视为不存在
+    stGridHeader * grid_header = (stGridHeader *) grid;
+    if (_grid_large(grid_header) || _grid_expired(grid_header, 0))
+        return -1;
+
+    return 0;
+}
+
+//把压缩的value解压到value, 空间至少为raw_len
+static int _decompress_value(char * grid, stGridData * data, char * value, uint16_t * vlen)
+{
+    stGridHeader * grid_header = (stGridHeader *) grid;
+    uint16_t raw_len = grid_header->header.raw_len;
+    if (lz_decompress(data->value, data->vlen, value, raw_len) != raw_len)
+    {
+        printf("(%s:%s)\tfailed to decompress value, lsn: %lu\n", __FILE__, __FUNCTION__, _grid_lsn(grid_header));
+        return -1;
+    }
+
+    *vlen = raw_len;
+    return 0;
+}
+
+static int _get_value(rfs * pfs, char * grid, uint32_t size, uint8_t type, char * value, uint16_t * vlen)
+{
+    stGridData data;
+    CHK_RET(_check_value(pfs, grid, size, type, &data));
+
+    if (_grid_compressed((stGridHeader *) grid))
+        return _decompress_value(grid, &data, value, vlen);
+
+    *vlen = data.vlen;
+    memcpy(value, data.value, data.vlen);
+
+    return 0;
+}
+
+enum {
+    WAL_OP_SET = 1,
+    WAL_OP_DEL = 2,
+};
+
+//日志记录, 后面跟着len字节的数据
+//WAL_OP_SET: 要写入index的格子; WAL_OP_DEL: type, klen, key
+typedef struct {
+    uint8_t  op;
+    uint8_t  relocate;   //WAL_OP_SET时是否同时删除old_index
+    uint16_t reserved;
+    uint32_t len;
+    stIndex  index;
+    stIndex  old_index;
+} stWalRecord;
+
+//工作目录下的日志, 检查点等非数据文件
+static void _meta_path(rfs * pfs, const char * name, char * path, size_t size)
+{
+    snprintf(path, size, "%s/%s", pfs->sys_config.working_dir, name);
+}
+
+static void _sync_dir(rfs * pfs)
+{
+    int dir = open(pfs->sys_config.working_dir, O_RDONLY);
+    if (dir >= 0)
+    {
+        fsync(dir);
+        close(dir);
+    }
+}
+
+static int _is_meta_file(const char * name)
+{
+    return strcmp(name, WAL_FILE_NAME) == 0 || strcmp(name, INDEX_FILE_NAME) == 0 || strcmp(name, INDEX_TMP_NAME) == 0
+        || strcmp(name, CLEAN_FILE_NAME) == 0;
+}
+
+//写数据之前先记日志, 返回这次写操作的lsn, 0表示失败
+//不写日志时lsn只用于加载时区分重复key的新旧
+static uint64_t _wal_log(rfs * pfs, uint8_t op, stIndex * index, stIndex * old_index, struct iovec * iov, int iovcnt, uint32_t len)
+{
+    if (pfs->wal == NULL)
+        return ++pfs->max_lsn;
+
+    stWalRecord rec;
+    memset(&rec, 0, sizeof(rec));
+    rec.op    = op;
+    rec.len   = len;
+    rec.index = *index;
+    if (old_index != NULL)
+    {
+        rec.relocate  = 1;
+        rec.old_index = *old_index;
+    }
+
+    struct iovec rec_iov[1 + GRID_IOV_NUM];
+    rec_iov[0].iov_base = &rec;
+    rec_iov[0].iov_len  = sizeof(rec);
+    memcpy(rec_iov + 1, iov, iovcnt * sizeof(struct iovec));
+
+    uint64_t lsn = wal_append(pfs->wal, rec_iov, 1 + iovcnt);
+    if (lsn == 0)
+    {
+        printf("(%s:%s)\tfailed to append wal record\n", __FILE__, __FUNCTION__);
+        return 0;
+    }
+
+    pfs->max_lsn = lsn;
+    return lsn;
+}
+
+//WAL_SYNC时等lsn及之前的日志落盘, WAL_ASYNC时攒够WAL_FLUSH_SIZE才落盘
+static int _wal_sync(rfs * pfs, uint64_t lsn)
+{
+    if (pfs->wal == NULL)
+        return 0;
+
+    if (pfs->user_config.wal_mode == WAL_SYNC)
+        return wal_commit(pfs->wal, lsn);
+
+    if (wal_buffered(pfs->wal) >= WAL_FLUSH_SIZE)
+        return wal_commit(pfs->wal, 0);
+
+    return 0;
+}
+
+//同_wal_sync, 但落盘期间放开pfs->lock, 其他线程的写操作可以接着记日志, 由同一次fdatasync落盘
+//keys[0, num)是这次写操作要写的key, 放开锁期间它们的写操作等这次完成; 返回时重新持有锁, 其他状态可能已经变了
+static int _wal_wait(rfs * pfs, uint64_t lsn, stPending * keys, uint32_t num)
+{
+    if (pfs->wal == NULL)
+        return 0;
+
+    if (pfs->user_config.wal_mode != WAL_SYNC)
+    {
+        if (wal_buffered(pfs->wal) < WAL_FLUSH_SIZE)
+            return 0;
+        lsn = 0;
+    }
+
+    uint32_t i = 0;
+    for (; i < num; ++i)
+    {
+        keys[i].next  = pfs->pendings;
+        pfs->pendings = keys + i;
+    }
+
+    pthread_rwlock_unlock(&pfs->lock);
+    int ret = wal_commit(pfs->wal, lsn);
+    pthread_rwlock_wrlock(&pfs->lock);
+
+    if (num == 0)
+        return ret;
+
+    stPending ** pp = &pfs->pendings;
+    while (*pp != NULL)
+    {
+        if (*pp >= keys && *pp < keys + num)
+            *pp = (*pp)->next;
+        else
+            pp = &(*pp)->next;
+    }
+
+    pthread_mutex_lock(&pfs->pending_lock);
+    pthread_cond_broadcast(&pfs->pending_cond);
+    pthread_mutex_unlock(&pfs->pending_lock);
+
+    return ret;
+}
+
+//key上是否有未完成的写操作: 1表示在_wal_wait中等日志落盘, 2表示有未完成的rfs_set_async
+static int _key_busy(rfs * pfs, uint8_t type, const char * kbuf, uint16_t klen)
+{
+    stPending * p = pfs->pendings;
+    for (; p != NULL; p = p->next)
+    {
+        if (p->type == type && p->klen == klen && memcmp(p->kbuf, kbuf, klen) == 0)
+            return 1;
+    }
+
+    return _async_busy(pfs, type, kbuf, klen) ? 2 : 0;
+}
+
+//放开pfs->lock, 等某个_wal_wait结束后重新加锁
+static void _wait_pending(rfs * pfs)
+{
+    pthread_mutex_lock(&pfs->pending_lock);
+    pthread_rwlock_unlock(&pfs->lock);
+    pthread_cond_wait(&pfs->pending_cond, &pfs->pending_lock);
+    pthread_mutex_unlock(&pfs->pending_lock);
+    pthread_rwlock_wrlock(&pfs->lock);
+}
+
+//写一个key之前调用: 等它在_wal_wait中的写操作完成, 有未完成的rfs_set_async时返回-1
+static int _wait_key(rfs * pfs, uint8_t type, const char * kbuf, uint16_t klen)
+{
+    int busy;
+    while ((busy = _key_busy(pfs, type, kbuf, klen)) == 1)
+        _wait_pending(pfs);
+
+    return busy ? -1 : 0;
+}
+
+//所有数据文件落盘
+static int _sync_files(rfs * pfs)
+{
+    int ret = 0;
+
+    uint16_t type = 0;
+    for (; type < pfs->sys_config.max_file_type_num; ++type)
+    {
+        stFileTypeMng * pftm = pfs->type_mng_array + type;
+
+        uint16_t no = 0;
+        for (; no <= pftm->max_opened_file_no; ++no)
+        {
+            stFileInfo * pfi = pftm->file_info_array + no;
+            if (!_file_exists(pfi))
+                continue;
+
+            if (_sync_file(pftm, pfi) != 0)
+            {
+                printf("(%s:%s)\tfailed to sync file %s, reason: %s\n",
+                        __FILE__, __FUNCTION__, pfi->path, strerror(errno));
+                ret = -1;
+            }
+        }
+    }
+
+    return ret;
+}
+
+#define INDEX_MAGIC    (0x58444952) //"RIDX"
+#define INDEX_VERSION  (3)
+#define INDEX_BUF_SIZE (1024*1024)
+
+/*
+   +-------+
+   | index |
+   +------------------------------------------------------------------------------------+
+   | stIndexFileHeader | stFile * file_num | entry * entry_num | large * large_num | stTimer * timer_num |
+   +------------------------------------------------------------------------------------+
+
+   entry: | stIndex | type | klen | key |, key为序列化后的key
+   large: | stIndex | part_num | stIndex * part_num |, 大value的key所在的格子和各段
+   stTimer: 时间轮中未到期的项, 包括已经被覆盖或删除的格子的旧项
+   格子的占用情况不单独保存, 由entry和large中的stIndex得到
+*/
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t lsn;          //写检查点时的max_lsn, 之后的写操作在日志中
+    uint64_t entry_num;
+    uint64_t size;         //整个文件的长度
+    uint32_t file_num;     //写检查点时打开的数据文件个数
+    uint32_t config_crc;   //决定格子位置的配置, 配置改变后检查点作废
+    uint32_t crc;          //头部之后所有内容的crc32c
+    uint32_t large_num;
+    uint32_t timer_num;
+} stIndexFileHeader;
+
+typedef struct {
+    int      fd;
+    char *   buf;
+    uint32_t len;
+    uint64_t offset;
+    uint32_t crc;
+} stIndexWriter;
+
+static uint32_t _config_crc(rfs * pfs)
+{
+    stSysConfig * psc = &pfs->sys_config;
+
+    uint32_t conf[] = {
+        psc->max_file_type_num, psc->max_open_file_num, psc->file_size, psc->base_file_grid_size,
+        psc->grid_size_growth_factor, pfs->type_count, MAX_KEY_LEN, sizeof(stGridHeader),
+    };
+
+    return crc32c(0, conf, sizeof(conf));
+}
+
+static int _index_flush(stIndexWriter * w)
+{
+    w->crc = crc32c(w->crc, w->buf, w->len);
+    if (pwrite(w->fd, w->buf, w->len, w->offset) != w->len)
+        return -1;
+
+    w->offset += w->len;
+    w->len = 0;
+    return 0;
+}
+
+static int _index_put(stIndexWriter * w, const void * data, uint32_t len)
+{
+    if (w->len + len > INDEX_BUF_SIZE)
+        CHK_RET(_index_flush(w));
+
+    memcpy(w->buf + w->len, data, len);
+    w->len += len;
+    return 0;
+}
+
+static int _index_put_timer(void * ctx, stTimer * timer)
+{
+    return _index_put((stIndexWriter *) ctx, timer, sizeof(stTimer));
+}
+
+static int _index_write(rfs * pfs, stIndexWriter * w, stIndexFileHeader * header)
+{
+    uint16_t type = 0;
+    for (; type < pfs->sys_config.max_file_type_num; ++type)
+    {
+        stFileTypeMng * pftm = pfs->type_mng_array + type;
+
+        uint16_t no = 0;
+        for (; no <= pftm->max_opened_file_no; ++no)
+        {
+            if (!_file_exists(pftm->file_info_array + no))
+                continue;
+
+            stFile file = { type, no };
+            CHK_RET(_index_put(w, &file, sizeof(file)));
+            ++header->file_num;
+        }
+    }
+
+    char     key[MAX_KEY_LEN];
+    uint8_t  key_type = 0;
+    uint16_t klen = 0;
+    stIndex  index;
+    int32_t  idx  = -1;
+    while (hashtable_next_entry(pfs->hash_table, &idx, &key_type, key, &klen, &index) == 0)
+    {
+        CHK_RET(_index_put(w, &index, sizeof(stIndex)));
+        CHK_RET(_index_put(w, &key_type, sizeof(uint8_t)));
+        CHK_RET(_index_put(w, &klen, sizeof(uint16_t)));
+        CHK_RET(_index_put(w, key, klen));
+        ++header->entry_num;
+    }
+
+    stLargeMap * map = &pfs->large;
+    uint32_t i = 0;
+    for (; i < map->cap; ++i)
+    {
+        stLargeObj * obj = map->slots + i;
+        if (obj->head == LARGE_EMPTY)
+            continue;
+
+        int64_to_index(obj->head, &index);
+        CHK_RET(_index_put(w, &index, sizeof(stIndex)));
+        CHK_RET(_index_put(w, &obj->part_num, sizeof(uint32_t)));
+        CHK_RET(_index_put(w, obj->parts, obj->part_num * sizeof(stIndex)));
+        ++header->large_num;
+    }
+
+    CHK_RET(tw_foreach(pfs->timers, _index_put_timer, w));
+    header->timer_num = tw_count(pfs->timers);
+
+    CHK_RET(_index_flush(w));
+
+    header->magic      = INDEX_MAGIC;
+    header->version    = INDEX_VERSION;
+    header->lsn        = pfs->max_lsn;
+    header->size       = w->offset;
+    header->config_crc = _config_crc(pfs);
+    header->crc        = w->crc;
+
+    if (pwrite(w->fd, header, sizeof(stIndexFileHeader), 0) != sizeof(stIndexFileHeader))
+        return -1;
+
+    return fdatasync(w->fd);
+}
+
+//把hash_table中的所有key和打开的文件写到检查点文件, 调用前数据文件必须已落盘
+//先写临时文件再rename, 中途失败时原来的检查点不受影响
+static int _index_save(rfs * pfs)
+{
+    char path[512], tmp[512];
+    _meta_path(pfs, INDEX_FILE_NAME, path, sizeof(path));
+    _meta_path(pfs, INDEX_TMP_NAME, tmp, sizeof(tmp));
+
+    stIndexWriter w;
+    memset(&w, 0, sizeof(w));
+    w.offset = sizeof(stIndexFileHeader);
+    w.buf    = malloc(INDEX_BUF_SIZE);
+    w.fd     = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (w.buf == NULL || w.fd < 0)
+    {
+        printf("(%s:%s)\tfailed to open file %s, reason: %s\n",
+                __FILE__, __FUNCTION__, tmp, strerror(errno));
+        free(w.buf);
+        if (w.fd >= 0) close(w.fd);
+        return -1;
+    }
+
+    stIndexFileHeader header;
+    memset(&header, 0, sizeof(header));
+
+    int ret = _index_write(pfs, &w, &header);
+    close(w.fd);
+    free(w.buf);
+
+    if (ret != 0 || rename(tmp, path) != 0)
+    {
+        printf("(%s:%s)\tfailed to write file %s, reason: %s\n",
+                __FILE__, __FUNCTION__, path, strerror(errno));
+        unlink(tmp);
+        return -1;
+    }
+
+    _sync_dir(pfs);
+
+    return 0;
+}
+
+//正常退出的标记: 记下检查点的lsn, 数据文件和检查点都落盘后才写入
+typedef struct {
+    uint32_t magic;
+    uint32_t crc;          //lsn的crc32c
+    uint64_t lsn;
+} stCleanMark;
+
+static int _clean_mark(rfs * pfs, uint64_t lsn)
+{
+    char path[512];
+    _meta_path(pfs, CLEAN_FILE_NAME, path, sizeof(path));
+
+    stCleanMark mark = { INDEX_MAGIC, crc32c(0, &lsn, sizeof(lsn)), lsn };
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0 || pwrite(fd, &mark, sizeof(mark), 0) != sizeof(mark) || fdatasync(fd) != 0)
+    {
+        printf("(%s:%s)\tfailed to write file %s, reason: %s\n",
+                __FILE__, __FUNCTION__, path, strerror(errno));
+        if (fd >= 0) close(fd);
+        unlink(path);
+        return -1;
+    }
+    close(fd);
+
+    _sync_dir(pfs);
+    return 0;
+}
+
+//上次正常退出时检查点的lsn, 0表示没有正常退出
+static uint64_t _clean_lsn(rfs * pfs)
+{
+    char path[512];
+    _meta_path(pfs, CLEAN_FILE_NAME, path, sizeof(path));
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return 0;
+
+    stCleanMark mark;
+    ssize_t r = pread(fd, &mark, sizeof(mark), 0);
+    close(fd);
+
+    if (r != sizeof(mark) || mark.magic != INDEX_MAGIC || mark.crc != crc32c(0, &mark.lsn, sizeof(mark.lsn)))
+        return 0;
+
+    return mark.lsn;
+}
+
+//WAL_SYNC时每次清空日志都写检查点, 检查点之后的写操作都在日志中, 异常退出后加载检查点再按日志补上
+static int _index_periodic(rfs * pfs)
+{
+    return pfs->user_config.index_checkpoint && pfs->user_config.wal_mode == WAL_SYNC && pfs->wal != NULL;
+}
+
+//正常退出时数据文件已落盘, 日志已清空, 写检查点和正常退出的标记
+static int _index_checkpoint(rfs * pfs)
+{
+    if (!pfs->user_config.index_checkpoint)
+        return 0;
+
+    //清空日志时已经写过
+    if (!_index_periodic(pfs))
+        CHK_RET(_index_save(pfs));
+    return _clean_mark(pfs, pfs->max_lsn);
+}
+
+//丢掉已加载的索引, 回到扫描数据文件之前的状态
+static int _index_reset(rfs * pfs)
+{
+    stSysConfig * psc = &pfs->sys_config;
+
+    hashtable_destroy(pfs->hash_table);
+    pfs->hash_table = hashtable_create(psc->hashtable_node_num, psc->hashtable_list_num);
+    if (pfs->hash_table == NULL)
+        return -1;
+
+    tw_destroy(pfs->timers);
+    pfs->timers = tw_create(time(0));
+    if (pfs->timers == NULL)
+        return -1;
+
+    _large_clear(pfs);
+
+    uint16_t type = 0;
+    for (; type < psc->max_file_type_num; ++type)
+    {
+        stFileTypeMng * pftm = pfs->type_mng_array + type;
+
+        uint16_t no = 0;
+        for (; no <= pftm->max_opened_file_no; ++no)
+        {
+            stFileInfo * pfi = pftm->file_info_array + no;
+            if (pfi->grids_bitmap != NULL)
+                bm_clear_all(pfi->grids_bitmap);
+        }
+    }
+
+    return 0;
+}
+
+//index指向一个已打开的文件中的格子
+static int _valid_index(rfs * pfs, stIndex * index)
+{
+    stSysConfig * psc = &pfs->sys_config;
+    if (index->file.file_type >= psc->max_file_type_num || index->file.file_no >= _type_mng(pfs, index)->file_cap)
+        return 0;
+
+    return _file_exists(_file_info(pfs, index)) && index->grid_idx < _type_mng(pfs, index)->grid_num;
+}
+
+//加载完所有key后占住各段的格子, 各段指向不存在的文件时丢掉这个大value的key
+static void _large_mark_parts(rfs * pfs)
+{
+    stLargeMap * map = &pfs->large;
+    uint16_t part_type = pfs->sys_config.max_file_type_num - 1;
+
+    uint32_t i = 0;
+    for (; i < map->cap; ++i)
+    {
+        stLargeObj * obj = map->slots + i;
+        if (obj->head == LARGE_EMPTY)
+            continue;
+
+        uint32_t k = 0;
+        for (; k < obj->part_num; ++k)
+        {
+            stIndex * part = obj->parts + k;
+            if (part->file.file_type != part_type || !_valid_index(pfs, part) || _mark_used(pfs, part) != 0)
+            {
+                printf("(%s:%s)\tpart %u of large value at %ld is missing\n",
+                        __FILE__, __FUNCTION__, k, (long) obj->head);
+                break;
+            }
+        }
+
+        //部分段找不到时已占住的段不放回, 等删除或覆盖这个key时统一放回
+        obj->part_num = k;
+    }
+}
+
+//解析检查点中的一个entry的type, klen, key, 返回下一个entry的位置, NULL表示数据不对
+static char * _parse_key(rfs * pfs, char * p, char * end, uint8_t * type, char * key)
+{
+    if (p + sizeof(uint8_t) + sizeof(uint16_t) > end)
+        return NULL;
+
+    *type = *(uint8_t *) p;
+    p += sizeof(uint8_t);
+
+    uint16_t klen;
+    memcpy(&klen, p, sizeof(uint16_t));
+    p += sizeof(uint16_t);
+
+    if (*type == 0 || *type >= pfs->type_count || klen > MAX_KEY_LEN || p + klen > end)
+        return NULL;
+
+    if (pfs->user_callbacks[*type].deserialize(key, p, klen) != 0)
+        return NULL;
+
+    return p + klen;
+}
+
+//把检查点中的文件和key加载到hash_table
+static int _index_apply(rfs * pfs, char * p, char * end, stIndexFileHeader * header)
+{
+    if (p + (uint64_t) header->file_num * sizeof(stFile) > end)
+        return -1;
+
+    uint32_t i = 0;
+    for (; i < header->file_num; ++i)
+    {
+        stIndex index;
+        memcpy(&index.file, p, sizeof(stFile));
+        index.grid_idx = 0;
+        p += sizeof(stFile);
+
+        if (!_valid_index(pfs, &index))
+        {
+            printf("(%s:%s)\tdata file of file_type %hu, file_no %hu is missing\n",
+                    __FILE__, __FUNCTION__, index.file.file_type, index.file.file_no);
+            return -1;
+        }
+    }
+
+    uint64_t n = 0;
+    for (; n < header->entry_num; ++n)
+    {
+        if (p + sizeof(stIndex) > end)
+            return -1;
+
+        stIndex index;
+        memcpy(&index, p, sizeof(stIndex));
+
+        uint8_t type;
+        char    key[MAX_KEY_LEN+1];
+        p = _parse_key(pfs, p + sizeof(stIndex), end, &type, key);
+        if (p == NULL || !_valid_index(pfs, &index))
+            return -1;
+
+        stKeyCallback * cb = pfs->user_callbacks + type;
+        CHK_RET(hashtable_set(pfs->hash_table, key, &index, cb));
+        CHK_RET(_mark_used(pfs, &index));
+    }
+
+    //各段的格子在补完日志后由_large_mark_parts占住
+    for (i = 0; i < header->large_num; ++i)
+    {
+        stIndex  index;
+        uint32_t part_num;
+        if (p + sizeof(stIndex) + sizeof(uint32_t) > end)
+            return -1;
+        memcpy(&index, p, sizeof(stIndex));
+        memcpy(&part_num, p + sizeof(stIndex), sizeof(uint32_t));
+        p += sizeof(stIndex) + sizeof(uint32_t);
+
+        if (p + (uint64_t) part_num * sizeof(stIndex) > end)
+            return -1;
+
+        stIndex * parts = malloc(part_num * sizeof(stIndex) + 1);
+        if (parts == NULL)
+            return -1;
+        memcpy(parts, p, part_num * sizeof(stIndex));
+        p += part_num * sizeof(stIndex);
+
+        CHK_RET(_large_put(pfs, &index, parts, part_num));
+    }
+
+    if (p + (uint64_t) header->timer_num * sizeof(stTimer) > end)
+        return -1;
+
+    for (i = 0; i < header->timer_num; ++i, p += sizeof(stTimer))
+    {
+        stTimer timer;
+        memcpy(&timer, p, sizeof(stTimer));
+        CHK_RET(tw_add(pfs->timers, timer.expire, timer.data));
+    }
+
+    return (p == end) ? 0 : -1;
+}
+
+typedef struct {
+    rfs *    pfs;
+    uint64_t lsn;  //检查点的lsn, 之前的记录已在检查点中
+} stIndexRedo;
+
+//按一条日志记录修改刚加载的索引, 数据文件已由_wal_redo补写过
+static int _index_redo(void * ctx, uint64_t lsn, char * buf, uint32_t len)
+{
+    stIndexRedo * redo = (stIndexRedo *) ctx;
+    rfs * pfs = redo->pfs;
+    stWalRecord * rec = (stWalRecord *) buf;
+
+    if (lsn <= redo->lsn)
+        return 0;
+
+    if (len < sizeof(stWalRecord) || len != sizeof(stWalRecord) + rec->len || !_valid_index(pfs, &rec->index))
+        return -1;
+
+    char * p   = buf + sizeof(stWalRecord);
+    char * end = p + rec->len;
+
+    uint8_t type;
+    char    key[MAX_KEY_LEN+1];
+    stIndex cur;
+
+    if (rec->op == WAL_OP_DEL)
+    {
+        if (_parse_key(pfs, p, end, &type, key) == NULL)
+            return -1;
+
+        stKeyCallback * cb = pfs->user_callbacks + type;
+        if (hashtable_get(pfs->hash_table, key, &cur, NULL, cb) == 0 && _cmp_index(&cur, &rec->index) == 0)
+        {
+            hashtable_del(pfs->hash_table, key, cb);
+            _mark_idle(pfs, &cur);
+            _large_free(pfs, &cur);
+        }
+        return 0;
+    }
+
+    stGridData data;
+    if (rec->op != WAL_OP_SET || _parse_grid(p, rec->len, 0, &data) != 0 || data.type == 0 || data.type >= pfs->type_count
+            || pfs->user_callbacks[data.type].deserialize(key, data.key, data.klen) != 0)
+        return -1;
+
+    //key原来的格子和大value的各段放回, 挪走时旧格子也放回
+    stKeyCallback * cb = pfs->user_callbacks + data.type;
+    if (hashtable_get(pfs->hash_table, key, &cur, NULL, cb) == 0)
+    {
+        _large_free(pfs, &cur);
+        _mark_idle(pfs, &cur);
+    }
+    if (rec->relocate && _valid_index(pfs, &rec->old_index))
+        _mark_idle(pfs, &rec->old_index);
+
+    CHK_RET(hashtable_set(pfs->hash_table, key, &rec->index, cb));
+    CHK_RET(_mark_used(pfs, &rec->index));
+
+    //各段的格子之后由_large_mark_parts占住
+    stGridHeader * grid_header = (stGridHeader *) p;
+    if (_grid_large(grid_header))
+    {
+        uint32_t  part_num = 0;
+        stIndex * parts    = _large_copy_parts(data.value, data.vlen, &part_num);
+        if (parts == NULL)
+            return -1;
+        CHK_RET(_large_put(pfs, &rec->index, parts, part_num));
+    }
+    _add_timer(pfs, &rec->index, _grid_expire(grid_header));
+
+    return 0;
+}
+
+//日志要接得上检查点, 中间缺了记录时检查点不可用
+static int _index_redo_wal(rfs * pfs, uint64_t lsn)
+{
+    if (wal_base_lsn(pfs->wal) > lsn + 1)
+    {
+        printf("(%s:%s)\twal starts at lsn %lu, after index checkpoint lsn %lu\n", __FILE__, __FUNCTION__,
+                (unsigned long) wal_base_lsn(pfs->wal), (unsigned long) lsn);
+        return -1;
+    }
+
+    stIndexRedo redo = { pfs, lsn };
+    return wal_replay(pfs->wal, _index_redo, &redo);
+}
+
+//加载索引检查点, 只有上次正常退出时写的检查点可信, WAL_SYNC时除外:
+//异常退出时数据文件中可能有比检查点和日志都新的格子(WAL_ASYNC丢失的最后一批日志), 按检查点加载会指向已被改写的格子
+//WAL_SYNC时格子都先记日志再写, 日志接得上检查点时按日志补上检查点之后的写操作
+//返回0表示已加载, -1表示检查点不存在或不可用, 此时需要扫描数据文件
+static int _index_load(rfs * pfs)
+{
+    if (!pfs->user_config.index_checkpoint)
+        return -1;
+
+    char path[512];
+    _meta_path(pfs, INDEX_FILE_NAME, path, sizeof(path));
+
+    int periodic = _index_periodic(pfs);
+    uint64_t clean_lsn = _clean_lsn(pfs);
+    if (clean_lsn == 0 && !periodic)
+    {
+        if (access(path, F_OK) == 0)
+            printf("(%s:%s)\tlast shutdown was not clean, index checkpoint %s is ignored\n", __FILE__, __FUNCTION__, path);
+        return -1;
+    }
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return -1;
+
+    struct stat st;
+    stIndexFileHeader header;
+    if (fstat(fd, &st) != 0 || pread(fd, &header, sizeof(header), 0) != sizeof(header)
+            || header.magic != INDEX_MAGIC || header.version != INDEX_VERSION
+            || header.size != (uint64_t) st.st_size || header.config_crc != _config_crc(pfs) || (!periodic && header.lsn != clean_lsn))
+    {
+        printf("(%s:%s)\tindex checkpoint %s is not usable\n", __FILE__, __FUNCTION__, path);
+        close(fd);
+        return -1;
+    }
+
+    char * map = mmap(NULL, header.size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        printf("(%s:%s)\tfailed to mmap file %s, reason: %s\n",
+                __FILE__, __FUNCTION__, path, strerror(errno));
+        return -1;
+    }
+    madvise(map, header.size, MADV_SEQUENTIAL);
+
+    char * begin = map + sizeof(stIndexFileHeader);
+    char * end   = map + header.size;
+
+    int ret = -1;
+    if (crc32c(0, begin, end - begin) != header.crc)
+        printf("(%s:%s)\tindex checkpoint %s is corrupted\n", __FILE__, __FUNCTION__, path);
+    else
+        ret = _index_apply(pfs, begin, end, &header);
+    munmap(map, header.size);
+
+    if (header.lsn > pfs->max_lsn)
+        pfs->max_lsn = header.lsn;
+
+    //WAL_SYNC时按日志补上检查点之后的写操作;
+    //其余模式正常退出时日志已清空, 日志中有检查点之后的记录说明不是这次退出写的检查点
+    if (ret == 0 && periodic)
+        ret = _index_redo_wal(pfs, header.lsn);
+    else if (ret == 0 && pfs->wal != NULL && wal_next_lsn(pfs->wal) - 1 > header.lsn)
+        ret = -1;
+
+    if (ret != 0)
+    {
+        printf("(%s:%s)\tindex checkpoint %s is not usable, fall back to scanning data files\n", __FILE__, __FUNCTION__, path);
+        _index_reset(pfs);
+        return -1;
+    }
+
+    _large_mark_parts(pfs);
+
+    printf("(%s:%s)\tload %lu keys from index checkpoint %s\n", __FILE__, __FUNCTION__,
+            (unsigned long) header.entry_num, path);
+
+    return 0;
+}
+
+//数据文件落盘后日志中的记录都不再需要, 清空日志
+static int _wal_checkpoint(rfs * pfs)
+{
+    if (pfs->wal == NULL)
+        return 0;
+
+    //未完成的rfs_set_async和_wal_wait中的写操作还没有写数据, 它们的日志不能清空
+    if (pfs->async_writes != NULL || pfs->pendings != NULL)
+        return 0;
+
+    CHK_RET(_sync_files(pfs));
+
+    //写不成功时旧的检查点和清空后的日志接不上, 加载时会发现
+    if (_index_periodic(pfs))
+        _index_save(pfs);
+
+    return wal_reset(pfs->wal, pfs->max_lsn + 1);
+}
+
+static void _wal_maybe_checkpoint(rfs * pfs)
+{
+    if (pfs->wal != NULL && wal_size(pfs->wal) > pfs->user_config.wal_checkpoint_size)
+        _wal_checkpoint(pfs);
+}
+
+//按日志补写一个格子, grid为NULL时删除格子; 格子的lsn不小于日志的lsn时说明已经写过
+static int _redo_grid(rfs * pfs, stIndex * index, uint64_t lsn, char * grid, uint32_t len)
+{
+    stSysConfig * psc = &pfs->sys_config;
+    if (index->file.file_type >= psc->max_file_type_num || _grow_files(_type_mng(pfs, index), index->file.file_no + 1) != 0)
+        return -1;
+
+    stFileTypeMng * pftm = _type_mng(pfs, index);
+    stFileInfo    * pfi  = _file_info(pfs, index);
+    if (index->grid_idx >= pftm->grid_num || len > pftm->grid_size || (grid != NULL && len < sizeof(stGridHeader)))
+        return -1;
+
+    if (!_file_exists(pfi))
+    {
+        if (grid == NULL)
+            return 0;
+
+        CHK_RET(_create_file(pfs, pfi, index->file.file_type, index->file.file_no, pftm->grid_num, pftm->grid_size));
+        if (_init_file(pfs, pftm, pfi, index->file.file_no) != 0)
+        {
+            _remove_file(pfs, pftm, pfi);
+            return -1;
+        }
+    }
+
+    uint64_t offset = _grid_offset(pftm, index->grid_idx);
+
+    stGridHeader grid_header;
+    CHK_RET(_read_grid_header(pfs, pfi, offset, &grid_header));
+    if (_grid_lsn(&grid_header) >= lsn)
+        return 0;
+
+    if (grid == NULL)
+        return _del_grid(pfs, index, lsn);
+
+    stGridHeader * p = (stGridHeader *) grid;
+    p->header.magic = GRID_MAGIC;
+    p->header.lsn   = lsn;
+
+    struct iovec iov = { grid, len };
+    return _write(pfs, pfi, offset, &iov, 1, len);
+}
+
+static int _wal_redo(void * ctx, uint64_t lsn, char * buf, uint32_t len)
+{
+    rfs * pfs = (rfs *) ctx;
+    stWalRecord * rec = (stWalRecord *) buf;
+
+    if (len < sizeof(stWalRecord) || len != sizeof(stWalRecord) + rec->len)
+        return -1;
+
+    if (lsn > pfs->max_lsn)
+        pfs->max_lsn = lsn;
+
+    if (rec->op == WAL_OP_DEL)
+        return _redo_grid(pfs, &rec->index, lsn, NULL, 0);
+
+    if (rec->op != WAL_OP_SET)
+        return -1;
+
+    CHK_RET(_redo_grid(pfs, &rec->index, lsn, buf + sizeof(stWalRecord), rec->len));
+    if (rec->relocate)
+        CHK_RET(_redo_grid(pfs, &rec->old_index, lsn, NULL, 0));
+
+    return 0;
+}
+
+//打开日志文件并按日志补写数据文件; 不写日志且没有遗留的日志文件时什么都不做
+static int _wal_recover(rfs * pfs)
+{
+    char path[512];
+    _meta_path(pfs, WAL_FILE_NAME, path, sizeof(path));
+
+    if (pfs->user_config.wal_mode == WAL_OFF && access(path, F_OK) != 0)
+        return 0;
+
+    pfs->wal = wal_open(path);
+    if (pfs->wal == NULL)
+        return -1;
+
+    if (wal_replay(pfs->wal, _wal_redo, pfs) != 0)
+    {
+        printf("(%s:%s)\tfailed to replay %s\n", __FILE__, __FUNCTION__, path);
+        return -1;
+    }
+
+    return 0;
+}
+
+//打开已有的数据文件并登记到type_mng_array, 格子在_scan_file中加载
+static int _open_file(rfs * pfs, char * file)
+{
+    int fd = open(file, O_RDWR);
+    if (fd < 0)
+    {
+        printf("(%s:%s)\tfailed to open file %s, reason: %s\n",
+                __FILE__, __FUNCTION__, file, strerror(errno));
+        return -1;
+    }
+
+    stFileHeader file_header;
+    if (pread(fd, &file_header, sizeof(stFileHeader), 0) != sizeof(stFileHeader))
+    {
+        printf("(%s:%s)\tfailed to read header of file %s, reason: %s\n",
+                __FILE__, __FUNCTION__, file, strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    uint16_t file_type = file_header.header.file_type;
+    uint16_t file_no   = file_header.header.file_no;
+    uint32_t grid_num  = file_header.header.grid_num;
+    uint32_t grid_size = file_header.header.grid_size;
+
+    stSysConfig * psc = &pfs->sys_config;
+    if (file_type >= psc->max_file_type_num || _grow_files(pfs->type_mng_array + file_type, file_no + 1) != 0)
+    {
+        printf("(%s:%s)\tfile %s has invalid file_type %hu or file_no %hu\n",
+                __FILE__, __FUNCTION__, file, file_type, file_no);
+        close(fd);
+        return -1;
+    }
+
+    stFileTypeMng * pftm = pfs->type_mng_array + file_type;
+
+    if (grid_num != pftm->grid_num || grid_size != pftm->grid_size)
+    {
+        printf("(%s:%s)\tfile %s has %u grids of %u bytes, but the config has %u grids of %u bytes\n",
+                __FILE__, __FUNCTION__, file, grid_num, grid_size, pftm->grid_num, pftm->grid_size);
+        close(fd);
+        return -1;
+    }
+
+    //同类型的文件布局相同: 这个类型的第一个文件沿用它自己的布局(换io_engine之前建的文件), 之后新建的文件跟它一致
+    uint32_t data_offset = file_header.header.data_offset ? file_header.header.data_offset : sizeof(stFileHeader);
+    if (data_offset != pftm->data_offset)
+    {
+        if (data_offset != sizeof(stFileHeader) && data_offset != DIRECT_ALIGN)
+        {
+            printf("(%s:%s)\tfile %s has invalid data offset %u\n", __FILE__, __FUNCTION__, file, data_offset);
+            close(fd);
+            return -1;
+        }
+
+        uint16_t no = 0;
+        for (; no <= pftm->max_opened_file_no; ++no)
+        {
+            if (_file_exists(pftm->file_info_array + no))
+            {
+                printf("(%s:%s)\tfile %s has data offset %u, but other files of type %hu have %u\n",
+                        __FILE__, __FUNCTION__, file, data_offset, file_type, pftm->data_offset);
+                close(fd);
+                return -1;
+            }
+        }
+
+        printf("(%s:%s)\tfiles of type %hu keep data offset %u of file %s\n", __FILE__, __FUNCTION__, file_type, data_offset, file);
+        pftm->data_offset = data_offset;
+    }
+
+    stFileInfo * pfi = pftm->file_info_array + file_no;
+    if (_file_exists(pfi))
+    {
+        printf("(%s:%s)\tfile %s has the same file_type and file_no as %s\n",
+                __FILE__, __FUNCTION__, file, pfi->path);
+        close(fd);
+        return -1;
+    }
+
+    pfi->fd = fd;
+    strncpy(pfi->path, file, sizeof(pfi->path) - 1);
+
+    return _init_file(pfs, pftm, pfi, file_no);
+}
+
+//加载时发现key已经加载过(rfs_set挪动数据后没来得及删除旧数据)
+//lsn大的是新数据, lsn相同(旧版本的格子)时比较write_time, 按auto_repair处理
+//返回1表示留下index, 0表示留下loaded
+static int _repair_duplicate(rfs * pfs, stIndex * loaded, stIndex * index, stGridHeader * grid_header)
+{
+    stGridHeader loaded_header;
+    CHK_RET(_read_grid_header(pfs, _file_info(pfs, loaded), _index_offset(pfs, loaded), &loaded_header));
+
+    uint64_t loaded_lsn = _grid_lsn(&loaded_header);
+    uint64_t lsn        = _grid_lsn(grid_header);
+
+    int index_is_new = (lsn != loaded_lsn) ? (lsn > loaded_lsn)
+                     : (grid_header->header.write_time >= loaded_header.header.write_time);
+
+    uint8_t policy = pfs->user_config.auto_repair;
+    int keep_new   = (policy != DELETE_NEW_DATA && policy != IGNORE_NEW_DATA);
+    int keep_index = (keep_new == index_is_new);
+
+    if (policy == DELETE_OLD_DATA || policy == DELETE_NEW_DATA)
+    {
+        stIndex * drop = keep_index ? loaded : index;
+        _del_grid(pfs, drop, keep_index ? loaded_lsn : lsn);
+    }
+
+    return keep_index;
+}
+
+//全量扫描时文件中的一个key, key为序列化后的key
+typedef struct {
+    stIndex  index;
+    uint64_t lsn;
+    uint32_t write_time;
+    uint32_t expire_time;
+    uint8_t  type;
+    uint16_t klen;
+    char     key[MAX_KEY_LEN];
+    uint32_t part_num;
+    stIndex * parts;     //大value的各段, 普通value为NULL
+} stLoadEntry;
+
+//一个文件的扫描结果, 由扫描线程填写, 主线程合并到hash_table
+typedef struct {
+    stFile        file;
+    stLoadEntry * entries;
+    uint32_t      entry_num;
+    uint32_t      entry_cap;
+    uint64_t      max_lsn;
+    int64_t       usec;      //扫描用时
+    int           ret;
+    int           done;
+} stLoadFile;
+
+typedef struct {
+    rfs *        pfs;
+    stLoadFile * files;
+    uint32_t     file_num;
+    uint32_t     next;       //下一个要扫描的文件, 扫描线程原子地递增
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+} stLoader;
+
+static int64_t _now_usec()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+#define SCAN_CHUNK_SIZE (4*1024*1024) //顺序扫描数据文件时一次读的字节数
+
+//顺序扫描一个数据文件的所有格子: 每次读SCAN_CHUNK_SIZE字节, 解析当前块时通过aio预读下一块
+//文件中没有写过的空洞直接跳过; IO_ENGINE_MMAP时直接返回映射区中的格子
+typedef struct {
+    stFileTypeMng * pftm;
+    stFileInfo    * pfi;
+    int      fd;             //扫描时另外打开, 不占描述符缓存的位置, 扫描线程之间也不用互斥
+    stAio *  aio;            //创建失败时同步读
+    char *   bufs[2];
+    struct iovec iov;
+    int64_t  res;            //同步读时保存读的结果
+
+    uint32_t chunk_grids;    //一块最多包含的格子数
+    uint32_t next_idx;       //下一块从哪个格子开始
+    uint64_t data_end;       //next_idx所在数据段的结束偏移
+    uint64_t file_end;
+
+    char *   cur;            //当前块
+    uint32_t cur_begin;      //当前块第一个格子的下标
+    uint32_t cur_num;        //当前块中的格子数
+    uint32_t pos;            //下一个要返回的格子在当前块中的位置
+
+    int      err;            //读文件失败
+    int      used_only;      //跳过格子位图中空闲的格子; 加载时位图还没建好, 不能跳
+    int      pending;        //是否有已提交还没取出的块
+    int      pending_buf;
+    uint32_t pending_begin;
+} stScanner;
+
+//确定下一块的位置, 跳过空洞; 返回块中的格子数, 0表示文件已扫描完
+static uint32_t _scanner_plan(stScanner * sc, uint32_t * begin)
+{
+    stFileTypeMng * pftm = sc->pftm;
+
+    if (sc->used_only)
+    {
+        int64_t used = bm_next_set(sc->pfi->grids_bitmap, sc->next_idx);
+        if (used < 0)
+            return 0;
+        sc->next_idx = (uint32_t) used;
+    }
+
+    uint64_t offset = _grid_offset(pftm, sc->next_idx);
+    if (sc->next_idx >= pftm->grid_num || offset >= sc->file_end)
+        return 0;
+
+    if (offset >= sc->data_end)
+    {
+        off_t data = lseek(sc->fd, offset, SEEK_DATA);
+        if (data < 0 && errno == ENXIO)
+            return 0;
+
+        off_t hole = (data < 0) ? -1 : lseek(sc->fd, data, SEEK_HOLE);
+        if (data < 0 || hole < 0)
+        {
+            //文件系统不支持SEEK_DATA/SEEK_HOLE时当作没有空洞
+            data = offset;
+            hole = sc->file_end;
+        }
+
+        if ((uint64_t) data > offset)
+            sc->next_idx = ((uint64_t) data - pftm->data_offset) / pftm->grid_size;
+        sc->data_end = hole;
+
+        offset = _grid_offset(pftm, sc->next_idx);
+        if (sc->next_idx >= pftm->grid_num || offset >= sc->file_end)
+            return 0;
+    }
+
+    uint64_t end = MIN(sc->data_end, sc->file_end);
+    uint32_t num = MIN((end - offset + pftm->grid_size - 1) / pftm->grid_size, sc->chunk_grids);
+    num = MIN(num, pftm->grid_num - sc->next_idx);
+
+    *begin = sc->next_idx;
+    sc->next_idx += num;
+    return num;
+}
+
+//开始读下一块到bufs[b]
+static void _scanner_submit(stScanner * sc, int b)
+{
+    uint32_t begin = 0;
+    uint32_t num   = _scanner_plan(sc, &begin);
+    if (num == 0)
+        return;
+
+    sc->pending       = 1;
+    sc->pending_buf   = b;
+    sc->pending_begin = begin;
+
+    uint64_t offset = _grid_offset(sc->pftm, begin);
+    if (sc->pfi->map != NULL)
+    {
+        sc->res = (int64_t) num * sc->pftm->grid_size;
+        return;
+    }
+
+    sc->iov.iov_base = sc->bufs[b];
+    sc->iov.iov_len  = (uint64_t) num * sc->pftm->grid_size;
+    //同步读失败时和异步读一样记下-errno
+    if (sc->aio == NULL || aio_submit(sc->aio, sc->fd, 0, &sc->iov, 1, offset, sc) != 0)
+    {
+        sc->res = preadv(sc->fd, &sc->iov, 1, offset);
+        if (sc->res < 0)
+            sc->res = -errno;
+    }
+    else
+        sc->res = INT64_MIN;
+}
+
+//等已提交的块读完, 作为当前块
+static int _scanner_wait(stScanner * sc)
+{
+    if (sc->res == INT64_MIN)
+    {
+        stAioEvent event;
+        if (aio_reap(sc->aio, 1, &event, 1) != 1)
+            return -1;
+        sc->res = event.res;
+    }
+
+    sc->pending   = 0;
+    sc->cur_begin = sc->pending_begin;
+    sc->cur_num   = (sc->res > 0) ? sc->res / sc->pftm->grid_size : 0;
+    sc->pos       = 0;
+    sc->cur       = (sc->pfi->map != NULL) ? sc->pfi->map + _grid_offset(sc->pftm, sc->cur_begin) : sc->bufs[sc->pending_buf];
+
+    if (sc->res < 0)
+    {
+        sc->err = 1;
+        printf("(%s:%s)\tfailed to read file %s, reason: %s\n",
+                __FILE__, __FUNCTION__, sc->pfi->path, strerror((int) -sc->res));
+        return -1;
+    }
+
+    return 0;
+}
+
+static int _scanner_open(rfs * pfs, stScanner * sc, stFile file, int used_only)
+{
+    memset(sc, 0, sizeof(stScanner));
+    sc->pftm = pfs->type_mng_array + file.file_type;
+    sc->pfi  = sc->pftm->file_info_array + file.file_no;
+    sc->used_only = used_only;
+    sc->fd   = open(sc->pfi->path, O_RDONLY);
+
+    struct stat st;
+    if (sc->fd < 0 || fstat(sc->fd, &st) != 0)
+    {
+        printf("(%s:%s)\tfailed to stat file %s, reason: %s\n",
+                __FILE__, __FUNCTION__, sc->pfi->path, strerror(errno));
+        if (sc->fd >= 0)
+            close(sc->fd);
+        return -1;
+    }
+
+    uint32_t grid_size = sc->pftm->grid_size;
+    sc->file_end    = MIN((uint64_t) st.st_size, _grid_offset(sc->pftm, sc->pftm->grid_num));
+    sc->chunk_grids = (SCAN_CHUNK_SIZE > grid_size) ? SCAN_CHUNK_SIZE / grid_size : 1;
+
+    if (sc->pfi->map != NULL)
+        madvise(sc->pfi->map, _grid_offset(sc->pftm, sc->pftm->grid_num), MADV_SEQUENTIAL);
+    else
+    {
+        posix_fadvise(sc->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+        uint64_t size = (uint64_t) sc->chunk_grids * grid_size;
+        sc->bufs[0] = malloc(size);
+        sc->bufs[1] = malloc(size);
+        if (sc->bufs[0] == NULL || sc->bufs[1] == NULL)
+        {
+            free(sc->bufs[0]);
+            free(sc->bufs[1]);
+            close(sc->fd);
+            return -1;
+        }
+
+        sc->aio = aio_create(pfs->user_config.async_engine, 1, 1);
+    }
+
+    _scanner_submit(sc, 0);
+    return 0;
+}
+
+//返回下一个格子, grid_idx为它的下标; NULL表示扫描完或读失败
+static char * _scanner_next(stScanner * sc, uint32_t * grid_idx)
+{
+    while (sc->pos >= sc->cur_num)
+    {
+        if (!sc->pending || _scanner_wait(sc) != 0)
+            return NULL;
+
+        //解析当前块时预读下一块
+        _scanner_submit(sc, 1 - sc->pending_buf);
+    }
+
+    *grid_idx = sc->cur_begin + sc->pos;
+    return sc->cur + (uint64_t) sc->pftm->grid_size * sc->pos++;
+}
+
+static void _scanner_close(stScanner * sc)
+{
+    if (sc->aio != NULL)
+    {
+        while (aio_inflight(sc->aio) > 0)
+        {
+            stAioEvent event;
+            aio_reap(sc->aio, 1, &event, 1);
+        }
+        aio_destroy(sc->aio);
+    }
+
+    free(sc->bufs[0]);
+    free(sc->bufs[1]);
+    close(sc->fd);
+}
+
+//扫描文件中的所有格子, 只读数据文件和写这个文件的格子位图, 可以在多个线程中同时扫描不同的文件
+static int _scan_file(rfs * pfs, stLoadFile * lf)
+{
+    stScanner sc;
+    CHK_RET(_scanner_open(pfs, &sc, lf->file, 0));
+
+    stIndex index;
+    index.file = lf->file;
+
+    uint32_t grid_size = _type_mng(pfs, &index)->grid_size;
+
+    uint32_t idx = 0;
+    char * p = NULL;
+    while ((p = _scanner_next(&sc, &idx)) != NULL)
+    {
+        //空格子的lsn也要算上, 之后分配的lsn必须比所有格子的都大
+        stGridHeader * grid_header = (stGridHeader *) p;
+        if (_grid_lsn(grid_header) > lf->max_lsn)
+            lf->max_lsn = _grid_lsn(grid_header);
+
+        uint8_t type = *(uint8_t *) (p + sizeof(stGridHeader));
+        if (type == 0 || type >= pfs->type_count)
+            continue;
+
+        //加载时总是校验, 损坏的格子当作空格子
+        stGridData data;
+        if (_parse_grid(p, grid_size, 1, &data) != 0)
+        {
+            printf("(%s:%s)\tgrid %u of file %hu-%hu is corrupted, skipped\n",
+                    __FILE__, __FUNCTION__, idx, index.file.file_type, index.file.file_no);
+            continue;
+        }
+
+        uint16_t len = data.klen;
+        if (len == 0)
+            continue;
+        p = data.key;
+
+        if (lf->entry_num == lf->entry_cap)
+        {
+            uint32_t cap = lf->entry_cap ? lf->entry_cap * 2 : 1024;
+            stLoadEntry * entries = realloc(lf->entries, cap * sizeof(stLoadEntry));
+            if (entries == NULL)
+            {
+                sc.err = 1;
+                break;
+            }
+            lf->entries   = entries;
+            lf->entry_cap = cap;
+        }
+
+        stLoadEntry * e = lf->entries + lf->entry_num;
+        e->index       = index;
+        e->index.grid_idx = idx;
+        e->lsn         = _grid_lsn(grid_header);
+        e->write_time  = grid_header->header.write_time;
+        e->expire_time = _grid_expire(grid_header);
+        e->type        = type;
+        e->klen        = len;
+        e->part_num    = 0;
+        e->parts       = NULL;
+        memcpy(e->key, p, len);
+
+        if (_grid_large(grid_header) && (e->parts = _large_copy_parts(data.value, data.vlen, &e->part_num)) == NULL)
+        {
+            printf("(%s:%s)\tgrid %u of file %hu-%hu is corrupted, skipped\n",
+                    __FILE__, __FUNCTION__, idx, index.file.file_type, index.file.file_no);
+            continue;
+        }
+        ++lf->entry_num;
+
+        //先占住格子, 合并时key重复或插入失败再放回去
+        _mark_used(pfs, &e->index);
+    }
+
+    _scanner_close(&sc);
+    return sc.err ? -1 : 0;
+}
+
+//把一个文件的扫描结果加载到hash_table, 只在主线程中调用
+static int _merge_file(rfs * pfs, stLoadFile * lf)
+{
+    if (lf->max_lsn > pfs->max_lsn)
+        pfs->max_lsn = lf->max_lsn;
+
+    char key[MAX_KEY_LEN+1];
+    uint32_t i = 0;
+    for (; i < lf->entry_num; ++i)
+    {
+        stLoadEntry   * e  = lf->entries + i;
+        stKeyCallback * cb = pfs->user_callbacks + e->type;
+
+        if (cb->deserialize(key, e->key, e->klen) != 0)
+        {
+            printf("(%s:%s)\tfailed to deserialize key of grid %u in file %s\n",
+                    __FILE__, __FUNCTION__, e->index.grid_idx, _file_info(pfs, &e->index)->path);
+            _mark_idle(pfs, &e->index);
+            free(e->parts);
+            continue;
+        }
+
+#if 0
+        char out[MAX_KEY_LEN+1] = {0};
+        cb->print(key, out);
+        printf("key is %s\n", out);
+#endif
+
+        stIndex loaded;
+        if (hashtable_get(pfs->hash_table, key, &loaded, NULL, cb) == 0)
+        {
+            stGridHeader grid_header;
+            memset(&grid_header, 0, sizeof(grid_header));
+            grid_header.header.write_time = e->write_time;
+            grid_header.header.magic      = GRID_MAGIC;
+            grid_header.header.lsn        = e->lsn;
+
+            if (_repair_duplicate(pfs, &loaded, &e->index, &grid_header) != 1)
+            {
+                _mark_idle(pfs, &e->index);
+                free(e->parts);
+                continue;
+            }
+
+            _mark_idle(pfs, &loaded);
+            _large_remove(pfs, &loaded);
+        }
+
+        if (hashtable_set(pfs->hash_table, key, &e->index, cb) != 0)
+        {
+            printf("(%s:%s)\tfailed to add key of grid %u in file %s to hash table\n",
+                    __FILE__, __FUNCTION__, e->index.grid_idx, _file_info(pfs, &e->index)->path);
+            _mark_idle(pfs, &e->index);
+            free(e->parts);
+            continue;
+        }
+
+        //各段的格子等所有文件都扫描完再占住, 此时扫描线程可能还在写别的文件的格子位图
+        if (e->parts != NULL)
+            _large_put(pfs, &e->index, e->parts, e->part_num);
+
+        _add_timer(pfs, &e->index, e->expire_time);
+    }
+
+    return 0;
+}
+
+static void * _load_worker(void * arg)
+{
+    stLoader * loader = (stLoader *) arg;
+    rfs * pfs = loader->pfs;
+
+    while (1)
+    {
+        uint32_t i = __sync_fetch_and_add(&loader->next, 1);
+        if (i >= loader->file_num)
+            break;
+
+        stLoadFile * lf = loader->files + i;
+        int64_t begin = _now_usec();
+        lf->ret  = _scan_file(pfs, lf);
+        lf->usec = _now_usec() - begin;
+
+        pthread_mutex_lock(&loader->lock);
+        lf->done = 1;
+        pthread_cond_broadcast(&loader->cond);
+        pthread_mutex_unlock(&loader->lock);
+    }
+
+    return NULL;
+}
+
+//扫描所有打开的数据文件, 重建hash_table和格子的占用情况
+//load_thread_num个线程同时扫描不同的文件, 主线程按文件顺序合并扫描结果
+static int _load_files(rfs * pfs)
+{
+    int64_t begin = _now_usec();
+
+    stLoader loader;
+    memset(&loader, 0, sizeof(loader));
+    loader.pfs = pfs;
+
+    stSysConfig * psc = &pfs->sys_config;
+
+    uint32_t max_num = 0;
+    uint16_t file_type = 0;
+    for (; file_type < psc->max_file_type_num; ++file_type)
+        max_num += pfs->type_mng_array[file_type].max_opened_file_no + 1;
+
+    loader.files = calloc(max_num, sizeof(stLoadFile));
+    if (loader.files == NULL)
+        return -1;
+
+    for (file_type = 0; file_type < psc->max_file_type_num; ++file_type)
+    {
+        stFileTypeMng * pftm = pfs->type_mng_array + file_type;
+
+        uint16_t file_no = 0;
+        for (; file_no <= pftm->max_opened_file_no; ++file_no)
+        {
+            if (!_file_exists(pftm->file_info_array + file_no))
+                continue;
+
+            stLoadFile * lf = loader.files + loader.file_num++;
+            lf->file.file_type = file_type;
+            lf->file.file_no   = file_no;
+        }
+    }
+
+    pthread_mutex_init(&loader.lock, NULL);
+    pthread_cond_init(&loader.cond, NULL);
+
+    uint32_t thread_num = MIN(pfs->user_config.load_thread_num, loader.file_num);
+    pthread_t * threads = calloc(thread_num + 1, sizeof(pthread_t));
+
+    uint32_t started = 0;
+    for (; threads != NULL && started < thread_num; ++started)
+    {
+        if (pthread_create(threads + started, NULL, _load_worker, &loader) != 0)
+            break;
+    }
+
+    //没有扫描线程时在主线程中扫描
+    if (started == 0)
+        _load_worker(&loader);
+
+    uint64_t key_num = 0;
+    uint32_t i = 0;
+    for (; i < loader.file_num; ++i)
+    {
+        stLoadFile * lf  = loader.files + i;
+        stFileInfo * pfi = pfs->type_mng_array[lf->file.file_type].file_info_array + lf->file.file_no;
+
+        pthread_mutex_lock(&loader.lock);
+        while (!lf->done)
+            pthread_cond_wait(&loader.cond, &loader.lock);
+        pthread_mutex_unlock(&loader.lock);
+
+        if (lf->ret != 0 || _merge_file(pfs, lf) != 0)
+        {
+            printf("(%s:%s)\tfailed to load file %s\n", __FILE__, __FUNCTION__, pfi->path);
+        }
+        else
+        {
+            printf("(%s:%s)\tsuccessfully load file %s, %u keys, %.3f ms\n",
+                    __FILE__, __FUNCTION__, pfi->path, lf->entry_num, lf->usec / 1000.0);
+            key_num += lf->entry_num;
+        }
+
+        //扫描失败的文件没有合并, 大value的各段还在entry中
+        uint32_t k = 0;
+        for (; lf->ret != 0 && k < lf->entry_num; ++k)
+            free(lf->entries[k].parts);
+
+        free(lf->entries);
+        lf->entries = NULL;
+    }
+
+    for (i = 0; i < started; ++i)
+        pthread_join(threads[i], NULL);
+
+    _large_mark_parts(pfs);
+
+    free(threads);
+    free(loader.files);
+    pthread_cond_destroy(&loader.cond);
+    pthread_mutex_destroy(&loader.lock);
+
+    printf("(%s:%s)\tload %u files, %lu keys, %.3f ms, %u threads\n", __FILE__, __FUNCTION__,
+            loader.file_num, (unsigned long) key_num, (_now_usec() - begin) / 1000.0, started ? started : 1);
+
+    return 0;
+}
+
+static int _rfs_init(rfs * pfs)
+{
+    char * working_dir = pfs->sys_config.working_dir;
+    char   file[256] = {0};
+
+    if (access(working_dir, 0) != 0)
+    {
+        printf("(%s:%s)\trfs working directory %s does not exist, check your config!!!\n",
+                __FILE__, __FUNCTION__, working_dir);
+        return -1;
+    }
+
+    DIR *dir = opendir(working_dir);
+    if (dir == NULL)
+    {
+        printf("(%s:%s)\tfailed to open dir %s, reason: %s\n",
+                __FILE__, __FUNCTION__, working_dir, strerror(errno));
+        return -1;
+    }
+
+    struct stat st;
+    struct dirent *ent;
+    while ((ent = readdir(dir)) != NULL)
+    {
+        if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0)
+            continue;
+
+        if (_is_meta_file(ent->d_name))
+            continue;
+
+        sprintf(file, "%s/%s", working_dir, ent->d_name);
+
+        stat(file, &st);
+        if (S_ISREG(st.st_mode))
+        {
+            printf("(%s:%s)\tloading file %s\n", __FILE__, __FUNCTION__, file);
+            if (_open_file(pfs, file) != 0)
+            {
+                printf("(%s:%s)\tfailed to load file %s\n", __FILE__, __FUNCTION__, file);
+                continue;
+            }
+        }
+    };
+    closedir(dir);
+
+    //所有数据文件都打开后再按日志补写, 补写完再加载格子
+    //补写失败时检查点和标记都留着, 改好配置等之后可以再打开
+    if (_wal_recover(pfs) != 0)
+        return -1;
+
+    //上次正常退出时不需要扫描数据文件
+    int loaded = _index_load(pfs);
+    if (loaded != 0)
+        _load_files(pfs);
+
+    //检查点和标记只用这一次, 之后的写操作会让它们过时, 写之前删掉; 下次正常退出时重新写
+    //WAL_SYNC时检查点留着, 下面清空日志时重新写
+    int periodic = _index_periodic(pfs);
+    const char * once[] = { CLEAN_FILE_NAME, INDEX_FILE_NAME };
+    int i = 0;
+    for (; i < (periodic ? 1 : 2); ++i)
+    {
+        _meta_path(pfs, once[i], file, sizeof(file));
+        if (unlink(file) != 0 && errno != ENOENT)
+        {
+            printf("(%s:%s)\tfailed to remove file %s, reason: %s\n",
+                    __FILE__, __FUNCTION__, file, strerror(errno));
+        }
+    }
+    _sync_dir(pfs);
+
+    //补写的数据落盘后清空日志, 之后的lsn从所有格子中最大的lsn之后开始
+    //检查点加载时日志是空的, 不用动; WAL_SYNC时日志中可能还有检查点之后的记录
+    if ((loaded != 0 || periodic) && _wal_checkpoint(pfs) != 0)
+    {
+        printf("(%s:%s)\tfailed to checkpoint wal, the remaining records are kept\n", __FILE__, __FUNCTION__);
+        return -1;
+    }
+
+    if (pfs->user_config.wal_mode == WAL_OFF)
+    {
+        //不再写日志时删掉遗留的日志文件
+        if (pfs->wal != NULL)
+        {
+            _meta_path(pfs, WAL_FILE_NAME, file, sizeof(file));
+            wal_close(pfs->wal);
+            pfs->wal = NULL;
+            unlink(file);
+        }
+    }
+
+    return 0;
+}
+
+rfs * rfs_create(stSysConfig sys_config, stUserConfig user_config, uint8_t type_count, stKeyCallback* user_callbacks)
+{
+    rfs * pfs             = calloc(1, sizeof(rfs));
+    if (pfs == NULL)
+        return NULL;
+
+    if (pthread_key_create(&pfs->scratch_key, _scratch_free) != 0)
+        return NULL;
+    pthread_rwlock_init(&pfs->lock, NULL);
+    pthread_mutex_init(&pfs->cache_lock, NULL);
+    pthread_mutex_init(&pfs->scratch_lock, NULL);
+    pthread_mutex_init(&pfs->fd_lock, NULL);
+    pthread_mutex_init(&pfs->pending_lock, NULL);
+    pthread_cond_init(&pfs->pending_cond, NULL);
+    pfs->fd_lru_head.file_type = LRU_NONE;
+    pfs->fd_lru_tail.file_type = LRU_NONE;
+
+    pfs->sys_config       = sys_config;
+    pfs->user_config      = user_config;
+    pfs->type_count       = type_count;
+    pfs->user_callbacks   = calloc(type_count, sizeof(stKeyCallback));
+    if (pfs->user_callbacks == NULL)
+        return NULL;
+
+    uint8_t i = 0;
+    for (; i < type_count; ++i)
+        pfs->user_callbacks[i] = user_callbacks[i];
+
+    pfs->hash_table = hashtable_create(sys_config.hashtable_node_num, sys_config.hashtable_list_num);
+    if (pfs->hash_table == NULL)
+        return NULL;
+
+    pfs->type_mng_array = calloc(sys_config.max_file_type_num, sizeof(stFileTypeMng));
+    if (pfs->type_mng_array == NULL)
+        return NULL;
+
+    uint16_t file_type = 0;
+    stFileTypeMng * pftm;
+    for (; file_type < sys_config.max_file_type_num; ++file_type)
+    {
+        pftm = pfs->type_mng_array + file_type;
+
+        pftm->max_opened_file_no = 0;
+        if (file_type == 0)
+            pftm->grid_size = sys_config.base_file_grid_size;
+        else
+        {
+            stFileTypeMng * p_pre_mng = pfs->type_mng_array + file_type - 1;
+            pftm->grid_size = p_pre_mng->grid_size * sys_config.grid_size_growth_factor;
+        }
+        pftm->grid_num = sys_config.file_size / pftm->grid_size;
+        if (_grow_files(pftm, (sys_config.max_open_file_num > 0) ? sys_config.max_open_file_num : 1) != 0)
+            return NULL;
+
+        pftm->data_offset = (user_config.io_engine == IO_ENGINE_DIRECT) ? DIRECT_ALIGN : sizeof(stFileHeader);
+    }
+
+    pfs->page_size    = sysconf(_SC_PAGESIZE);
+    if (posix_memalign((void **) &pfs->private_data, DIRECT_ALIGN, pftm->grid_size) != 0)
+        return NULL;
+    memset(pfs->private_data, 0, pftm->grid_size);
+    if (user_config.io_engine == IO_ENGINE_DIRECT && posix_memalign((void **) &pfs->direct_data, DIRECT_ALIGN, pftm->grid_size) != 0)
+        return NULL;
+    pfs->batch_size   = (pftm->grid_size > BATCH_BUF_SIZE) ? pftm->grid_size : BATCH_BUF_SIZE;
+    pfs->batch_data   = calloc(1, pfs->batch_size);
+    if (pfs->batch_data == NULL)
+        return NULL;
+    pfs->zero_data    = calloc(1, pftm->grid_size);
+    if (pfs->zero_data == NULL)
+        return NULL;
+    pfs->timers       = tw_create(time(0));
+    if (pfs->timers == NULL)
+        return NULL;
+
+    if (user_config.value_cache_size > 0 && (pfs->value_cache = vc_create(user_config.value_cache_size)) == NULL)
+        return NULL;
+
+    //按日志补写失败时不能不写日志就继续用
+    if (_rfs_init(pfs) != 0)
+    {
+        printf("(%s:%s)\tfailed to recover rfs in %s\n", __FILE__, __FUNCTION__, sys_config.working_dir);
+        _rfs_free(pfs);
+        return NULL;
+    }
+
+    if (_init_file_bits(pfs) != 0)
+        return NULL;
+
+    return pfs;
+}
+
+int rfs_destroy(rfs * pfs)
+{
+    assert(pfs != NULL);
+
+    if (pfs->aio != NULL)
+    {
+        while (aio_inflight(pfs->aio) > 0)
+            _rfs_poll(pfs, aio_inflight(pfs->aio));
+    }
+
+    //数据文件落盘并清空日志, 再写索引检查点和正常退出的标记, 下次启动时不需要补写和扫描数据文件
+    if (pfs->wal != NULL)
+    {
+        if (wal_commit(pfs->wal, 0) == 0 && _wal_checkpoint(pfs) == 0)
+            _index_checkpoint(pfs);
+    }
+    else if (pfs->user_config.index_checkpoint && _sync_files(pfs) == 0)
+        _index_checkpoint(pfs);
+
+    _rfs_free(pfs);
+
+    return 0;
+}
+
+//关闭所有文件并释放内存, 不落盘也不写检查点; rfs_create失败时也用它清理
+static void _rfs_free(rfs * pfs)
+{
+    if (pfs->aio != NULL)
+    {
+        aio_destroy(pfs->aio);
+        free(pfs->aio_events);
+    }
+
+    if (pfs->wal != NULL)
+        wal_close(pfs->wal);
+
+    free(pfs->user_callbacks);
+    hashtable_destroy(pfs->hash_table);
+
+    uint16_t type = 0;
+    for (; type < pfs->sys_config.max_file_type_num; ++type)
+    {
+        stFileTypeMng * pftm = pfs->type_mng_array + type;
+        if (pftm == NULL)
+            continue;
+
+        if (pftm->file_info_array == NULL)
+            continue;
+
+        uint16_t no = 0;
+        for (; no <= pftm->max_opened_file_no; ++no)
+        {
+            stFileInfo * pfi = pftm->file_info_array + no;
+            _close_file(pfs, pftm, pfi);
+
+            if (pfi->grids_bitmap != NULL)
+                bm_destroy(pfi->grids_bitmap);
+        }
+        free(pftm->file_info_array);
+
+        if (pftm->opened_files != NULL)
+            bm_destroy(pftm->opened_files);
+        if (pftm->free_files != NULL)
+            bm_destroy(pftm->free_files);
+    }
+    free(pfs->type_mng_array);
+
+    free(pfs->private_data);
+    free(pfs->batch_data);
+    free(pfs->zero_data);
+    free(pfs->direct_data);
+    tw_destroy(pfs->timers);
+    if (pfs->value_cache != NULL)
+        vc_destroy(pfs->value_cache);
+
+    //先删掉key, 之后退出的线程不再调用_scratch_free
+    pthread_key_delete(pfs->scratch_key);
+    while (pfs->scratches != NULL)
+    {
+        stScratch * next = pfs->scratches->next;
+        free(pfs->scratches);
+        pfs->scratches = next;
+    }
+    pthread_rwlock_destroy(&pfs->lock);
+    pthread_mutex_destroy(&pfs->cache_lock);
+    pthread_mutex_destroy(&pfs->scratch_lock);
+    pthread_mutex_destroy(&pfs->fd_lock);
+    pthread_mutex_destroy(&pfs->pending_lock);
+    pthread_cond_destroy(&pfs->pending_cond);
+    _large_clear(pfs);
+    free(pfs);
+}
+
+typedef struct {
+    stIndex index;      //新数据写入的格子
+    stIndex old_index;  //relocate为1时旧数据所在的格子
+    uint8_t exist;      //key原来是否存在
+    uint8_t relocate;   //是否需要把数据挪到新的格子
+} stSetPlan;
+
+//rfs_set第一步: 确定新数据写到哪个格子并预占该格子, key在_commit_set时才指向它
+//此时还没有写数据, 写失败要调用_abort_set, 写成功要调用_commit_set
+static int _plan_set(rfs * pfs, void * key, stKeyCallback * cb, uint32_t real_len, stSetPlan * plan)
+{
+    stSysConfig  * psc = &pfs->sys_config;
+    stUserConfig * puc = &pfs->user_config;
+
+    stIndex * index = &plan->index;
+    plan->relocate  = 0;
+    plan->exist     = (hashtable_get(pfs->hash_table, key, index, NULL, cb) == 0);
+
+    if (!plan->exist)
+    {
+        if (hashtable_full(pfs->hash_table))
+            return -1;
+
+        CHK_RET(_get_idx(pfs, 0, psc->max_file_type_num-1, real_len, 
+                    &index->file.file_type, &index->file.file_no, &index->grid_idx));
+        return _mark_used(pfs, index);
+    }
+
+    stFileTypeMng * pftm = _type_mng(pfs, index);
+    uint8_t fit = (real_len <= pftm->grid_size);
+    if (fit && ((puc->size_down_if_possible == 0) || (real_len == pftm->grid_size) || (index->file.file_type == 0)))
+        return 0;
+
+    uint16_t begin_type = 0;
+    uint16_t end_type   = index->file.file_type;
+    if (!fit)
+    {
+        begin_type = index->file.file_type + 1;
+        end_type   = psc->max_file_type_num - 1;
+
+        if (begin_type >= psc->max_file_type_num)
+        {
+            //TODO lor error, alert
+            return -1;
+        }
+    }
+
+    stIndex new_index;
+    if (_get_idx(pfs, begin_type, end_type, real_len, 
+                &new_index.file.file_type, &new_index.file.file_no, &new_index.grid_idx) != 0)
+    {
+        //没有更小的格子时写回原来的格子
+        return fit ? 0 : -1;
+    }
+
+    //如果file_type和file_no都一样的话,说明是原来的文件,将数据写到原来的grid_idx.
+    if ((new_index.file.file_type == index->file.file_type) && (new_index.file.file_no == index->file.file_no))
+        return 0;
+
+    //否则,写到新的文件
+    CHK_RET(_mark_used(pfs, &new_index));
+
+    plan->old_index = *index;
+    plan->relocate  = 1;
+    *index = new_index;
+
+    return 0;
+}
+
+//日志没有记下或没有落盘, 恢复_plan_set之前的状态; 日志已落盘时要用_undo_set
+static int _abort_set(rfs * pfs, stSetPlan * plan)
+{
+    //可能已经写了一部分
+    _uncache(pfs, &plan->index);
+
+    if (!plan->exist || plan->relocate)
+        return _mark_idle(pfs, &plan->index);
+
+    return 0;
+}
+
+//数据写入plan->index后让key指向它, 删除旧数据, lsn为这次写操作的lsn
+//key放不进hash_table时什么都没有改, 返回-1, 由调用方按_undo_set撤销
+static int _commit_set(rfs * pfs, void * key, stKeyCallback * cb, stSetPlan * plan, uint64_t lsn)
+{
+    if ((!plan->exist || plan->relocate) && hashtable_set(pfs->hash_table, key, &plan->index, cb) != 0)
+        return -1;
+
+    _uncache(pfs, &plan->index);
+
+    //原来是大value时放回它的各段
+    if (plan->exist)
+        _large_free(pfs, plan->relocate ? &plan->old_index : &plan->index);
+
+    if (!plan->relocate)
+        return 0;
+
+    //清不掉时旧格子的lsn更小, 重启时按lsn丢掉它
+    if (_del_grid(pfs, &plan->old_index, lsn) != 0)
+    {
+        printf("(%s:%s)\tfailed to clear grid %u in file %s, reason: %s\n",
+                __FILE__, __FUNCTION__, plan->old_index.grid_idx, _file_info(pfs, &plan->old_index)->path, strerror(errno));
+    }
+    return _mark_idle(pfs, &plan->old_index);
+}
+
+//日志落盘后新数据没有写成功或没能让key指向它, 再记一条日志撤销这次写操作, 重启时不会按前一条日志补写
+//旧数据还完整时记下旧数据, key仍指向它; 否则记下删除, key也一起删除; lsn为这次写操作的lsn
+static void _undo_set(rfs * pfs, uint8_t type, void * key, char * kbuf, uint16_t klen, stSetPlan * plan, uint64_t lsn)
+{
+    if (pfs->wal == NULL)
+    {
+        _abort_set(pfs, plan);
+        return;
+    }
+
+    stIndex       * old  = plan->relocate ? &plan->old_index : &plan->index;
+    stFileTypeMng * pftm = _type_mng(pfs, old);
+    stFileInfo    * pfi  = _file_info(pfs, old);
+    uint64_t offset = _grid_offset(pftm, old->grid_idx);
+
+    //格子的lsn比这次写操作小, 校验和也对, 说明旧数据没有被覆盖
+    char *     grid    = NULL;
+    stScratch * scratch = _scratch(pfs);
+    if (plan->exist && scratch != NULL)
+    {
+        grid = scratch->grid;
+        if (pfi->map != NULL)
+            memcpy(grid, pfi->map + offset, pftm->grid_size);
+        else if (_pread_grids(pfs, pfi, grid, pftm->grid_size, offset) != pftm->grid_size)
+            grid = NULL;
+    }
+
+    stGridData data;
+    uint32_t len = 0;
+    if (grid != NULL && _grid_lsn((stGridHeader *) grid) < lsn && _parse_grid(grid, pftm->grid_size, 1, &data) == 0
+            && data.type == type && data.klen == klen && memcmp(data.key, kbuf, klen) == 0)
+        len = data.value + data.vlen - grid;
+
+    struct iovec iov[GRID_IOV_NUM];
+    uint64_t undo = 0;
+    if (len > 0)
+    {
+        iov[0].iov_base = grid;
+        iov[0].iov_len  = len;
+        undo = _wal_log(pfs, WAL_OP_SET, old, plan->relocate ? &plan->index : NULL, iov, 1, len);
+    }
+    else
+    {
+        int iovcnt = _del_iov(iov, &type, &klen, kbuf);
+        undo = _wal_log(pfs, WAL_OP_DEL, &plan->index, NULL, iov, iovcnt, _iov_len(iov, iovcnt));
+    }
+
+    if (undo == 0 || _wal_sync(pfs, undo) != 0)
+    {
+        printf("(%s:%s)\tfailed to log the undo of grid %u in file %s, it may be redone after a crash\n",
+                __FILE__, __FUNCTION__, plan->index.grid_idx, _file_info(pfs, &plan->index)->path);
+        undo = lsn;
+    }
+
+    //新格子中可能已经写了一部分, 清掉它, 扫描数据文件时不会把它当成更新的数据
+    if ((!plan->exist || plan->relocate) && _del_grid(pfs, &plan->index, undo) != 0)
+    {
+        printf("(%s:%s)\tfailed to clear grid %u in file %s, reason: %s\n",
+                __FILE__, __FUNCTION__, plan->index.grid_idx, _file_info(pfs, &plan->index)->path, strerror(errno));
+    }
+    _abort_set(pfs, plan);
+
+    if (!plan->exist || len > 0)
+        return;
+
+    printf("(%s:%s)\tgrid %u in file %s is torn, the key is deleted\n",
+            __FILE__, __FUNCTION__, old->grid_idx, pfi->path);
+    _del_grid(pfs, old, undo);
+    _large_free(pfs, old);
+    _mark_idle(pfs, old);
+    hashtable_del(pfs->hash_table, key, pfs->user_callbacks + type);
+}
+
+//按CLOCK选一个最近没有访问过的key, 按rfs_del删除, 腾出hash_table的节点
+//跳过有未完成的写操作的key, 它们最多async_depth个加上在等日志落盘的
+static int _evict(rfs * pfs)
+{
+    uint8_t  type;
+    char     kbuf[MAX_KEY_LEN];
+    uint16_t klen;
+    stIndex  index;
+    uint32_t tries = pfs->user_config.async_depth + 1;
+
+    stPending * p = pfs->pendings;
+    for (; p != NULL; p = p->next)
+        ++tries;
+
+    do
+    {
+        CHK_RET(hashtable_clock_next(pfs->hash_table, &type, kbuf, &klen, &index));
+    } while (_key_busy(pfs, type, kbuf, klen) && --tries > 0);
+
+    if (tries == 0)
+        return -1;
+
+    char key[MAX_KEY_LEN+1];
+    if (pfs->user_callbacks[type].deserialize(key, kbuf, klen) != 0)
+        return -1;
+
+    CHK_RET(_rfs_del(pfs, type, key, NULL, 0));
+    ++pfs->stat.evictions;
+
+    return 0;
+}
+
+//写入一个格子, flags为GRID_FLAG_LARGE时value是大value的stLargeHeader和各段的位置, expire为0表示不过期
+static int64_t _set(rfs * pfs, uint32_t now, uint32_t expire, uint8_t type, void * key, char * value, uint16_t vlen, uint8_t flags)
+{
+    char kbuf[MAX_KEY_LEN] = {0};
+    uint16_t klen = MAX_KEY_LEN;
+
+    stKeyCallback * cb = pfs->user_callbacks + type;
+    if (cb->serialize(key, kbuf, &klen) != 0)
+        return -1;
+
+    //压缩后的value放在线程自己的缓冲区, 等日志落盘时放开了锁, 别的写操作不会改掉它
+    stScratch * scratch = _scratch(pfs);
+    if (scratch == NULL)
+        return -1;
+
+    stGridHeader grid_header;
+    _init_grid_header(&grid_header, now, 0);
+    grid_header.header.flags       = flags;
+    grid_header.header.expire_time = expire;
+    if (flags == 0)
+        value = _compress_value(pfs, type, &grid_header, value, &vlen, scratch->batch);
+
+    //参考文件格式图
+    uint32_t real_len = sizeof(stGridHeader) + sizeof(uint8_t) + sizeof(uint16_t) + klen + sizeof(uint16_t) + vlen;
+    if (real_len > _part_type_mng(pfs)->grid_size)
+    {
+        printf("(%s:%s)\tvalue of %u bytes does not fit in any grid, use rfs_lset\n", __FILE__, __FUNCTION__, vlen);
+        return -1;
+    }
+
+    //新的key放不进hash_table时先淘汰一个
+    if (pfs->user_config.evict_when_full && hashtable_full(pfs->hash_table)
+            && hashtable_get(pfs->hash_table, key, NULL, NULL, cb) != 0)
+        CHK_RET(_evict(pfs));
+
+    CHK_RET(_wait_key(pfs, type, kbuf, klen));
+
+    stSetPlan plan;
+    CHK_RET(_plan_set(pfs, key, cb, real_len, &plan));
+
+    struct iovec iov[GRID_IOV_NUM];
+    int iovcnt = _grid_iov(iov, &grid_header, &type, &klen, kbuf, &vlen, value);
+    _grid_checksum(iov, iovcnt);
+
+    //先记日志再写数据
+    stIndex * index = &plan.index;
+    uint64_t lsn = _wal_log(pfs, WAL_OP_SET, index, plan.relocate ? &plan.old_index : NULL, iov, iovcnt, real_len);
+    grid_header.header.lsn = lsn;
+
+    stPending pending = { NULL, type, klen, kbuf };
+    if (lsn == 0 || _wal_wait(pfs, lsn, &pending, 1) != 0)
+    {
+        printf("(%s:%s)\tfailed to log set of grid %u in file %s\n",
+                __FILE__, __FUNCTION__, index->grid_idx, _file_info(pfs, index)->path);
+        _abort_set(pfs, &plan);
+        return -1;
+    }
+
+    if (_write(pfs, _file_info(pfs, index), _index_offset(pfs, index), iov, iovcnt, real_len) != 0)
+    {
+        printf("(%s:%s)\tfailed to write grid %u in file %s, reason: %s\n",
+                __FILE__, __FUNCTION__, index->grid_idx, _file_info(pfs, index)->path, strerror(errno));
+        _undo_set(pfs, type, key, kbuf, klen, &plan, lsn);
+        return -1;
+    }
+
+    if (_commit_set(pfs, key, cb, &plan, lsn) != 0)
+    {
+        _undo_set(pfs, type, key, kbuf, klen, &plan, lsn);
+        return -1;
+    }
+    _add_timer(pfs, index, expire);
+    _wal_maybe_checkpoint(pfs);
+
+    return index_to_int64(index);
+}
+
+static int64_t _rfs_set(rfs * pfs, uint32_t now, uint8_t type, void * key, char * value, uint16_t vlen, char * info, uint16_t ilen)
+{
+    return _set(pfs, now, 0, type, key, value, vlen, 0);
+}
+
+int64_t rfs_set(rfs * pfs, uint32_t now, uint8_t type, void * key, char * value, uint16_t vlen, char * info, uint16_t ilen)
+{
+    pthread_rwlock_wrlock(&pfs->lock);
+    int64_t ret = _rfs_set(pfs, now, type, key, value, vlen, info, ilen);
+    pthread_rwlock_unlock(&pfs->lock);
+
+    return ret;
+}
+
+//读接口按当前时间判断是否过期, 过期时间也按当前时间计算, now只作为写入时间
+static int64_t _rfs_set_ex(rfs * pfs, uint32_t now, uint32_t ttl, uint8_t type, void * key, char * value, uint16_t vlen)
+{
+    return _set(pfs, now, ttl ? (uint32_t) time(0) + ttl : 0, type, key, value, vlen, 0);
+}
+
+int64_t rfs_set_ex(rfs * pfs, uint32_t now, uint32_t ttl, uint8_t type, void * key, char * value, uint16_t vlen)
+{
+    pthread_rwlock_wrlock(&pfs->lock);
+    int64_t ret = _rfs_set_ex(pfs, now, ttl, type, key, value, vlen);
+    pthread_rwlock_unlock(&pfs->lock);
+
+    return ret;
+}
+
+//线程退出时释放它的stScratch, 线程退出不能和rfs_destroy同时进行
+static void _scratch_free(void * arg)
+{
+    stScratch * s   = (stScratch *) arg;
+    rfs       * pfs = s->pfs;
+
+    pthread_mutex_lock(&pfs->scratch_lock);
+    stScratch ** pp = &pfs->scratches;
+    while (*pp != NULL && *pp != s)
+        pp = &(*pp)->next;
+    if (*pp != NULL)
+        *pp = s->next;
+    pthread_mutex_unlock(&pfs->scratch_lock);
+
+    free(s);
+}
+
+//第一次调用时分配, 线程退出时由_scratch_free释放, 没有退出的线程的留到rfs_destroy
+static stScratch * _scratch(rfs * pfs)
+{
+    stScratch * s = pthread_getspecific(pfs->scratch_key);
+    if (s != NULL)
+        return s;
+
+    //grid和batch按DIRECT_ALIGN对齐, IO_ENGINE_DIRECT时可以直接读入
+    uint32_t grid_size = pfs->type_mng_array[pfs->sys_config.max_file_type_num - 1].grid_size;
+    if (posix_memalign((void **) &s, DIRECT_ALIGN, DIRECT_ALIGN + grid_size + pfs->batch_size) != 0)
+        return NULL;
+
+    s->pfs   = pfs;
+    s->grid  = (char *) s + DIRECT_ALIGN;
+    s->batch = s->grid + grid_size;
+
+    pthread_mutex_lock(&pfs->scratch_lock);
+    s->next = pfs->scratches;
+    pfs->scratches = s;
+    pthread_mutex_unlock(&pfs->scratch_lock);
+
+    pthread_setspecific(pfs->scratch_key, s);
+    return s;
+}
+
+//只读, 读到过期的格子时返回-1, *expired为它的位置, 由rfs_get换成写锁后删除
+static int64_t _rfs_get(rfs * pfs, uint8_t type, void * key, char * value, uint16_t * vlen, char * info, uint16_t ilen, int64_t * expired)
+{
+    stKeyCallback * cb = pfs->user_callbacks + type;
+
+    stIndex index;
+    int exist = hashtable_get(pfs->hash_table, key, &index, NULL, cb);
+    if (exist == -1)
+        return -1;
+
+    //命中缓存时不读文件, 过期的交给下面读文件时删除
+    if (pfs->value_cache != NULL)
+    {
+        pthread_mutex_lock(&pfs->cache_lock);
+
+        uint32_t len = 0;
+        const stCachedValue * cached = (const stCachedValue *) vc_get(pfs->value_cache, index_to_int64(&index), &len);
+        if (cached != NULL && (cached->expire_time == 0 || cached->expire_time > time(0)))
+        {
+            int hit = (cached->type == type);
+            if (hit)
+            {
+                ++pfs->stat.cache_hits;
+                *vlen = cached->vlen;
+                memcpy(value, cached + 1, cached->vlen);
+            }
+
+            pthread_mutex_unlock(&pfs->cache_lock);
+            return hit ? index_to_int64(&index) : -1;
+        }
+
+        ++pfs->stat.cache_misses;
+        pthread_mutex_unlock(&pfs->cache_lock);
+    }
+
+    stFileTypeMng * pftm = _type_mng(pfs, &index);
+    stFileInfo    * pfi  = _file_info(pfs, &index);
+
+    uint64_t offset = _grid_offset(pftm, index.grid_idx);
+
+    stScratch * scratch = _scratch(pfs);
+    if (scratch == NULL)
+        return -1;
+
+    char * p = scratch->grid;
+    ssize_t size = pftm->grid_size;
+    if (pfi->map != NULL)
+        p = pfi->map + offset;
+    else if ((size = _pread_grids(pfs, pfi, p, pftm->grid_size, offset)) <= 0)
+        return -1;
+
+    //时间轮中的项到期时已经找不到这个格子
+    if (size >= sizeof(stGridHeader) && _grid_expired((stGridHeader *) p, 0))
+    {
+        *expired = index_to_int64(&index);
+        return -1;
+    }
+
+    CHK_RET(_get_value(pfs, p, size, type, value, vlen));
+
+    //持有读锁, 写接口不会同时改这个格子, 放进缓存的不会是旧value
+    if (pfs->value_cache != NULL)
+    {
+        pthread_mutex_lock(&pfs->cache_lock);
+
+        stCachedValue * put = (stCachedValue *) vc_put(pfs->value_cache, index_to_int64(&index), sizeof(stCachedValue) + *vlen);
+        if (put != NULL)
+        {
+            put->expire_time = _grid_expire((stGridHeader *) p);
+            put->vlen        = *vlen;
+            put->type        = type;
+            memcpy(put + 1, value, *vlen);
+        }
+
+        pthread_mutex_unlock(&pfs->cache_lock);
+    }
+
+    return index_to_int64(&index);
+}
+
+int64_t rfs_get(rfs * pfs, uint8_t type, void * key, char * value, uint16_t * vlen, char * info, uint16_t ilen)
+{
+    int64_t expired = -1;
+
+    pthread_rwlock_rdlock(&pfs->lock);
+    int64_t ret = _rfs_get(pfs, type, key, value, vlen, info, ilen, &expired);
+    pthread_rwlock_unlock(&pfs->lock);
+
+    //过期的key顺便删掉, 换成写锁之前可能已被覆盖或删除, 由_expire_grid重新检查
+    if (expired != -1)
+    {
+        stTimer timer = { expired, 0 };
+        pthread_rwlock_wrlock(&pfs->lock);
+        _expire_grid(pfs, &timer, 0);
+        pthread_rwlock_unlock(&pfs->lock);
+    }
+
+    return ret;
+}
+
+//找到key所在的格子, mmap时*grid指向文件映射, 否则把格子读到buf(为NULL时分配一个, 由调用者释放)
+static int _read_grid(rfs * pfs, uint8_t type, void * key, char * buf, stIndex * index, char ** grid, ssize_t * size)
+{
+    stKeyCallback * cb = pfs->user_callbacks + type;
+    if (hashtable_get(pfs->hash_table, key, index, NULL, cb) == -1)
+        return -1;
+
+    stFileTypeMng * pftm = _type_mng(pfs, index);
+    stFileInfo    * pfi  = _file_info(pfs, index);
+
+    uint64_t offset = _grid_offset(pftm, index->grid_idx);
+
+    *size = pftm->grid_size;
+    if (pfi->map != NULL)
+    {
+        *grid = pfi->map + offset;
+        return 0;
+    }
+
+    if ((*grid = buf) == NULL && posix_memalign((void **) grid, DIRECT_ALIGN, pftm->grid_size) != 0)
+        return -1;
+
+    if ((*size = _pread_grids(pfs, pfi, *grid, pftm->grid_size, offset)) <= 0)
+    {
+        if (buf == NULL)
+            free(*grid);
+        return -1;
+    }
+
+    return 0;
+}
+
+static int64_t _rfs_get_view(rfs * pfs, uint8_t type, void * key, rfs_view * view)
+{
+    view->value  = NULL;
+    view->vlen   = 0;
+    view->buf    = NULL;
+    view->pinned = -1;
+
+    //不是mmap时直接读到view自己的缓冲区
+    stIndex index;
+    char * grid = NULL;
+    ssize_t size = 0;
+    CHK_RET(_read_grid(pfs, type, key, NULL, &index, &grid, &size));
+
+    stFileInfo * pfi = _file_info(pfs, &index);
+    char * buf = (pfi->map == NULL) ? grid : NULL;
+
+    stGridData data;
+    if (_check_value(pfs, grid, size, type, &data) != 0)
+    {
+        free(buf);
+        return -1;
+    }
+
+    if (_grid_compressed((stGridHeader *) grid))
+    {
+        char * raw = malloc(((stGridHeader *) grid)->header.raw_len + 1);
+        if (raw == NULL || _decompress_value(grid, &data, raw, &view->vlen) != 0)
+        {
+            free(raw);
+            free(buf);
+            return -1;
+        }
+
+        free(buf);
+        view->value = view->buf = raw;
+        return index_to_int64(&index);
+    }
+
+    view->value = data.value;
+    view->vlen  = data.vlen;
+    if (buf != NULL)
+        view->buf = buf;
+    else
+    {
+        __sync_fetch_and_add(&pfi->pins, 1);
+        view->pinned = index_to_int64(&index);
+    }
+
+    return index_to_int64(&index);
+}
+
+int64_t rfs_get_view(rfs * pfs, uint8_t type, void * key, rfs_view * view)
+{
+    pthread_rwlock_rdlock(&pfs->lock);
+    int64_t ret = _rfs_get_view(pfs, type, key, view);
+    pthread_rwlock_unlock(&pfs->lock);
+
+    return ret;
+}
+
+int rfs_release_view(rfs * pfs, rfs_view * view)
+{
+    if (view->pinned != -1)
+    {
+        stIndex index;
+        int64_to_index(view->pinned, &index);
+
+        //写接口扩展file_info_array时会挪动pins
+        pthread_rwlock_rdlock(&pfs->lock);
+        __sync_fetch_and_sub(&_file_info(pfs, &index)->pins, 1);
+        pthread_rwlock_unlock(&pfs->lock);
+    }
+
+    free(view->buf);
+    view->value  = NULL;
+    view->vlen   = 0;
+    view->buf    = NULL;
+    view->pinned = -1;
+
+    return 0;
+}
+
+static int64_t _rfs_visit(rfs * pfs, uint8_t type, void * key, rfs_visitor visitor, void * arg)
+{
+    stIndex index;
+    char * grid = NULL;
+    ssize_t size = 0;
+    stScratch * scratch = _scratch(pfs);
+    if (scratch == NULL)
+        return -1;
+
+    CHK_RET(_read_grid(pfs, type, key, scratch->grid, &index, &grid, &size));
+
+    stGridData data;
+    CHK_RET(_check_value(pfs, grid, size, type, &data));
+
+    int64_t ret = index_to_int64(&index);
+    if (!_grid_compressed((stGridHeader *) grid))
+        return (visitor(data.value, data.vlen, arg) == 0) ? ret : -1;
+
+    //压缩的value只能先解压
+    char * raw = malloc(((stGridHeader *) grid)->header.raw_len + 1);
+    uint16_t vlen = 0;
+    if (raw == NULL || _decompress_value(grid, &data, raw, &vlen) != 0 || visitor(raw, vlen, arg) != 0)
+        ret = -1;
+    free(raw);
+
+    return ret;
+}
+
+int64_t rfs_visit(rfs * pfs, uint8_t type, void * key, rfs_visitor visitor, void * arg)
+{
+    pthread_rwlock_rdlock(&pfs->lock);
+    int64_t ret = _rfs_visit(pfs, type, key, visitor, arg);
+    pthread_rwlock_unlock(&pfs->lock);
+
+    return ret;
+}
+
+static int _rfs_del(rfs * pfs, uint8_t type, void * key, char * info, uint16_t ilen)
+{
+    stKeyCallback * cb = pfs->user_callbacks + type;
+
+    char kbuf[MAX_KEY_LEN];
+    uint16_t klen = MAX_KEY_LEN;
+    if (cb->serialize(key, kbuf, &klen) != 0)
+        return -1;
+
+    CHK_RET(_wait_key(pfs, type, kbuf, klen));
+
+    stIndex index;
+    if (hashtable_get(pfs->hash_table, key, &index, NULL, cb) != 0)
+        return -1;
+
+    struct iovec iov[GRID_IOV_NUM];
+    int iovcnt = _del_iov(iov, &type, &klen, kbuf);
+
+    uint64_t lsn = _wal_log(pfs, WAL_OP_DEL, &index, NULL, iov, iovcnt, _iov_len(iov, iovcnt));
+
+    stPending pending = { NULL, type, klen, kbuf };
+    if (lsn == 0 || _wal_wait(pfs, lsn, &pending, 1) != 0)
+        return -1;
+
+    _del_grid(pfs, &index, lsn);
+
+    _mark_idle(pfs, &index);
+    _large_free(pfs, &index);
+
+    int ret = hashtable_del(pfs->hash_table, key, cb);
+    _wal_maybe_checkpoint(pfs);
+
+    return ret;
+}
+
+int rfs_del(rfs * pfs, uint8_t type, void * key, char * info, uint16_t ilen)
+{
+    pthread_rwlock_wrlock(&pfs->lock);
+    int ret = _rfs_del(pfs, type, key, info, ilen);
+    pthread_rwlock_unlock(&pfs->lock);
+
+    return ret;
+}
+
+//批量接口中的一个key
+typedef struct {
+    uint32_t  i;          //在keys中的下标
+    stSetPlan plan;       //rfs_mget/rfs_mdel只用到plan.index
+    stGridHeader grid_header; //rfs_mset写入的格子头, 每个key的lsn不同
+    uint8_t   type;
+    uint16_t  klen;
+    uint16_t  vlen;
+    uint32_t  real_len;
+    char      key[MAX_KEY_LEN];
+} stBatchItem;
+
+//按(file_type, file_no, grid_idx)排序, 同一个格子按keys中的顺序
+static int _cmp_batch_item(const void * a, const void * b)
+{
+    const stBatchItem * pa = (const stBatchItem *) a;
+    const stBatchItem * pb = (const stBatchItem *) b;
+
+    int ret = _cmp_index(&pa->plan.index, &pb->plan.index);
+    if (ret != 0)
+        return ret;
+
+    return (pa->i < pb->i) ? -1 : ((pa->i > pb->i) ? 1 : 0);
+}
+
+static inline int _same_batch_key(const stBatchItem * a, const stBatchItem * b)
+{
+    return a->klen == b->klen && memcmp(a->key, b->key, a->klen) == 0;
+}
+
+//按序列化后的key排序, 同一个key按keys中的顺序
+static int _cmp_batch_key(const void * a, const void * b)
+{
+    const stBatchItem * pa = (const stBatchItem *) a;
+    const stBatchItem * pb = (const stBatchItem *) b;
+
+    if (pa->klen != pb->klen)
+        return (pa->klen < pb->klen) ? -1 : 1;
+
+    int ret = memcmp(pa->key, pb->key, pa->klen);
+    if (ret != 0)
+        return ret;
+
+    return (pa->i < pb->i) ? -1 : ((pa->i > pb->i) ? 1 : 0);
+}
+
+//items[begin, end)都在同一个文件中, 返回从begin开始能合并成一次读写的个数
+static uint32_t _batch_run(stBatchItem * items, uint32_t begin, uint32_t end, uint32_t grid_size, uint32_t max_bytes, uint32_t max_gap)
+{
+    stIndex * first = &items[begin].plan.index;
+
+    uint32_t i = begin + 1;
+    for (; i < end; ++i)
+    {
+        stIndex * cur  = &items[i].plan.index;
+        stIndex * prev = &items[i-1].plan.index;
+
+        if (cur->file.file_type != first->file.file_type || cur->file.file_no != first->file.file_no)
+            break;
+
+        if ((uint64_t) (cur->grid_idx - prev->grid_idx) * grid_size > max_gap + grid_size)
+            break;
+
+        if ((uint64_t) (cur->grid_idx - first->grid_idx + 1) * grid_size > max_bytes)
+            break;
+    }
+
+    return i - begin;
+}
+
+static int _rfs_mget(rfs * pfs, uint8_t type, void ** keys, char ** values, uint16_t * vlens, uint32_t n, int64_t * rets)
+{
+    stKeyCallback * cb = pfs->user_callbacks + type;
+
+    stScratch * scratch = _scratch(pfs);
+    if (scratch == NULL)
+        return -1;
+
+    stBatchItem * items = malloc(n * sizeof(stBatchItem));
+    if (items == NULL)
+        return -1;
+
+    uint32_t cnt = 0;
+    uint32_t i = 0;
+    for (; i < n; ++i)
+    {
+        rets[i] = -1;
+        if (hashtable_get(pfs->hash_table, keys[i], &items[cnt].plan.index, NULL, cb) != 0)
+            continue;
+
+        items[cnt++].i = i;
+    }
+
+    qsort(items, cnt, sizeof(stBatchItem), _cmp_batch_item);
+
+    uint32_t ok = 0;
+    uint32_t begin = 0;
+    while (begin < cnt)
+    {
+        stIndex       * first = &items[begin].plan.index;
+        stFileTypeMng * pftm  = _type_mng(pfs, first);
+        stFileInfo    * pfi   = _file_info(pfs, first);
+
+        uint32_t run = _batch_run(items, begin, cnt, pftm->grid_size, pfs->batch_size, BATCH_MAX_GAP);
+        uint32_t last_idx = items[begin + run - 1].plan.index.grid_idx;
+
+        uint64_t offset = _grid_offset(pftm, first->grid_idx);
+        uint64_t length = (uint64_t) (last_idx - first->grid_idx + 1) * pftm->grid_size;
+
+        char * buf = scratch->batch;
+        if (pfi->map != NULL)
+            buf = pfi->map + offset;
+        else if (_pread_grids(pfs, pfi, buf, length, offset) != length)
+        {
+            printf("(%s:%s)\tfailed to read %u grids from file %s, reason: %s\n",
+                    __FILE__, __FUNCTION__, run, pfi->path, strerror(errno));
+            begin += run;
+            continue;
+        }
+
+        for (i = begin; i < begin + run; ++i)
+        {
+            stBatchItem * item = items + i;
+            char * grid = buf + (uint64_t) (item->plan.index.grid_idx - first->grid_idx) * pftm->grid_size;
+
+            if (_get_value(pfs, grid, pftm->grid_size, type, values[item->i], vlens + item->i) != 0)
+                continue;
+
+            rets[item->i] = index_to_int64(&item->plan.index);
+            ++ok;
+        }
+
+        begin += run;
+    }
+
+    free(items);
+    return ok;
+}
+
+int rfs_mget(rfs * pfs, uint8_t type, void ** keys, char ** values, uint16_t * vlens, uint32_t n, int64_t * rets)
+{
+    pthread_rwlock_rdlock(&pfs->lock);
+    int ret = _rfs_mget(pfs, type, keys, values, vlens, n, rets);
+    pthread_rwlock_unlock(&pfs->lock);
+
+    return ret;
+}
+
+static int _cmp_prefetch(const void * a, const void * b)
+{
+    return _cmp_index((const stIndex *) a, (const stIndex *) b);
+}
+
+//让[offset, offset+len)提前读进page cache, 不等读完
+static void _prefetch_range(rfs * pfs, stFileInfo * pfi, uint64_t offset, uint64_t len)
+{
+    if (pfi->map != NULL)
+    {
+        uint64_t begin = offset & ~((uint64_t) pfs->page_size - 1);
+        madvise(pfi->map + begin, offset + len - begin, MADV_WILLNEED);
+        return;
+    }
+
+    int dfd = -1;
+    int fd = _file_fds(pfs, pfi, &dfd);
+    if (fd < 0)
+        return;
+
+    //O_DIRECT读不经过page cache, 预读了也用不上
+    if (dfd < 0)
+        posix_fadvise(fd, offset, len, POSIX_FADV_WILLNEED);
+
+    _file_put(pfs, pfi);
+}
+
+static int _rfs_prefetch(rfs * pfs, uint8_t type, void ** keys, uint32_t n)
+{
+    stKeyCallback * cb = pfs->user_callbacks + type;
+
+    stIndex * indexes = malloc(n * sizeof(stIndex) + 1);
+    if (indexes == NULL)
+        return -1;
+
+    uint32_t cnt = 0;
+    uint32_t i = 0;
+    for (; i < n; ++i)
+    {
+        if (hashtable_get(pfs->hash_table, keys[i], indexes + cnt, NULL, cb) == 0)
+            ++cnt;
+    }
+
+    //同一个文件中相邻的格子合并成一次预读
+    qsort(indexes, cnt, sizeof(stIndex), _cmp_prefetch);
+
+    uint32_t begin = 0;
+    while (begin < cnt)
+    {
+        stIndex       * first = indexes + begin;
+        stFileTypeMng * pftm  = _type_mng(pfs, first);
+
+        uint32_t end = begin + 1;
+        while (end < cnt && indexes[end].file.file_type == first->file.file_type
+                && indexes[end].file.file_no == first->file.file_no
+                && indexes[end].grid_idx <= indexes[end-1].grid_idx + 1)
+            ++end;
+
+        uint32_t last_idx = indexes[end-1].grid_idx;
+        _prefetch_range(pfs, _file_info(pfs, first), _grid_offset(pftm, first->grid_idx),
+                (uint64_t) (last_idx - first->grid_idx + 1) * pftm->grid_size);
+
+        begin = end;
+    }
+
+    free(indexes);
+    return cnt;
+}
+
+int rfs_prefetch(rfs * pfs, uint8_t type, void ** keys, uint32_t n)
+{
+    pthread_rwlock_rdlock(&pfs->lock);
+    int ret = _rfs_prefetch(pfs, type, keys, n);
+    pthread_rwlock_unlock(&pfs->lock);
+
+    return ret;
+}
+
+//把items[begin, begin+run)写到同一个文件的相邻格子, 格子之间的空隙用zero_data填充
+static int _mset_write_run(rfs * pfs, stBatchItem * items, uint32_t run, char ** values)
+{
+    stIndex       * first = &items[0].plan.index;
+    stFileTypeMng * pftm  = _type_mng(pfs, first);
+    stFileInfo    * pfi   = _file_info(pfs, first);
+    uint64_t       offset = _grid_offset(pftm, first->grid_idx);
+
+    if (pfi->map != NULL)
+    {
+        uint32_t i = 0;
+        for (; i < run; ++i)
+        {
+            stBatchItem * item = items + i;
+
+            struct iovec iov[GRID_IOV_NUM];
+            int iovcnt = _grid_iov(iov, &item->grid_header, &item->type, &item->klen, item->key, &item->vlen, values[item->i]);
+            CHK_RET(_write(pfs, pfi, _grid_offset(pftm, item->plan.index.grid_idx), iov, iovcnt, item->real_len));
+        }
+        return 0;
+    }
+
+    struct iovec * iov = malloc(run * (GRID_IOV_NUM + 1) * sizeof(struct iovec));
+    if (iov == NULL)
+        return -1;
+
+    int      iovcnt = 0;
+    uint64_t length = 0;
+    uint32_t i = 0;
+    for (; i < run; ++i)
+    {
+        stBatchItem * item = items + i;
+
+        uint64_t grid_offset = _grid_offset(pftm, item->plan.index.grid_idx);
+        if (grid_offset > offset + length)
+        {
+            iov[iovcnt].iov_base = pfs->zero_data;
+            iov[iovcnt].iov_len  = grid_offset - (offset + length);
+            length += iov[iovcnt++].iov_len;
+        }
+
+        iovcnt += _grid_iov(iov + iovcnt, &item->grid_header, &item->type, &item->klen, item->key, &item->vlen, values[item->i]);
+        length += item->real_len;
+    }
+
+    int fd = _file_fd(pfs, pfi);
+    if (fd < 0)
+    {
+        free(iov);
+        return -1;
+    }
+
+    ssize_t r = pwritev(fd, iov, iovcnt, offset);
+    _file_put(pfs, pfi);
+    free(iov);
+
+    return (r == length) ? 0 : -1;
+}
+
+static int _rfs_mset(rfs * pfs, uint32_t now, uint8_t type, void ** keys, char ** values, uint16_t * vlens, uint32_t n, int64_t * rets)
+{
+    stKeyCallback * cb = pfs->user_callbacks + type;
+
+    stBatchItem * items = malloc(n * sizeof(stBatchItem));
+    if (items == NULL)
+        return -1;
+
+    uint32_t i = 0;
+
+    //需要压缩时values换成指向压缩后数据的副本, 压缩后的数据依次放在zbuf中
+    char ** zvalues = NULL;
+    char *  zbuf    = NULL;
+    if (_compressible(pfs, type))
+    {
+        uint64_t total = 0;
+        for (i = 0; i < n; ++i)
+            total += vlens[i];
+
+        zvalues = malloc(n * sizeof(char *) + total);
+        if (zvalues == NULL)
+        {
+            free(items);
+            return -1;
+        }
+        memcpy(zvalues, values, n * sizeof(char *));
+        zbuf   = (char *) (zvalues + n);
+        values = zvalues;
+    }
+
+    //同一个key出现多次时只写最后一次的value, 与逐个rfs_set的结果一致, 前面几次的结果与它相同
+    //每个key只有一个格子, 写失败时各自恢复, 不会撤销别的key预占的格子
+    uint32_t * same = malloc(n * sizeof(uint32_t));
+    stPending * pendings = malloc(n * sizeof(stPending));
+    if (same == NULL || pendings == NULL)
+    {
+        free(items);
+        free(zvalues);
+        free(same);
+        free(pendings);
+        return -1;
+    }
+
+    uint32_t cnt = 0;
+    for (i = 0; i < n; ++i)
+    {
+        rets[i] = -1;
+        same[i] = i;
+
+        stBatchItem * item = items + cnt;
+        item->i    = i;
+        item->type = type;
+        item->klen = MAX_KEY_LEN;
+        if (cb->serialize(keys[i], item->key, &item->klen) == 0)
+            ++cnt;
+    }
+
+    qsort(items, cnt, sizeof(stBatchItem), _cmp_batch_key);
+
+    uint32_t num = 0;
+    uint32_t j = 0;
+    for (i = 0; i < cnt; i = j)
+    {
+        for (j = i + 1; j < cnt && _same_batch_key(items + i, items + j); ++j)
+            ;
+
+        uint32_t k = i;
+        for (; k + 1 < j; ++k)
+            same[items[k].i] = items[j-1].i;
+        items[num++] = items[j-1];
+    }
+
+    //有key在等日志落盘时等它完成, 放开锁期间别的key也可能开始等, 从头再查
+    for (j = 0; j < num; )
+    {
+        if (_key_busy(pfs, type, items[j].key, items[j].klen) == 1)
+        {
+            _wait_pending(pfs);
+            j = 0;
+        }
+        else
+            ++j;
+    }
+
+    //再给所有key确定格子, 跳过有未完成的rfs_set_async的key
+    cnt = 0;
+    for (j = 0; j < num; ++j)
+    {
+        stBatchItem * item = items + cnt;
+        if (item != items + j)
+            *item = items[j];
+
+        if (_key_busy(pfs, type, item->key, item->klen) != 0)
+            continue;
+
+        i = item->i;
+        item->vlen = vlens[i];
+
+        _init_grid_header(&item->grid_header, now, 0);
+        if (zbuf != NULL)
+        {
+            values[i] = _compress_value(pfs, type, &item->grid_header, values[i], &item->vlen, zbuf);
+            zbuf += item->vlen;
+        }
+
+        item->real_len = sizeof(stGridHeader) + sizeof(uint8_t) + sizeof(uint16_t) + item->klen + sizeof(uint16_t) + item->vlen;
+        if (_plan_set(pfs, keys[i], cb, item->real_len, &item->plan) != 0)
+            continue;
+
+        struct iovec iov[GRID_IOV_NUM];
+        int iovcnt = _grid_iov(iov, &item->grid_header, &item->type, &item->klen, item->key, &item->vlen, values[i]);
+        _grid_checksum(iov, iovcnt);
+
+        stSetPlan * plan = &item->plan;
+        item->grid_header.header.lsn = _wal_log(pfs, WAL_OP_SET, &plan->index, plan->relocate ? &plan->old_index : NULL, iov, iovcnt, item->real_len);
+        if (item->grid_header.header.lsn == 0)
+        {
+            _abort_set(pfs, plan);
+            continue;
+        }
+
+        ++cnt;
+    }
+
+    //所有key的日志一起落盘, 放开锁期间这些key的写操作等这次完成
+    for (i = 0; i < cnt; ++i)
+    {
+        pendings[i].type = type;
+        pendings[i].klen = items[i].klen;
+        pendings[i].kbuf = items[i].key;
+    }
+
+    if (cnt > 0 && _wal_wait(pfs, items[cnt-1].grid_header.header.lsn, pendings, cnt) != 0)
+    {
+        while (cnt > 0)
+        {
+            --cnt;
+            _abort_set(pfs, &items[cnt].plan);
+        }
+    }
+
+    //IOV_MAX限制了一次pwritev的格子数
+    uint32_t max_run = IOV_MAX / (GRID_IOV_NUM + 1);
+
+    qsort(items, cnt, sizeof(stBatchItem), _cmp_batch_item);
+
+    uint32_t begin = 0;
+    while (begin < cnt)
+    {
+        stFileTypeMng * pftm = _type_mng(pfs, &items[begin].plan.index);
+
+        uint32_t run = _batch_run(items, begin, MIN(cnt, begin + max_run), pftm->grid_size, pfs->batch_size, 0);
+
+        int ret = _mset_write_run(pfs, items + begin, run, values);
+        if (ret != 0)
+        {
+            printf("(%s:%s)\tfailed to write %u grids to file %s, reason: %s\n",
+                    __FILE__, __FUNCTION__, run, _file_info(pfs, &items[begin].plan.index)->path, strerror(errno));
+        }
+
+        for (i = begin; i < begin + run; ++i)
+        {
+            stBatchItem * item = items + i;
+            if (ret == 0)
+                rets[item->i] = index_to_int64(&item->plan.index);
+            else
+                _undo_set(pfs, type, keys[item->i], item->key, item->klen, &item->plan, item->grid_header.header.lsn);
+        }
+
+        begin += run;
+    }
+
+    //数据都写完后再删除挪走的旧数据
+    uint32_t ok = 0;
+    for (i = 0; i < cnt; ++i)
+    {
+        stBatchItem * item = items + i;
+        if (rets[item->i] == -1)
+            continue;
+
+        if (_commit_set(pfs, keys[item->i], cb, &item->plan, item->grid_header.header.lsn) != 0)
+        {
+            _undo_set(pfs, type, keys[item->i], item->key, item->klen, &item->plan, item->grid_header.header.lsn);
+            rets[item->i] = -1;
+        }
+        else
+            ++ok;
+    }
+
+    for (i = 0; i < n; ++i)
+    {
+        if (same[i] == i)
+            continue;
+
+        rets[i] = rets[same[i]];
+        if (rets[i] != -1)
+            ++ok;
+    }
+
+    free(same);
+    free(pendings);
+    free(items);
+    free(zvalues);
+    _wal_maybe_checkpoint(pfs);
+
+    return ok;
+}
+
+int rfs_mset(rfs * pfs, uint32_t now, uint8_t type, void ** keys, char ** values, uint16_t * vlens, uint32_t n, int64_t * rets)
+{
+    pthread_rwlock_wrlock(&pfs->lock);
+    int ret = _rfs_mset(pfs, now, type, keys, values, vlens, n, rets);
+    pthread_rwlock_unlock(&pfs->lock);
+
+    return ret;
+}
+
+static int _rfs_mdel(rfs * pfs, uint8_t type, void ** keys, uint32_t n, int * rets)
+{
+    stKeyCallback * cb = pfs->user_callbacks + type;
+
+    stBatchItem * items = malloc(n * sizeof(stBatchItem));
+    stPending * pendings = malloc(n * sizeof(stPending));
+    if (items == NULL || pendings == NULL)
+    {
+        free(items);
+        free(pendings);
+        return -1;
+    }
+
+    uint32_t cnt = 0;
+    uint32_t i = 0;
+    for (; i < n; ++i)
+    {
+        rets[i] = -1;
+
+        stBatchItem * item = items + cnt;
+        item->i    = i;
+        item->type = type;
+        item->klen = MAX_KEY_LEN;
+        if (cb->serialize(keys[i], item->key, &item->klen) == 0)
+            ++cnt;
+    }
+
+    //有key在等日志落盘时等它完成, 放开锁期间别的key也可能开始等, 从头再查
+    for (i = 0; i < cnt; )
+    {
+        if (_key_busy(pfs, type, items[i].key, items[i].klen) == 1)
+        {
+            _wait_pending(pfs);
+            i = 0;
+        }
+        else
+            ++i;
+    }
+
+    uint32_t num = 0;
+    for (i = 0; i < cnt; ++i)
+    {
+        stBatchItem * item = items + num;
+        if (item != items + i)
+            *item = items[i];
+
+        if (_key_busy(pfs, type, item->key, item->klen) == 0
+                && hashtable_get(pfs->hash_table, keys[item->i], &item->plan.index, NULL, cb) == 0)
+            ++num;
+    }
+    cnt = num;
+
+    qsort(items, cnt, sizeof(stBatchItem), _cmp_batch_item);
+
+    //先记下所有key的日志并一起落盘, 同一个key出现多次时只删一次
+    uint64_t lsn = 0;
+    num = 0;
+    for (i = 0; i < cnt; ++i)
+    {
+        stBatchItem * item = items + i;
+        item->grid_header.header.lsn = 0;
+        if (i > 0 && _cmp_index(&items[i-1].plan.index, &item->plan.index) == 0)
+            continue;
+
+        struct iovec iov[GRID_IOV_NUM];
+        int iovcnt = _del_iov(iov, &item->type, &item->klen, item->key);
+        item->grid_header.header.lsn = _wal_log(pfs, WAL_OP_DEL, &item->plan.index, NULL, iov, iovcnt, _iov_len(iov, iovcnt));
+        if (item->grid_header.header.lsn == 0)
+            continue;
+
+        lsn = item->grid_header.header.lsn;
+        pendings[num].type = type;
+        pendings[num].klen = item->klen;
+        pendings[num].kbuf = item->key;
+        ++num;
+    }
+
+    if (lsn != 0 && _wal_wait(pfs, lsn, pendings, num) != 0)
+    {
+        free(items);
+        free(pendings);
+        return -1;
+    }
+
+    uint32_t ok = 0;
+    for (i = 0; i < cnt; ++i)
+    {
+        stBatchItem * item = items + i;
+        if (item->grid_header.header.lsn == 0)
+            continue;
+
+        stIndex * index = &item->plan.index;
+        _del_grid(pfs, index, item->grid_header.header.lsn);
+        _mark_idle(pfs, index);
+        _large_free(pfs, index);
+
+        rets[item->i] = hashtable_del(pfs->hash_table, keys[item->i], cb);
+        if (rets[item->i] == 0)
+            ++ok;
+    }
+
+    free(items);
+    free(pendings);
+    _wal_maybe_checkpoint(pfs);
+
+    return ok;
+}
+
+int rfs_mdel(rfs * pfs, uint8_t type, void ** keys, uint32_t n, int * rets)
+{
+    pthread_rwlock_wrlock(&pfs->lock);
+    int ret = _rfs_mdel(pfs, type, keys, n, rets);
+    pthread_rwlock_unlock(&pfs->lock);
+
+    return ret;
+}
+
+typedef struct _stAsyncReq {
+    struct _stAsyncReq * next;   //在async_writes链表中的下一个
+    rfs_async_callback callback;
+    void *       arg;
+    uint8_t      write;
+    uint8_t      type;
+    void *       key;
+    stSetPlan    plan;           //rfs_get_async只用到plan.index
+    stGridHeader grid_header;
+    uint16_t     klen;
+    uint16_t     vlen;
+    uint32_t     real_len;
+    char         kbuf[MAX_KEY_LEN];
+    struct iovec iov[GRID_IOV_NUM];
+    char *       raw;            //rfs_get_async解压后的value
+    char         buf[];          //rfs_get_async读出的格子, rfs_set_async压缩后的value
+} stAsyncReq;
+
+static int _async_init(rfs * pfs)
+{
+    if (pfs->aio != NULL)
+        return 0;
+
+    stUserConfig * puc = &pfs->user_config;
+    if (puc->async_depth == 0)
+        puc->async_depth = 1;
+
+    pfs->aio_events = calloc(puc->async_depth, sizeof(stAioEvent));
+    if (pfs->aio_events == NULL)
+        return -1;
+
+    pfs->aio = aio_create(puc->async_engine, puc->async_depth, puc->async_thread_num);
+    if (pfs->aio == NULL)
+    {
+        printf("(%s:%s)\tfailed to create aio engine\n", __FILE__, __FUNCTION__);
+        free(pfs->aio_events);
+        pfs->aio_events = NULL;
+        return -1;
+    }
+
+    return 0;
+}
+
+//等日志落盘的rfs_set_async还没有提交, 也要算上
+static int _async_full(rfs * pfs)
+{
+    return aio_inflight(pfs->aio) + pfs->async_logging >= pfs->user_config.async_depth;
+}
+
+//key是否有未完成的rfs_set_async, 有的话这个key的写操作都返回失败
+static int _async_busy(rfs * pfs, uint8_t type, const char * kbuf, uint16_t klen)
+{
+    stAsyncReq * req = pfs->async_writes;
+    for (; req != NULL; req = req->next)
+    {
+        if (req->type == type && req->klen == klen && memcmp(req->kbuf, kbuf, klen) == 0)
+            return 1;
+    }
+
+    return 0;
+}
+
+static void _async_unlink(rfs * pfs, stAsyncReq * req)
+{
+    stAsyncReq ** pp = &pfs->async_writes;
+    for (; *pp != req; pp = &(*pp)->next)
+        assert(*pp != NULL);
+    *pp = req->next;
+}
+
+static int _rfs_get_async(rfs * pfs, uint8_t type, void * key, rfs_async_callback callback, void * arg)
+{
+    CHK_RET(_async_init(pfs));
+    if (_async_full(pfs))
+        return -1;
+
+    stKeyCallback * cb = pfs->user_callbacks + type;
+
+    stIndex index;
+    if (hashtable_get(pfs->hash_table, key, &index, NULL, cb) != 0)
+        return -1;
+
+    stFileTypeMng * pftm = _type_mng(pfs, &index);
+    stFileInfo    * pfi  = _file_info(pfs, &index);
+
+    stAsyncReq * req = malloc(sizeof(stAsyncReq) + pftm->grid_size);
+    if (req == NULL)
+        return -1;
+
+    req->callback   = callback;
+    req->arg        = arg;
+    req->write      = 0;
+    req->type       = type;
+    req->key        = key;
+    req->plan.index = index;
+    req->raw        = NULL;
+    req->iov[0].iov_base = req->buf;
+    req->iov[0].iov_len  = pftm->grid_size;
+
+    //提交后有未完成的请求, 描述符缓存不会关这个描述符
+    int fd = _file_fd(pfs, pfi);
+    int r  = (fd < 0) ? -1 : aio_submit(pfs->aio, fd, 0, req->iov, 1, _grid_offset(pftm, index.grid_idx), req);
+    if (fd >= 0)
+        _file_put(pfs, pfi);
+
+    if (r != 0)
+    {
+        free(req);
+        return -1;
+    }
+
+    return 0;
+}
+
+int rfs_get_async(rfs * pfs, uint8_t type, void * key, rfs_async_callback callback, void * arg)
+{
+    pthread_rwlock_wrlock(&pfs->lock);
+    int ret = _rfs_get_async(pfs, type, key, callback, arg);
+    pthread_rwlock_unlock(&pfs->lock);
+
+    return ret;
+}
+
+static int _rfs_set_async(rfs * pfs, uint32_t now, uint8_t type, void * key, char * value, uint16_t vlen, rfs_async_callback callback, void * arg)
+{
+    CHK_RET(_async_init(pfs));
+
+    stKeyCallback * cb = pfs->user_callbacks + type;
+
+    stAsyncReq * req = malloc(sizeof(stAsyncReq) + (_compressible(pfs, type) ? vlen : 0));
+    if (req == NULL)
+        return -1;
+
+    req->callback = callback;
+    req->arg      = arg;
+    req->write    = 1;
+    req->type     = type;
+    req->key      = key;
+    req->raw      = NULL;
+    req->vlen     = vlen;
+    req->klen     = MAX_KEY_LEN;
+    //等待时放开了锁, 之后再看是否已满
+    if (cb->serialize(key, req->kbuf, &req->klen) != 0 || _wait_key(pfs, type, req->kbuf, req->klen) != 0 || _async_full(pfs))
+    {
+        free(req);
+        return -1;
+    }
+
+    _init_grid_header(&req->grid_header, now, 0);
+    value = _compress_value(pfs, type, &req->grid_header, value, &req->vlen, req->buf);
+
+    //参考文件格式图
+    req->real_len = sizeof(stGridHeader) + sizeof(uint8_t) + sizeof(uint16_t) + req->klen + sizeof(uint16_t) + req->vlen;
+
+    if (_plan_set(pfs, key, cb, req->real_len, &req->plan) != 0)
+    {
+        free(req);
+        return -1;
+    }
+
+    int iovcnt = _grid_iov(req->iov, &req->grid_header, &req->type, &req->klen, req->kbuf, &req->vlen, value);
+    _grid_checksum(req->iov, iovcnt);
+
+    //日志落盘后才提交写请求, 先放进async_writes, 等日志落盘时这个key的其他写操作返回失败
+    stSetPlan * plan = &req->plan;
+    req->grid_header.header.lsn = _wal_log(pfs, WAL_OP_SET, &plan->index, plan->relocate ? &plan->old_index : NULL, req->iov, iovcnt, req->real_len);
+    if (req->grid_header.header.lsn == 0)
+    {
+        _abort_set(pfs, &req->plan);
+        free(req);
+        return -1;
+    }
+
+    req->next = pfs->async_writes;
+    pfs->async_writes = req;
+
+    ++pfs->async_logging;
+    int logged = (_wal_wait(pfs, req->grid_header.header.lsn, NULL, 0) == 0);
+    --pfs->async_logging;
+
+    stIndex    * new_index = &req->plan.index;
+    stFileInfo * pfi       = _file_info(pfs, new_index);
+
+    int fd = -1;
+    int r  = -1;
+    if (logged && (fd = _file_fd(pfs, pfi)) >= 0)
+    {
+        r = aio_submit(pfs->aio, fd, 1, req->iov, iovcnt, _index_offset(pfs, new_index), req);
+        _file_put(pfs, pfi);
+    }
+
+    if (r != 0)
+    {
+        _async_unlink(pfs, req);
+        if (logged)
+            _undo_set(pfs, type, key, req->kbuf, req->klen, &req->plan, req->grid_header.header.lsn);
+        else
+            _abort_set(pfs, &req->plan);
+        free(req);
+        return -1;
+    }
+
+    return 0;
+}
+
+int rfs_set_async(rfs * pfs, uint32_t now, uint8_t type, void * key, char * value, uint16_t vlen, rfs_async_callback callback, void * arg)
+{
+    pthread_rwlock_wrlock(&pfs->lock);
+    int ret = _rfs_set_async(pfs, now, type, key, value, vlen, callback, arg);
+    pthread_rwlock_unlock(&pfs->lock);
+
+    return ret;
+}
+
+//解析rfs_get_async读出的格子, 参考文件格式图
+static int64_t _async_get_done(rfs * pfs, stAsyncReq * req, int64_t res, stAsyncResult * result)
+{
+    uint32_t grid_size = _type_mng(pfs, &req->plan.index)->grid_size;
+    if (res <= 0)
+        return -1;
+
+    stGridData data;
+    if (_parse_grid(req->buf, (res < grid_size) ? res : grid_size, pfs->user_config.verify_checksum_when_get, &data) != 0
+        || data.type != req->type)
+        return -1;
+
+    result->klen  = data.klen;
+    result->kbuf  = data.key;
+    result->vlen  = data.vlen;
+    result->value = data.value;
+
+    stGridHeader * grid_header = (stGridHeader *) req->buf;
+    if (_grid_large(grid_header) || _grid_expired(grid_header, 0))
+        return -1;
+
+    if (_grid_compressed(grid_header))
+    {
+        uint16_t raw_len = grid_header->header.raw_len;
+        req->raw = malloc(raw_len);
+        if (req->raw == NULL || lz_decompress(data.value, data.vlen, req->raw, raw_len) != raw_len)
+            return -1;
+
+        result->vlen  = raw_len;
+        result->value = req->raw;
+    }
+
+    //提交之后格子可能已被rfs_set挪走并被别的key占用
+    if (pfs->user_config.check_key_when_get)
+    {
+        char kbuf[MAX_KEY_LEN];
+        uint16_t klen = MAX_KEY_LEN;
+        stKeyCallback * cb = pfs->user_callbacks + req->type;
+        if (cb->serialize(req->key, kbuf, &klen) != 0 || klen != result->klen || memcmp(kbuf, result->kbuf, klen) != 0)
+            return -1;
+    }
+
+    return index_to_int64(&req->plan.index);
+}
+
+static int64_t _async_set_done(rfs * pfs, stAsyncReq * req, int64_t res)
+{
+    _async_unlink(pfs, req);
+
+    stKeyCallback * cb = pfs->user_callbacks + req->type;
+    if (res != req->real_len)
+    {
+        printf("(%s:%s)\tfailed to write grid %u of file %s, reason: %s\n",
+                __FILE__, __FUNCTION__, req->plan.index.grid_idx, _file_info(pfs, &req->plan.index)->path,
+                (res < 0) ? strerror((int) -res) : "short write");
+        _undo_set(pfs, req->type, req->key, req->kbuf, req->klen, &req->plan, req->grid_header.header.lsn);
+        return -1;
+    }
+
+    if (_commit_set(pfs, req->key, cb, &req->plan, req->grid_header.header.lsn) != 0)
+    {
+        _undo_set(pfs, req->type, req->key, req->kbuf, req->klen, &req->plan, req->grid_header.header.lsn);
+        return -1;
+    }
+    return index_to_int64(&req->plan.index);
+}
+
+static int _rfs_poll(rfs * pfs, uint32_t min_complete)
+{
+    if (pfs->aio == NULL)
+        return 0;
+
+    int n = aio_reap(pfs->aio, min_complete, pfs->aio_events, pfs->user_config.async_depth);
+
+    int i = 0;
+    for (; i < n; ++i)
+    {
+        stAsyncReq * req = (stAsyncReq *) pfs->aio_events[i].data;
+
+        stAsyncResult result;
+        memset(&result, 0, sizeof(result));
+        result.type = req->type;
+        result.key  = req->key;
+
+        if (req->write)
+            result.ret = _async_set_done(pfs, req, pfs->aio_events[i].res);
+        else
+            result.ret = _async_get_done(pfs, req, pfs->aio_events[i].res, &result);
+
+        if (req->callback != NULL)
+            req->callback(&result, req->arg);
+
+        free(req->raw);
+        free(req);
+    }
+
+    if (n > 0)
+        _wal_maybe_checkpoint(pfs);
+
+    return n;
+}
+
+int rfs_poll(rfs * pfs, uint32_t min_complete)
+{
+    pthread_rwlock_wrlock(&pfs->lock);
+    int ret = _rfs_poll(pfs, min_complete);
+    pthread_rwlock_unlock(&pfs->lock);
+
+    return ret;
+}
+
+static int _rfs_sync(rfs * pfs)
+{
+    return _sync_files(pfs);
+}
+
+int rfs_sync(rfs * pfs)
+{
+    //日志自己加锁, 落盘时不挡住其他接口
+    if (pfs->wal != NULL)
+        return wal_commit(pfs->wal, 0);
+
+    pthread_rwlock_wrlock(&pfs->lock);
+    int ret = _rfs_sync(pfs);
+    pthread_rwlock_unlock(&pfs->lock);
+
+    return ret;
+}
+
+struct _stLargeWriter
+{
+    rfs *     pfs;
+    uint8_t   type;
+    void *    key;
+    uint32_t  len;        //已写入的字节数
+    uint32_t  max_parts;  //key所在的格子最多能记下的段数
+    uint32_t  part_num;
+    uint32_t  part_cap;
+    stIndex * parts;
+    uint32_t  used;       //buf中还没写入格子的字节数
+    char *    buf;        //不满一段的数据, 大小为_part_payload
+};
+
+//写入大value的一段, 段的lsn取当前最大的lsn, 日志补写时不会覆盖之前分配给这个格子的写操作
+static int _large_write_part(rfs_lwriter * w, const char * data, uint32_t len)
+{
+    rfs * pfs = w->pfs;
+
+    if (w->part_num == w->max_parts)
+    {
+        printf("(%s:%s)\tlarge value exceeds %u parts\n", __FILE__, __FUNCTION__, w->max_parts);
+        return -1;
+    }
+
+    if (w->part_num == w->part_cap)
+    {
+        uint32_t cap = w->part_cap ? w->part_cap * 2 : 16;
+        stIndex * parts = realloc(w->parts, cap * sizeof(stIndex));
+        if (parts == NULL)
+            return -1;
+        w->parts    = parts;
+        w->part_cap = cap;
+    }
+
+    stFileTypeMng * pftm = _part_type_mng(pfs);
+    stIndex * part = w->parts + w->part_num;
+    CHK_RET(_get_idx(pfs, pfs->sys_config.max_file_type_num - 1, pfs->sys_config.max_file_type_num - 1, pftm->grid_size,
+                &part->file.file_type, &part->file.file_no, &part->grid_idx));
+    CHK_RET(_mark_used(pfs, part));
+    ++w->part_num;
+
+    stGridHeader grid_header;
+    _init_grid_header(&grid_header, 0, pfs->max_lsn);
+
+    char prefix[sizeof(uint8_t) + sizeof(uint16_t)] = {0};
+    struct iovec iov[] = {
+        { &grid_header,  sizeof(stGridHeader) },
+        { prefix,        sizeof(prefix)       },
+        { (char *) data, len                  },
+    };
+    _grid_checksum(iov, 3);
+    grid_header.header.flags |= GRID_FLAG_PART;
+
+    return _write(pfs, _file_info(pfs, part), _index_offset(pfs, part), iov, 3, _iov_len(iov, 3));
+}
+
+//写日志时各段要先落盘, 之后key所在格子的日志才能落盘
+static int _large_sync_parts(rfs_lwriter * w)
+{
+    rfs * pfs = w->pfs;
+    if (pfs->wal == NULL)
+        return 0;
+
+    stFileTypeMng * pftm = _part_type_mng(pfs);
+
+    uint32_t i = 0;
+    for (; i < w->part_num; ++i)
+    {
+        stIndex    * part = w->parts + i;
+        stFileInfo * pfi  = _file_info(pfs, part);
+
+        //同一个文件只落盘一次
+        if (i > 0 && part->file.file_no == w->parts[i-1].file.file_no)
+            continue;
+
+        if (_sync_file(pftm, pfi) != 0)
+        {
+            printf("(%s:%s)\tfailed to sync file %s, reason: %s\n",
+                    __FILE__, __FUNCTION__, pfi->path, strerror(errno));
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+rfs_lwriter * rfs_lset_begin(rfs * pfs, uint8_t type, void * key)
+{
+    char kbuf[MAX_KEY_LEN];
     uint16_t klen = MAX_KEY_LEN;
+    if (pfs->user_callbacks[type].serialize(key, kbuf, &klen) != 0)
+        return NULL;
+
+    //key所在的格子放得下的段数, 参考文件格式图
+    uint32_t room = _part_type_mng(pfs)->grid_size - sizeof(stGridHeader) - sizeof(uint8_t) - sizeof(uint16_t) - klen - sizeof(uint16_t);
+    room = MIN(room, UINT16_MAX) - sizeof(stLargeHeader);
+
+    rfs_lwriter * w = calloc(1, sizeof(rfs_lwriter));
+    if (w == NULL)
+        return NULL;
+
+    w->buf = malloc(_part_payload(pfs));
+    if (w->buf == NULL)
+    {
+        free(w);
+        return NULL;
+    }
+
+    w->pfs       = pfs;
+    w->type      = type;
+    w->key       = key;
+    w->max_parts = room / sizeof(stIndex);
+
+    return w;
+}
+
+static int _rfs_lset_write(rfs_lwriter * w, const char * data, uint32_t len)
+{
+    uint32_t payload = _part_payload(w->pfs);
+
+    if (w->len + (uint64_t) len > UINT32_MAX)
+        return -1;
+    w->len += len;
+
+    //先补满buf中不满一段的数据, 整段的数据直接写入格子
+    while (len > 0)
+    {
+        if (w->used == 0 && len >= payload)
+        {
+            CHK_RET(_large_write_part(w, data, payload));
+            data += payload;
+            len  -= payload;
+            continue;
+        }
+
+        uint32_t n = MIN(len, payload - w->used);
+        memcpy(w->buf + w->used, data, n);
+        w->used += n;
+        data    += n;
+        len     -= n;
+
+        if (w->used == payload)
+        {
+            CHK_RET(_large_write_part(w, w->buf, payload));
+            w->used = 0;
+        }
+    }
+
+    return 0;
+}
+
+int rfs_lset_write(rfs_lwriter * w, const char * data, uint32_t len)
+{
+    rfs * pfs = w->pfs;
+    pthread_rwlock_wrlock(&pfs->lock);
+    int ret = _rfs_lset_write(w, data, len);
+    pthread_rwlock_unlock(&pfs->lock);
+
+    return ret;
+}
+
+static void _rfs_lset_abort(rfs_lwriter * w)
+{
+    uint32_t i = 0;
+    for (; i < w->part_num; ++i)
+        _mark_idle(w->pfs, w->parts + i);
+
+    free(w->parts);
+    free(w->buf);
+    free(w);
+}
+
+void rfs_lset_abort(rfs_lwriter * w)
+{
+    rfs * pfs = w->pfs;
+    pthread_rwlock_wrlock(&pfs->lock);
+    _rfs_lset_abort(w);
+    pthread_rwlock_unlock(&pfs->lock);
+}
+
+static int64_t _rfs_lset_commit(rfs_lwriter * w, uint32_t now)
+{
+    rfs * pfs = w->pfs;
+
+    if ((w->used > 0 && _large_write_part(w, w->buf, w->used) != 0) || _large_sync_parts(w) != 0)
+    {
+        _rfs_lset_abort(w);
+        return -1;
+    }
+
+    uint16_t vlen  = sizeof(stLargeHeader) + w->part_num * sizeof(stIndex);
+    char *   value = malloc(vlen);
+    if (value == NULL)
+    {
+        _rfs_lset_abort(w);
+        return -1;
+    }
+
+    stLargeHeader header = { w->len, w->part_num };
+    memcpy(value, &header, sizeof(header));
+    memcpy(value + sizeof(header), w->parts, w->part_num * sizeof(stIndex));
+
+    int64_t ret = _set(pfs, now, 0, w->type, w->key, value, vlen, GRID_FLAG_LARGE);
+    free(value);
+
+    //key所在的格子写入后各段交给pfs->large, 不再放回
+    if (ret != -1)
+    {
+        stIndex index;
+        int64_to_index(ret, &index);
+        _large_put(pfs, &index, w->parts, w->part_num);
+
+        w->parts    = NULL;
+        w->part_num = 0;
+    }
+
+    _rfs_lset_abort(w);
+    return ret;
+}
+
+int64_t rfs_lset_commit(rfs_lwriter * w, uint32_t now)
+{
+    rfs * pfs = w->pfs;
+    pthread_rwlock_wrlock(&pfs->lock);
+    int64_t ret = _rfs_lset_commit(w, now);
+    pthread_rwlock_unlock(&pfs->lock);
+
+    return ret;
+}
+
+static int64_t _rfs_lset(rfs * pfs, uint32_t now, uint8_t type, void * key, const char * value, uint32_t vlen)
+{
+    rfs_lwriter * w = rfs_lset_begin(pfs, type, key);
+    if (w == NULL)
+        return -1;
+
+    if (_rfs_lset_write(w, value, vlen) != 0)
+    {
+        _rfs_lset_abort(w);
+        return -1;
+    }
+
+    return _rfs_lset_commit(w, now);
+}
+
+int64_t rfs_lset(rfs * pfs, uint32_t now, uint8_t type, void * key, const char * value, uint32_t vlen)
+{
+    pthread_rwlock_wrlock(&pfs->lock);
+    int64_t ret = _rfs_lset(pfs, now, type, key, value, vlen);
+    pthread_rwlock_unlock(&pfs->lock);
+
+    return ret;
+}
+
+//读出大value的各段, 同一个文件中相邻的段合并成一次preadv
+static int _large_read(rfs * pfs, stLargeHeader * header, stIndex * parts, char * value)
+{
+    stFileTypeMng * pftm    = _part_type_mng(pfs);
+    uint32_t        payload = _part_payload(pfs);
+    uint32_t        max_run = IOV_MAX / 2;
+
+    typedef struct {
+        stGridHeader grid_header;
+        char         prefix[sizeof(uint8_t) + sizeof(uint16_t)];
+    } stPartHead;
+
+    stPartHead * heads = malloc(MIN(header->part_num, max_run) * sizeof(stPartHead) + 1);
+    struct iovec * iov = malloc(MIN(header->part_num, max_run) * 2 * sizeof(struct iovec) + 1);
+    int ret = (heads != NULL && iov != NULL) ? 0 : -1;
+
+    uint32_t begin = 0;
+    while (ret == 0 && begin < header->part_num)
+    {
+        stIndex * first = parts + begin;
+        if (first->file.file_type != pftm - pfs->type_mng_array || !_valid_index(pfs, first))
+        {
+            ret = -1;
+            break;
+        }
+
+        uint32_t run = 1;
+        while (begin + run < header->part_num && run < max_run
+                && parts[begin + run].file.file_type == first->file.file_type
+                && parts[begin + run].file.file_no   == first->file.file_no
+                && parts[begin + run].grid_idx       == first->grid_idx + run)
+            ++run;
+
+        uint32_t len = 0;
+        uint32_t i = 0;
+        for (; i < run; ++i)
+        {
+            uint64_t off  = (uint64_t) (begin + i) * payload;
+            uint32_t plen = MIN(payload, header->len - off);
+            iov[i*2].iov_base   = heads + i;
+            iov[i*2].iov_len    = sizeof(stGridHeader) + sizeof(heads[i].prefix); //不含结构体末尾的填充
+            iov[i*2+1].iov_base = value + off;
+            iov[i*2+1].iov_len  = plen;
+            len += iov[i*2].iov_len + plen;
+        }
+
+        stFileInfo * pfi    = _file_info(pfs, first);
+        uint64_t     offset = _index_offset(pfs, first);
+        if (pfi->map != NULL)
+        {
+            char * p = pfi->map + offset;
+            for (i = 0; i < run * 2; ++i)
+            {
+                memcpy(iov[i].iov_base, p, iov[i].iov_len);
+                p += iov[i].iov_len;
+            }
+        }
+        else
+        {
+            int fd = _file_fd(pfs, pfi);
+            if (fd < 0)
+            {
+                ret = -1;
+                break;
+            }
+
+            ssize_t r = preadv(fd, iov, run * 2, offset);
+            _file_put(pfs, pfi);
+            if (r != len)
+            {
+                ret = -1;
+                break;
+            }
+        }
+
+        for (i = 0; i < run; ++i)
+        {
+            stGridHeader * grid_header = &heads[i].grid_header;
+            if (grid_header->header.magic != GRID_MAGIC || !(grid_header->header.flags & GRID_FLAG_PART))
+                ret = -1;
+            else if (pfs->user_config.verify_checksum_when_get
+                    && crc32c(crc32c(0, heads[i].prefix, sizeof(heads[i].prefix)), iov[i*2+1].iov_base, iov[i*2+1].iov_len) != grid_header->header.crc)
+                ret = -1;
+        }
+
+        begin += run;
+    }
+
+    if (ret != 0)
+        printf("(%s:%s)\tfailed to read large value, part %u\n", __FILE__, __FUNCTION__, begin);
+
+    free(heads);
+    free(iov);
+    return ret;
+}
+
+static int64_t _rfs_lget(rfs * pfs, uint8_t type, void * key, char * value, uint32_t cap, uint32_t * vlen)
+{
+    stKeyCallback * cb = pfs->user_callbacks + type;
+
+    stIndex index;
+    if (hashtable_get(pfs->hash_table, key, &index, NULL, cb) != 0)
+        return -1;
+
+    stFileTypeMng * pftm = _type_mng(pfs, &index);
+    stFileInfo    * pfi  = _file_info(pfs, &index);
+
+    uint64_t offset = _grid_offset(pftm, index.grid_idx);
+
+    stScratch * scratch = _scratch(pfs);
+    if (scratch == NULL)
+        return -1;
+
+    char * p = scratch->grid;
+    ssize_t size = pftm->grid_size;
+    if (pfi->map != NULL)
+        p = pfi->map + offset;
+    else if ((size = _pread_grids(pfs, pfi, p, pftm->grid_size, offset)) <= 0)
+        return -1;
+
+    stGridData data;
+    if (_parse_grid(p, size, pfs->user_config.verify_checksum_when_get, &data) != 0 || data.type != type
+            || _grid_expired((stGridHeader *) p, 0))
+        return -1;
+
+    //普通的value
+    stGridHeader * grid_header = (stGridHeader *) p;
+    if (!_grid_large(grid_header))
+    {
+        *vlen = _grid_compressed(grid_header) ? grid_header->header.raw_len : data.vlen;
+        if (*vlen > cap)
+            return -1;
+
+        uint16_t len = 0;
+        CHK_RET(_get_value(pfs, p, size, type, value, &len));
+        return index_to_int64(&index);
+    }
+
+    stLargeHeader header;
+    stIndex * parts = _large_parse(data.value, data.vlen, &header);
+    if (parts == NULL || (uint64_t) header.part_num * _part_payload(pfs) < header.len)
+        return -1;
+
+    *vlen = header.len;
+    if (header.len > cap)
+        return -1;
 
-    stKeyCallback * cb = pfs->user_callbacks + type;
-    if (cb->serialize(key, kbuf, &klen) != 0)
+    CHK_RET(_large_read(pfs, &header, parts, value));
+    return index_to_int64(&index);
+}
+
+int64_t rfs_lget(rfs * pfs, uint8_t type, void * key, char * value, uint32_t cap, uint32_t * vlen)
+{
+    pthread_rwlock_rdlock(&pfs->lock);
+    int64_t ret = _rfs_lget(pfs, type, key, value, cap, vlen);
+    pthread_rwlock_unlock(&pfs->lock);
+
+    return ret;
+}
+
+//选出已用格子比例最低且低于compact_threshold的文件, 同类型其他文件的空闲格子要放得下它的格子
+static int _compact_pick(rfs * pfs, stFile * file)
+{
+    uint8_t threshold = pfs->user_config.compact_threshold;
+    if (threshold == 0)
         return -1;
 
-    //参考文件格式图
-    uint16_t real_len = sizeof(stGridHeader) + sizeof(uint8_t) + sizeof(uint16_t) + klen + sizeof(uint16_t) + vlen;
+    double best = 1.0;
+    int found = 0;
 
-    stIndex index;
-    int exist = hashtable_get(pfs->hash_table, key, &index, NULL, cb);
-    if (exist == -1)
+    uint16_t type = 0;
+    for (; type < pfs->sys_config.max_file_type_num; ++type)
     {
-        uint16_t * ftype = &index.file.file_type;
-        uint16_t * fno   = &index.file.file_no;
-        uint32_t * gidx  = &index.grid_idx;
+        stFileTypeMng * pftm = pfs->type_mng_array + type;
 
-        *ftype = 0;
-        *fno   = 0;
-        *gidx  = 0;
+        uint64_t idle = 0;
+        uint16_t no = 0;
+        for (; no <= pftm->max_opened_file_no; ++no)
+        {
+            stFileInfo * pfi = pftm->file_info_array + no;
+            if (_file_exists(pfi))
+                idle += pftm->grid_num - bm_count(pfi->grids_bitmap);
+        }
 
-        int ret = _get_idx(pfs, 0, psc->max_file_type_num-1, real_len, ftype, fno, gidx);
-        if (ret != 0)
+        for (no = 0; no <= pftm->max_opened_file_no; ++no)
         {
-            //TODO log error, alert
-            return -1;
+            stFileInfo * pfi = pftm->file_info_array + no;
+            if (!_file_exists(pfi) || pfi->no_compact)
+                continue;
+
+            uint32_t used_num = bm_count(pfi->grids_bitmap);
+            if ((uint64_t) used_num * 100 >= (uint64_t) pftm->grid_num * threshold)
+                continue;
+
+            if (idle - (pftm->grid_num - used_num) < used_num)
+                continue;
+
+            double ratio = (double) used_num / pftm->grid_num;
+            if (!found || ratio < best)
+            {
+                best = ratio;
+                file->file_type = type;
+                file->file_no   = no;
+                found = 1;
+            }
         }
+    }
 
-        stFileTypeMng * pftm = pfs->type_mng_array  + *ftype;
-        stFileInfo    * pfi = pftm->file_info_array + *fno;
-        FILE * fp = pfi->fp;
+    return found ? 0 : -1;
+}
 
-        uint32_t offset = sizeof(stFileHeader) + pftm->grid_size * (*gidx);
-        CHK_RET(_set_grid(pfs, fp, offset, now, real_len, type, kbuf, klen, value, vlen));
-        CHK_RET(dl_move_idx(pfi->grids_translist, *gidx, grpIdle, grpUsed));
-        CHK_RET(hashtable_set(pfs->hash_table, key, &index, cb));
+//把compact_file中的一个格子搬到同类型的其他文件, 按relocate记日志
+//返回0表示搬了一个格子, 1表示文件已经搬空, -1表示这个文件不能再搬
+static int _compact_grid(rfs * pfs)
+{
+    stIndex old_index;
+    old_index.file = pfs->compact_file;
+
+    stFileTypeMng * pftm = _type_mng(pfs, &old_index);
+    stFileInfo    * pfi  = _file_info(pfs, &old_index);
+
+    int64_t idx = bm_next_set(pfi->grids_bitmap, 0);
+    if (idx < 0)
+        return 1;
+    old_index.grid_idx = idx;
+
+    char * grid = pfs->private_data;
+    uint64_t offset = _grid_offset(pftm, idx);
+    if (pfi->map != NULL)
+        memcpy(grid, pfi->map + offset, pftm->grid_size);
+    else if (_pread_grids(pfs, pfi, grid, pftm->grid_size, offset) != pftm->grid_size)
+        return -1;
 
-        return index_to_int64(&index);
+    //大value的段只记在key所在的格子中, 找不到是谁的段, 这个文件不搬
+    stGridData data;
+    if (*(uint8_t *) (grid + sizeof(stGridHeader)) == 0)
+    {
+        pfi->no_compact = 1;
+        return -1;
     }
-    else
+
+    char key[MAX_KEY_LEN+1];
+    stIndex loaded;
+    if (_parse_grid(grid, pftm->grid_size, 1, &data) != 0 || data.type >= pfs->type_count
+            || pfs->user_callbacks[data.type].deserialize(key, data.key, data.klen) != 0
+            || hashtable_get(pfs->hash_table, key, &loaded, NULL, pfs->user_callbacks + data.type) != 0
+            || _cmp_index(&loaded, &old_index) != 0)
+    {
+        printf("(%s:%s)\tgrid %u of file %s does not match the index, file is not compacted\n",
+                __FILE__, __FUNCTION__, old_index.grid_idx, pfi->path);
+        pfi->no_compact = 1;
+        return -1;
+    }
+
+    stKeyCallback * cb = pfs->user_callbacks + data.type;
+
+    //只搬到已打开的文件中, 不能因为整理再创建文件; compact_file不在free_files中
+    int64_t target_no = bm_next_set(pftm->free_files, 0);
+    if (target_no < 0)
+        return -1;
+
+    stIndex new_index;
+    new_index.file.file_type = old_index.file.file_type;
+    new_index.file.file_no   = target_no;
+    new_index.grid_idx       = bm_next_zero(pftm->file_info_array[target_no].grids_bitmap, 0);
+    CHK_RET(_mark_used(pfs, &new_index));
+
+    //旧版本的格子头没有初始化, 重新初始化, 不带校验和
+    stGridHeader * grid_header = (stGridHeader *) grid;
+    if (grid_header->header.magic != GRID_MAGIC)
+        _init_grid_header(grid_header, grid_header->header.write_time, 0);
+
+    uint32_t len = data.value + data.vlen - grid;
+    struct iovec iov = { grid, len };
+
+    uint64_t lsn = _wal_log(pfs, WAL_OP_SET, &new_index, &old_index, &iov, 1, len);
+    grid_header->header.lsn = lsn;
+
+    if (lsn == 0 || _wal_sync(pfs, lsn) != 0)
+    {
+        _mark_idle(pfs, &new_index);
+        return -1;
+    }
+
+    //按rfs_set挪动数据撤销, 旧格子还在原处
+    if (_write(pfs, _file_info(pfs, &new_index), _index_offset(pfs, &new_index), &iov, 1, len) != 0
+            || hashtable_set(pfs->hash_table, key, &new_index, cb) != 0)
+    {
+        stSetPlan plan = { new_index, old_index, 1, 1 };
+        _undo_set(pfs, data.type, key, data.key, data.klen, &plan, lsn);
+        return -1;
+    }
+
+    //大value的各段跟着key所在的格子走
+    stLargeObj * obj = _large_find(pfs, &old_index);
+    if (obj != NULL)
     {
-        uint16_t * ftype = &index.file.file_type;
-        uint16_t * fno   = &index.file.file_no;
-        uint32_t * gidx  = &index.grid_idx;
+        stIndex * parts    = obj->parts;
+        uint32_t  part_num = obj->part_num;
+        obj->parts = NULL;
+        _large_remove(pfs, &old_index);
+        _large_put(pfs, &new_index, parts, part_num);
+    }
+    _add_timer(pfs, &new_index, _grid_expire(grid_header));
 
-        stFileTypeMng * pftm = pfs->type_mng_array + *ftype;
-        stFileInfo    * pfi  = pftm->file_info_array + *fno;
-        FILE * fp = pfi->fp;
-        uint32_t offset = sizeof(stFileHeader) + pftm->grid_size * (*gidx);
+    _del_grid(pfs, &old_index, lsn);
+    _mark_idle(pfs, &old_index);
 
-        if ((real_len <= pftm->grid_size) && (puc->size_down_if_possible == 0))
+    return 0;
+}
+
+//删除搬空的文件, 再清空日志, 日志中写这个文件的记录不再需要
+static int _compact_release(rfs * pfs)
+{
+    stIndex index;
+    index.file     = pfs->compact_file;
+    index.grid_idx = 0;
+
+    stFileTypeMng * pftm = _type_mng(pfs, &index);
+    stFileInfo    * pfi  = _file_info(pfs, &index);
+
+    pfs->compacting = 0;
+
+    char path[sizeof(pfi->path)];
+    strcpy(path, pfi->path);
+    if (_remove_file(pfs, pftm, pfi) == 0)
+        printf("(%s:%s)\tfile %s is compacted and removed\n", __FILE__, __FUNCTION__, path);
+
+    if (pfs->wal != NULL)
+        return _wal_checkpoint(pfs);
+
+    return 0;
+}
+
+static int _rfs_compact(rfs * pfs, uint32_t budget)
+{
+    //未完成的rfs_set_async和等日志落盘的写操作可能要写要搬的格子, 日志也不能清空
+    //未完成的rfs_get_async可能正在读要搬的格子, 搬空后删除文件时还会关掉它们在用的描述符
+    if (pfs->async_writes != NULL || pfs->pendings != NULL || (pfs->aio != NULL && aio_inflight(pfs->aio) > 0))
+        return 0;
+
+    uint32_t moved = 0;
+    while (moved < budget)
+    {
+        if (!pfs->compacting)
         {
-            _set_grid(pfs, fp, offset, now, real_len, type, kbuf, klen, value, vlen);
-            return index_to_int64(&index);
+            if (_compact_pick(pfs, &pfs->compact_file) != 0)
+                break;
+            pfs->compacting = 1;
+            _update_file_bits(pfs, pfs->compact_file.file_type, pfs->compact_file.file_no);
         }
 
-        uint16_t begin_type;
-        uint16_t end_type;
-        if (real_len > pftm->grid_size)
+        int ret = _compact_grid(pfs);
+        if (ret == 1)
         {
-            begin_type = *ftype + 1;
-            end_type   = psc->max_file_type_num - 1;
+            //还有rfs_view指向这个文件的映射, 等释放后再删除
+            stIndex index = { pfs->compact_file, 0 };
+            if (_file_info(pfs, &index)->pins > 0 || _compact_release(pfs) != 0)
+                break;
+            continue;
+        }
 
-            if (begin_type >= psc->max_file_type_num)
-            {
-                //TODO lor error, alert
-                return 0;
-            }
+        if (ret != 0)
+        {
+            pfs->compacting = 0;
+            _update_file_bits(pfs, pfs->compact_file.file_type, pfs->compact_file.file_no);
+            break;
         }
-        else if ((real_len < pftm->grid_size) && (puc->size_down_if_possible))
+
+        ++moved;
+    }
+
+    _wal_maybe_checkpoint(pfs);
+    return moved;
+}
+
+int rfs_compact(rfs * pfs, uint32_t budget)
+{
+    pthread_rwlock_wrlock(&pfs->lock);
+    int ret = _rfs_compact(pfs, budget);
+    pthread_rwlock_unlock(&pfs->lock);
+
+    return ret;
+}
+
+#define EXPIRE_BATCH (64) //rfs_expire每次从时间轮中取出的项数
+
+//到期的格子仍是某个key的当前数据且过期时间没有被重新设置过时, 按rfs_del删除这个key
+static int _expire_grid(rfs * pfs, stTimer * timer, uint32_t now)
+{
+    stIndex index;
+    int64_to_index(timer->data, &index);
+    if (!_valid_index(pfs, &index) || !bm_test(_file_info(pfs, &index)->grids_bitmap, index.grid_idx))
+        return -1;
+
+    stFileTypeMng * pftm = _type_mng(pfs, &index);
+    stFileInfo    * pfi  = _file_info(pfs, &index);
+    uint64_t offset = _grid_offset(pftm, index.grid_idx);
+
+    char * grid = pfs->private_data;
+    if (pfi->map != NULL)
+        grid = pfi->map + offset;
+    else if (_pread_grids(pfs, pfi, grid, pftm->grid_size, offset) != pftm->grid_size)
+        return -1;
+
+    stGridData data;
+    if (!_grid_expired((stGridHeader *) grid, now) || _parse_grid(grid, pftm->grid_size, 1, &data) != 0
+            || data.type >= pfs->type_count)
+        return -1;
+
+    stKeyCallback * cb = pfs->user_callbacks + data.type;
+
+    char key[MAX_KEY_LEN+1];
+    if (cb->deserialize(key, data.key, data.klen) != 0)
+        return -1;
+
+    stIndex loaded;
+    if (hashtable_get(pfs->hash_table, key, &loaded, NULL, cb) != 0 || _cmp_index(&loaded, &index) != 0)
+        return -1;
+
+    //写操作完成之前不能删除, 写失败时格子里还是过期的数据, 稍后再检查
+    if (_key_busy(pfs, data.type, data.key, data.klen))
+    {
+        tw_add(pfs->timers, ((now == 0) ? time(0) : now) + 1, timer->data);
+        return -1;
+    }
+
+    CHK_RET(_rfs_del(pfs, data.type, key, NULL, 0));
+    ++pfs->stat.expirations;
+
+    return 0;
+}
+
+static int _rfs_expire(rfs * pfs, uint32_t now, uint32_t budget)
+{
+    //不能删除读接口还认为没有过期的key
+    uint32_t wall = time(0);
+    if (now == 0 || now > wall)
+        now = wall;
+
+    int deleted = 0;
+    stTimer timers[EXPIRE_BATCH];
+    while (budget > 0)
+    {
+        uint32_t n = tw_expire(pfs->timers, now, timers, MIN(budget, EXPIRE_BATCH));
+        if (n == 0)
+            break;
+        budget -= n;
+
+        uint32_t i = 0;
+        for (; i < n; ++i)
         {
-            begin_type = 0;
-            end_type   = *ftype; // = *ftype - 1;
+            if (_expire_grid(pfs, timers + i, now) == 0)
+                ++deleted;
         }
+    }
 
-        stIndex new_index;
-        uint16_t * new_ftype = &new_index.file.file_type;
-        uint16_t * new_fno   = &new_index.file.file_no;
-        uint32_t * new_gidx  = &new_index.grid_idx;
+    return deleted;
+}
 
-        int ret = _get_idx(pfs, begin_type, end_type, real_len, new_ftype, new_fno, new_gidx);
-        if (ret != 0)
+int rfs_expire(rfs * pfs, uint32_t now, uint32_t budget)
+{
+    pthread_rwlock_wrlock(&pfs->lock);
+    int ret = _rfs_expire(pfs, now, budget);
+    pthread_rwlock_unlock(&pfs->lock);
+
+    return ret;
+}
+
+int rfs_get_stat(rfs * pfs, stRfsStat * stat)
+{
+    pthread_rwlock_rdlock(&pfs->lock);
+    pthread_mutex_lock(&pfs->cache_lock);
+    *stat = pfs->stat;
+    pthread_mutex_unlock(&pfs->cache_lock);
+    if (pfs->wal != NULL)
+        stat->wal_syncs = wal_syncs(pfs->wal);
+    pthread_rwlock_unlock(&pfs->lock);
+    return 0;
+}
+
+struct _stRfsScan {
+    rfs *     pfs;
+    stFile    file;     //正在扫描或下一个要扫描的文件
+    int       opened;   //sc已打开
+    uint32_t  gen;      //打开sc时文件的gen, 之后不一样说明文件被删掉了(可能又新建了同编号的文件)
+    stScanner sc;
+};
+
+rfs_scan * rfs_scan_open(rfs * pfs)
+{
+    rfs_scan * scan = calloc(1, sizeof(rfs_scan));
+    if (scan == NULL)
+        return NULL;
+
+    scan->pfs = pfs;
+    return scan;
+}
+
+static void _scan_close_file(rfs_scan * scan)
+{
+    if (scan->opened)
+        _scanner_close(&scan->sc);
+
+    scan->opened = 0;
+    ++scan->file.file_no;
+}
+
+//从scan->file开始找到下一个存在的文件并打开, 返回0表示打开了, 1表示没有文件了
+static int _scan_open_file(rfs_scan * scan)
+{
+    rfs * pfs = scan->pfs;
+
+    for (; scan->file.file_type < pfs->sys_config.max_file_type_num; ++scan->file.file_type, scan->file.file_no = 0)
+    {
+        stFileTypeMng * pftm = pfs->type_mng_array + scan->file.file_type;
+
+        for (; scan->file.file_no <= pftm->max_opened_file_no; ++scan->file.file_no)
         {
-            //TODO log error, alert
-            return -1;
+            stFileInfo * pfi = pftm->file_info_array + scan->file.file_no;
+            if (!_file_exists(pfi))
+                continue;
+
+            CHK_RET(_scanner_open(pfs, &scan->sc, scan->file, 1));
+            scan->opened = 1;
+            scan->gen    = pfi->gen;
+            return 0;
         }
+    }
+
+    return 1;
+}
+
+//sc读到的格子仍然是key的当前位置时取出它; 返回0表示取到, -1表示跳过
+static int _scan_record(rfs * pfs, stScanner * sc, stFile file, uint32_t grid_idx, char * grid, uint8_t * type, void * key, char * value, uint16_t * vlen, uint32_t * write_time)
+{
+    stIndex index;
+    index.file     = file;
+    index.grid_idx = grid_idx;
 
-        //如果file_type和file_no都一样的话,说明是原来的文件,将数据写到原来的grid_idx.
-        if ((*new_ftype == *ftype) && (*new_fno == *fno))
+    stFileTypeMng * pftm = sc->pftm;
+    stGridHeader  * grid_header = (stGridHeader *) grid;
+
+    stGridData data;
+    if (!bm_test(sc->pfi->grids_bitmap, grid_idx)
+            || _parse_grid(grid, pftm->grid_size, pfs->user_config.verify_checksum_when_get, &data) != 0
+            || data.type == 0 || data.type >= pfs->type_count || data.klen == 0
+            || _grid_large(grid_header) || _grid_expired(grid_header, 0))
+        return -1;
+
+    stKeyCallback * cb = pfs->user_callbacks + data.type;
+    if (cb->deserialize(key, data.key, data.klen) != 0)
+        return -1;
+
+    //格子可能是已经挪走或删掉的旧数据
+    stIndex loaded;
+    if (hashtable_get(pfs->hash_table, key, &loaded, NULL, cb) != 0 || _cmp_index(&loaded, &index) != 0)
+        return -1;
+
+    if (_grid_compressed(grid_header))
+        CHK_RET(_decompress_value(grid, &data, value, vlen));
+    else
+    {
+        memcpy(value, data.value, data.vlen);
+        *vlen = data.vlen;
+    }
+
+    *type       = data.type;
+    *write_time = grid_header->header.write_time;
+    return 0;
+}
+
+static int _rfs_scan_next(rfs_scan * scan, uint8_t * type, void * key, char * value, uint16_t * vlen, uint32_t * write_time)
+{
+    rfs * pfs = scan->pfs;
+
+    while (1)
+    {
+        if (!scan->opened)
         {
-            _set_grid(pfs, fp, offset, now, real_len, type, kbuf, klen, value, vlen);
-            return index_to_int64(&index);
+            int r = _scan_open_file(scan);
+            if (r != 0)
+                return (r == 1) ? 0 : -1;
         }
 
-        //否则,写到新的文件
-        stFileTypeMng * new_pftm = pfs->type_mng_array  + *new_ftype;
-        stFileInfo    * new_pfi  = new_pftm->file_info_array + *new_fno;
-        FILE * new_fp = new_pfi->fp;
+        //两次调用之间写接口可能扩展了file_info_array或删掉了这个文件
+        stFileInfo * pfi = _file_at(pfs, scan->file);
+        if (!_file_exists(pfi) || pfi->gen != scan->gen)
+        {
+            _scan_close_file(scan);
+            continue;
+        }
+        scan->sc.pfi = pfi;
 
-        uint32_t new_offset = sizeof(stFileHeader) + new_pftm->grid_size * (*new_gidx);
-        CHK_RET(_set_grid(pfs, new_fp, new_offset, now, real_len, type, kbuf, klen, value, vlen));
-        CHK_RET(_del_grid(pfs, fp, offset));
-        CHK_RET(dl_move_idx(pfi->grids_translist, *gidx, grpUsed, grpIdle));
-        CHK_RET(dl_move_idx(new_pfi->grids_translist, *new_gidx, grpIdle, grpUsed));
-        CHK_RET(hashtable_set(pfs->hash_table, key, &new_index, cb));
+        uint32_t idx = 0;
+        char   * p   = NULL;
+        while ((p = _scanner_next(&scan->sc, &idx)) != NULL)
+        {
+            if (_scan_record(pfs, &scan->sc, scan->file, idx, p, type, key, value, vlen, write_time) == 0)
+                return 1;
+        }
 
-        return index_to_int64(&new_index);
+        int err = scan->sc.err;
+        _scan_close_file(scan);
+        if (err)
+            return -1;
     }
+}
 
-    return -1;
+int rfs_scan_next(rfs_scan * scan, uint8_t * type, void * key, char * value, uint16_t * vlen, uint32_t * write_time)
+{
+    pthread_rwlock_rdlock(&scan->pfs->lock);
+    int ret = _rfs_scan_next(scan, type, key, value, vlen, write_time);
+    pthread_rwlock_unlock(&scan->pfs->lock);
+
+    return ret;
 }
 
-int64_t rfs_get(rfs * pfs, uint8_t type, void * key, char * value, uint16_t * vlen, char * info, uint16_t ilen)
+void rfs_scan_close(rfs_scan * scan)
 {
-    stKeyCallback * cb = pfs->user_callbacks + type;
+    if (scan->opened)
+        _scanner_close(&scan->sc);
 
-    stIndex index;
-    int exist = hashtable_get(pfs->hash_table, key, &index, NULL, cb);
-    if (exist == -1)
-        return -1;
+    free(scan);
+}
 
-    uint16_t file_type = index.file.file_type;
-    uint16_t file_no   = index.file.file_no;
-    uint32_t grid_idx  = index.grid_idx;
+//rfs_for_each_parallel的各线程按顺序领取files中的文件
+typedef struct {
+    rfs *              pfs;
+    stFile *           files;
+    uint32_t           file_num;
+    uint32_t           next;
+    rfs_record_visitor visitor;
+    void *             arg;
+    int                stop;   //visitor返回非0或读文件失败
+    uint64_t           count;  //调用visitor的次数
+} stParallelScan;
 
-    stFileTypeMng * pftm = pfs->type_mng_array   + file_type;
-    stFileInfo    * pfi  = pftm->file_info_array + file_no;
-    FILE          * fp   = pfi->fp;
+typedef struct {
+    stParallelScan * ps;
+    uint32_t         worker;
+} stParallelWorker;
 
-    uint32_t offset = sizeof(stFileHeader) + pftm->grid_size * grid_idx + sizeof(stGridHeader) + sizeof(uint8_t);
-    fseek(fp, offset, SEEK_SET);
+static void * _parallel_worker(void * arg)
+{
+    stParallelWorker * w  = (stParallelWorker *) arg;
+    stParallelScan   * ps = w->ps;
+    rfs              * pfs = ps->pfs;
+
+    //每个线程自己的缓冲区, visitor可以在其中做耗时的计算
+    char   key[MAX_KEY_LEN+1];
+    char * value = malloc(UINT16_MAX);
+    if (value == NULL)
+    {
+        ps->stop = 1;
+        return NULL;
+    }
 
-    char * p = pfs->private_data;
-    fread(p, 1, pftm->grid_size - sizeof(stGridHeader), fp);
+    uint64_t count = 0;
+    while (!ps->stop)
+    {
+        uint32_t i = __sync_fetch_and_add(&ps->next, 1);
+        if (i >= ps->file_num)
+            break;
 
-    uint16_t klen = *(uint16_t *) p;
-    *vlen = *(uint16_t *) (p + sizeof(uint16_t) + klen);
-    strncpy(value, p + sizeof(uint16_t) + klen + sizeof(uint16_t), *vlen);
+        stScanner sc;
+        if (_scanner_open(pfs, &sc, ps->files[i], 1) != 0)
+        {
+            ps->stop = 1;
+            break;
+        }
 
-    return index_to_int64(&index);
+        uint32_t idx = 0;
+        char   * p   = NULL;
+        while (!ps->stop && (p = _scanner_next(&sc, &idx)) != NULL)
+        {
+            uint8_t  type = 0;
+            uint16_t vlen = 0;
+            uint32_t write_time = 0;
+            if (_scan_record(pfs, &sc, ps->files[i], idx, p, &type, key, value, &vlen, &write_time) != 0)
+                continue;
+
+            ++count;
+            if (ps->visitor(w->worker, type, key, value, vlen, write_time, ps->arg) != 0)
+                ps->stop = 1;
+        }
+
+        if (sc.err)
+            ps->stop = 1;
+        _scanner_close(&sc);
+    }
+
+    __sync_fetch_and_add(&ps->count, count);
+    free(value);
+    return NULL;
 }
 
-int rfs_del(rfs * pfs, uint8_t type, void * key, char * info, uint16_t ilen)
+static int64_t _rfs_for_each_parallel(rfs * pfs, uint32_t thread_num, rfs_record_visitor visitor, void * arg)
 {
-    stKeyCallback * cb = pfs->user_callbacks + type;
+    stParallelScan ps;
+    memset(&ps, 0, sizeof(ps));
+    ps.pfs     = pfs;
+    ps.visitor = visitor;
+    ps.arg     = arg;
 
-    stIndex index;
-    int exist = hashtable_get(pfs->hash_table, key, &index, NULL, cb);
-    if (exist == -1)
+    uint32_t max_num = 0;
+    uint16_t type = 0;
+    for (; type < pfs->sys_config.max_file_type_num; ++type)
+        max_num += pfs->type_mng_array[type].max_opened_file_no + 1;
+
+    ps.files = malloc(max_num * sizeof(stFile));
+    if (ps.files == NULL)
         return -1;
 
-    uint16_t file_type = index.file.file_type;
-    uint16_t file_no   = index.file.file_no;
-    uint32_t grid_idx  = index.grid_idx;
+    for (type = 0; type < pfs->sys_config.max_file_type_num; ++type)
+    {
+        stFileTypeMng * pftm = pfs->type_mng_array + type;
+
+        uint16_t no = 0;
+        for (; no <= pftm->max_opened_file_no; ++no)
+        {
+            if (!_file_exists(pftm->file_info_array + no))
+                continue;
+
+            ps.files[ps.file_num].file_type = type;
+            ps.files[ps.file_num].file_no   = no;
+            ++ps.file_num;
+        }
+    }
+
+    thread_num = MIN(thread_num, ps.file_num);
+    pthread_t        * threads = calloc(thread_num + 1, sizeof(pthread_t));
+    stParallelWorker * workers = calloc(thread_num + 1, sizeof(stParallelWorker));
+
+    uint32_t started = 0;
+    for (; threads != NULL && workers != NULL && started < thread_num; ++started)
+    {
+        workers[started].ps     = &ps;
+        workers[started].worker = started;
+        if (pthread_create(threads + started, NULL, _parallel_worker, workers + started) != 0)
+            break;
+    }
+
+    //没有线程时在当前线程中遍历
+    if (started == 0)
+    {
+        stParallelWorker w = { &ps, 0 };
+        _parallel_worker(&w);
+    }
+
+    uint32_t i = 0;
+    for (; i < started; ++i)
+        pthread_join(threads[i], NULL);
 
-    stFileTypeMng * pftm = pfs->type_mng_array   + file_type;
-    stFileInfo    * pfi  = pftm->file_info_array + file_no;
-    FILE          * fp   = pfi->fp;
+    free(threads);
+    free(workers);
+    free(ps.files);
 
-    uint32_t offset = sizeof(stFileHeader) + pftm->grid_size * grid_idx;
-    _del_grid(pfs, fp, offset);
+    return ps.stop ? -1 : (int64_t) ps.count;
+}
 
-    dl_move_idx(pfi->grids_translist, grid_idx, grpUsed, grpIdle);
+int64_t rfs_for_each_parallel(rfs * pfs, uint32_t thread_num, rfs_record_visitor visitor, void * arg)
+{
+    pthread_rwlock_rdlock(&pfs->lock);
+    int64_t ret = _rfs_for_each_parallel(pfs, thread_num, visitor, arg);
+    pthread_rwlock_unlock(&pfs->lock);
 
-    return hashtable_del(pfs->hash_table, key, cb);
+    return ret;
 }
 
-int rfs_print_data(rfs * pfs)
+static int _rfs_print_data(rfs * pfs)
 {
     char * p = pfs->private_data;
     uint8_t type  = 0;
@@ -719,7 +5810,8 @@ int rfs_print_data(rfs * pfs)
 
         char value[1024 * 4];
         uint16_t vlen = 0;
-        int64_t i = rfs_get(pfs, type, p, value, &vlen, NULL, 0);
+        int64_t expired = -1;
+        int64_t i = _rfs_get(pfs, type, p, value, &vlen, NULL, 0, &expired);
         value[vlen] = '\0';
 
         if (i == -1)
@@ -737,7 +5829,25 @@ int rfs_print_data(rfs * pfs)
     return 0;
 }
 
-int rfs_print_hashtable(rfs * pfs)
+int rfs_print_data(rfs * pfs)
+{
+    pthread_rwlock_wrlock(&pfs->lock);
+    int ret = _rfs_print_data(pfs);
+    pthread_rwlock_unlock(&pfs->lock);
+
+    return ret;
+}
+
+static int _rfs_print_hashtable(rfs * pfs)
 {
     return hashtable_print(pfs->hash_table, pfs->user_callbacks);
 }
+
+int rfs_print_hashtable(rfs * pfs)
+{
+    pthread_rwlock_wrlock(&pfs->lock);
+    int ret = _rfs_print_hashtable(pfs);
+    pthread_rwlock_unlock(&pfs->lock);
+
+    return ret;
+}
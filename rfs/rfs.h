@@ -8,6 +8,10 @@
 struct _rfs;
 typedef struct _rfs rfs;
 
+//多个线程可以同时使用一个rfs: rfs_get/rfs_get_view/rfs_visit/rfs_mget/rfs_lget/rfs_prefetch/rfs_scan_next/rfs_for_each_parallel之间并发执行, 其他接口互斥执行
+//写操作等日志落盘时不占着rfs: 其他接口照常执行, 其他写操作的日志一起落盘; 同一个key的写操作等前一个完成, 之前读到的是旧数据
+//rfs_create/rfs_destroy不能和其他接口同时调用; rfs_poll中的回调和rfs_visit的visitor中不能再调用rfs的接口
+//工作目录不存在, 按遗留的日志补写失败等时返回NULL, 日志留着不动
 rfs * rfs_create(stSysConfig sys_config, stUserConfig user_config, uint8_t type_count, stKeyCallback* user_callbacks);
 int rfs_destroy(rfs * pfs);
 
@@ -19,8 +23,126 @@ int64_t rfs_get(rfs * pfs, uint8_t type, void * key, char * value, uint16_t * vl
 //返回-1表示失败
 int64_t rfs_set(rfs * pfs, uint32_t now, uint8_t type, void * key, char * value, uint16_t vlen, char * info, uint16_t ilen);
 
+//同rfs_set, 过期时间为当前时间(time(0)) + ttl秒, ttl为0表示不过期; now只作为写入时间, 不影响过期时间
+//读接口都按当前时间判断是否过期: 过期的key在rfs_get时删除, 其他读接口视为不存在; 没有被读到的由rfs_expire删除
+int64_t rfs_set_ex(rfs * pfs, uint32_t now, uint32_t ttl, uint8_t type, void * key, char * value, uint16_t vlen);
+
 int rfs_del(rfs * pfs, uint8_t type, void * key, char * info, uint16_t ilen);
 
+//不复制value的读取: IO_ENGINE_MMAP且value未压缩时view->value直接指向文件映射, 否则指向view自己的缓冲区
+//rfs_release_view之前view->value一直有效, 期间rfs_compact不删除它所在的文件; 但同一个key的set/del会改写映射中的内容
+//不经过value_cache, 过期的key视为不存在; 返回编码同rfs_get
+typedef struct {
+    const char * value;
+    uint16_t     vlen;
+    char       * buf;     //内部使用: view自己的缓冲区
+    int64_t      pinned;  //内部使用: 指向映射时为格子的位置, 否则为-1
+} rfs_view;
+
+int64_t rfs_get_view(rfs * pfs, uint8_t type, void * key, rfs_view * view);
+int rfs_release_view(rfs * pfs, rfs_view * view);
+
+//在读到的格子上直接调用visitor, value只在visitor中有效, visitor中不能调用rfs的接口
+//visitor返回非0时rfs_visit返回-1, 否则返回编码同rfs_get
+typedef int (* rfs_visitor)(const char * value, uint16_t vlen, void * arg);
+
+int64_t rfs_visit(rfs * pfs, uint8_t type, void * key, rfs_visitor visitor, void * arg);
+
+//批量接口: 先查出所有key的位置, 按(file_type, file_no, grid_idx)排序后合并相邻格子的读写
+//rets[i]为keys[i]的结果, 编码同rfs_get/rfs_set/rfs_del, -1表示该key失败
+//返回成功的key个数, -1表示失败; rfs_mset中同一个key出现多次时只写最后一次的value, 各次的结果相同
+int rfs_mget(rfs * pfs, uint8_t type, void ** keys, char ** values, uint16_t * vlens, uint32_t n, int64_t * rets);
+int rfs_mset(rfs * pfs, uint32_t now, uint8_t type, void ** keys, char ** values, uint16_t * vlens, uint32_t n, int64_t * rets);
+int rfs_mdel(rfs * pfs, uint8_t type, void ** keys, uint32_t n, int * rets);
+
+//预读: 查出各key所在的格子, 让它们提前进入page cache(映射的文件用madvise), 不等读完就返回
+//之后的rfs_get等读接口不用再等磁盘; IO_ENGINE_DIRECT时读不经过page cache, 不预读; 大value只预读key所在的格子
+//返回找到的key个数, -1表示失败
+int rfs_prefetch(rfs * pfs, uint8_t type, void ** keys, uint32_t n);
+
+//异步接口的结果, 在rfs_poll中通过回调返回
+typedef struct {
+    int64_t  ret;    //编码同rfs_get/rfs_set, -1表示失败
+    uint8_t  type;
+    void *   key;    //提交时传入的key
+    uint16_t klen;   //以下字段只对rfs_get_async有效, 指向rfs内部的缓冲区, 只在回调中有效
+    char *   kbuf;   //文件中序列化后的key
+    uint16_t vlen;
+    char *   value;
+} stAsyncResult;
+
+typedef void (* rfs_async_callback)(stAsyncResult * result, void * arg);
+
+//提交异步读写, 返回0表示已提交, -1表示失败(key不存在, 未完成的请求已达async_depth等)
+//key和value在回调之前必须保持有效; 一个key的rfs_set_async完成之前, 它的rfs_set/rfs_del/rfs_mset/rfs_mdel/rfs_set_async等写操作返回失败,
+//rfs_expire和evict_when_full也跳过它
+int rfs_get_async(rfs * pfs, uint8_t type, void * key, rfs_async_callback callback, void * arg);
+int rfs_set_async(rfs * pfs, uint32_t now, uint8_t type, void * key, char * value, uint16_t vlen, rfs_async_callback callback, void * arg);
+
+//至少等到min_complete个异步请求完成并执行它们的回调, 返回完成的请求数
+int rfs_poll(rfs * pfs, uint32_t min_complete);
+
+//把已完成的写操作落盘: 写日志时只需日志落盘(重启时按日志补写), 否则对所有数据文件fdatasync/msync
+int rfs_sync(rfs * pfs);
+
+//大value: 放不进一个格子的value拆成多段, 每段占最大文件类型的一个格子, key所在的格子记下各段的位置
+//rfs_get/rfs_mget/rfs_get_async读到大value时返回-1; 覆盖或删除时各段一起放回
+//返回编码同rfs_set/rfs_get, -1表示失败
+int64_t rfs_lset(rfs * pfs, uint32_t now, uint8_t type, void * key, const char * value, uint32_t vlen);
+
+//value的空间为cap字节, vlen返回value的长度, 长度超过cap时返回-1; 普通的value也可以用rfs_lget读
+int64_t rfs_lget(rfs * pfs, uint8_t type, void * key, char * value, uint32_t cap, uint32_t * vlen);
+
+//流式写入大value: rfs_lset_begin之后多次rfs_lset_write, 最后rfs_lset_commit
+//每写满一段就写入格子, key所在的格子在commit时才写入; 失败或放弃时调用rfs_lset_abort
+//key在commit之前必须保持有效, commit和abort之后writer不能再用
+struct _stLargeWriter;
+typedef struct _stLargeWriter rfs_lwriter;
+
+rfs_lwriter * rfs_lset_begin(rfs * pfs, uint8_t type, void * key);
+int rfs_lset_write(rfs_lwriter * w, const char * data, uint32_t len);
+int64_t rfs_lset_commit(rfs_lwriter * w, uint32_t now);
+void rfs_lset_abort(rfs_lwriter * w);
+
+//整理数据文件: 把已用格子低于compact_threshold的文件中的格子搬到同类型的其他文件, 搬空后删除文件
+//每次最多搬budget个格子, 可以在空闲时反复调用, 不影响其他请求的延迟; 返回搬的格子数
+//有大value的段的文件不搬, 只在删除格子时释放磁盘空间(punch_hole_size); 有未完成的异步读写时不搬, 返回0
+int rfs_compact(rfs * pfs, uint32_t budget);
+
+//删除到now为止过期的key, now为0或晚于当前时间时取当前时间, 最多处理budget个到期项, 返回删除的key数
+//可以在空闲时或定时反复调用, 代替扫描全部key
+int rfs_expire(rfs * pfs, uint32_t now, uint32_t budget);
+
+typedef struct {
+    uint64_t evictions;   //hash_table满时按evict_when_full淘汰的key数
+    uint64_t expirations; //过期后由rfs_get或rfs_expire删除的key数
+    uint64_t cache_hits;  //rfs_get命中value_cache的次数
+    uint64_t cache_misses;
+    uint64_t wal_syncs;   //日志的fdatasync次数, 同时进行的写操作共用一次; 不写日志时为0
+} stRfsStat;
+
+int rfs_get_stat(rfs * pfs, stRfsStat * stat);
+
+//按数据文件在磁盘上的顺序遍历所有key: 每次顺序读一大块(通过aio预读下一块), 跳过格子位图中空闲的格子, 不经过value_cache
+//每次rfs_scan_next时加读锁, 两次调用之间可以调用其他接口, 期间改写, 删除或搬动的key可能读到旧值, 漏掉或重复
+//大value和过期的key跳过; rfs_destroy之前要rfs_scan_close
+struct _stRfsScan;
+typedef struct _stRfsScan rfs_scan;
+
+rfs_scan * rfs_scan_open(rfs * pfs);
+
+//key为反序列化后的key, 空间至少MAX_KEY_LEN+1字节; value的空间同rfs_get
+//返回1表示取到一个key, 0表示扫描完, -1表示读文件失败(之后可以继续扫描下一个文件)
+int rfs_scan_next(rfs_scan * scan, uint8_t * type, void * key, char * value, uint16_t * vlen, uint32_t * write_time);
+void rfs_scan_close(rfs_scan * scan);
+
+//多线程遍历所有key: 按数据文件划分, thread_num个线程各自领取文件, 用自己的缓冲区顺序扫描(同rfs_scan), 0表示在当前线程中遍历
+//整个过程持有读锁, 写接口等到遍历完; visitor在各线程中并发调用, worker为线程的序号, key和value只在visitor中有效
+//visitor中不能调用rfs的接口, 返回非0时停止遍历; 返回调用visitor的次数, -1表示visitor要求停止或读文件失败
+typedef int (* rfs_record_visitor)(uint32_t worker, uint8_t type, const void * key, const char * value, uint16_t vlen, uint32_t write_time, void * arg);
+
+int64_t rfs_for_each_parallel(rfs * pfs, uint32_t thread_num, rfs_record_visitor visitor, void * arg);
+
 int rfs_print_data(rfs * pfs);
 int rfs_print_hashtable(rfs * pfs);
 
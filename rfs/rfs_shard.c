@@ -0,0 +1,368 @@
+#include "rfs_shard.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#define SHARD_DIR_FORMAT "%s/shard_%u"  //每个shard的工作目录
+#define SHARD_CPU_WORDS  (16)           //绑定CPU时的位图, 最多1024个CPU
+
+typedef struct {
+    rfs_shard     * owner;
+    uint32_t        idx;
+    rfs           * pfs;
+    pthread_t       thread;
+    int             started;    //线程已创建
+
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;       //队列不为空或要停止
+    pthread_cond_t  done_cond;  //rfs创建完成或有同步请求执行完
+    rfs_shard_req * head;
+    rfs_shard_req * tail;
+    int             stop;
+    int             state;      //0: 正在创建rfs, 1: 已创建, -1: 创建失败
+} stShard;
+
+struct _stRfsShard {
+    stSysConfig     sys_config;
+    stUserConfig    user_config;
+    uint8_t         type_count;
+    stKeyCallback * user_callbacks;
+    uint32_t        shard_num;
+    stShard       * shards;
+};
+
+static void _pin_cpu(uint32_t idx)
+{
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpus <= 0)
+        return;
+    if (cpus > SHARD_CPU_WORDS * 64)
+        cpus = SHARD_CPU_WORDS * 64;
+
+    uint32_t cpu = idx % cpus;
+    uint64_t mask[SHARD_CPU_WORDS] = {0};
+    mask[cpu / 64] = 1ULL << (cpu % 64);
+
+    //pthread_setaffinity_np需要_GNU_SOURCE, 直接用系统调用绑定当前线程
+    if (syscall(SYS_sched_setaffinity, 0, sizeof(mask), mask) != 0)
+    {
+        printf("(%s:%s)\tfailed to pin shard %u to cpu %u, reason: %s\n",
+                __FILE__, __FUNCTION__, idx, cpu, strerror(errno));
+    }
+}
+
+static void _execute(stShard * shard, rfs_shard_req * req)
+{
+    switch (req->op)
+    {
+        case SHARD_OP_GET:
+            req->ret = rfs_get(shard->pfs, req->type, req->key, req->value, &req->vlen, NULL, 0);
+            break;
+        case SHARD_OP_SET:
+            if (req->ttl != 0)
+                req->ret = rfs_set_ex(shard->pfs, req->now, req->ttl, req->type, req->key, req->value, req->vlen);
+            else
+                req->ret = rfs_set(shard->pfs, req->now, req->type, req->key, req->value, req->vlen, NULL, 0);
+            break;
+        case SHARD_OP_DEL:
+            req->ret = rfs_del(shard->pfs, req->type, req->key, NULL, 0);
+            break;
+        default:
+            req->ret = -1;
+            break;
+    }
+}
+
+static void _set_state(stShard * shard, int state)
+{
+    pthread_mutex_lock(&shard->lock);
+    shard->state = state;
+    pthread_cond_broadcast(&shard->done_cond);
+    pthread_mutex_unlock(&shard->lock);
+}
+
+static void * _shard_worker(void * arg)
+{
+    stShard   * shard = (stShard *) arg;
+    rfs_shard * ps    = shard->owner;
+
+    _pin_cpu(shard->idx);
+
+    stSysConfig sys_config = ps->sys_config;
+
+    char dir[sizeof(sys_config.working_dir) + 16];
+    snprintf(dir, sizeof(dir), SHARD_DIR_FORMAT, ps->sys_config.working_dir, shard->idx);
+    if (strlen(dir) >= sizeof(sys_config.working_dir))
+    {
+        printf("(%s:%s)\tdir name %s is too long\n", __FILE__, __FUNCTION__, dir);
+        _set_state(shard, -1);
+        return NULL;
+    }
+    strcpy(sys_config.working_dir, dir);
+
+    if (mkdir(dir, 0755) != 0 && errno != EEXIST)
+    {
+        printf("(%s:%s)\tfailed to create dir %s, reason: %s\n",
+                __FILE__, __FUNCTION__, dir, strerror(errno));
+        _set_state(shard, -1);
+        return NULL;
+    }
+
+    shard->pfs = rfs_create(sys_config, ps->user_config, ps->type_count, ps->user_callbacks);
+    _set_state(shard, (shard->pfs != NULL) ? 1 : -1);
+    if (shard->pfs == NULL)
+        return NULL;
+
+    for (;;)
+    {
+        pthread_mutex_lock(&shard->lock);
+        while (shard->head == NULL && !shard->stop)
+            pthread_cond_wait(&shard->cond, &shard->lock);
+
+        //一次取走整个队列, 执行时不持有锁
+        rfs_shard_req * req = shard->head;
+        shard->head = shard->tail = NULL;
+        pthread_mutex_unlock(&shard->lock);
+
+        if (req == NULL)
+            break;
+
+        while (req != NULL)
+        {
+            //回调或同步调用返回后req可能已经释放
+            rfs_shard_req * next = req->next;
+
+            _execute(shard, req);
+            if (req->callback != NULL)
+                req->callback(req);
+            else
+            {
+                pthread_mutex_lock(&shard->lock);
+                req->done = 1;
+                pthread_cond_broadcast(&shard->done_cond);
+                pthread_mutex_unlock(&shard->lock);
+            }
+
+            req = next;
+        }
+    }
+
+    rfs_destroy(shard->pfs);
+    shard->pfs = NULL;
+
+    return NULL;
+}
+
+static void _stop(rfs_shard * ps)
+{
+    uint32_t i = 0;
+    for (; i < ps->shard_num; ++i)
+    {
+        stShard * shard = ps->shards + i;
+
+        pthread_mutex_lock(&shard->lock);
+        shard->stop = 1;
+        pthread_cond_broadcast(&shard->cond);
+        pthread_mutex_unlock(&shard->lock);
+    }
+
+    for (i = 0; i < ps->shard_num; ++i)
+    {
+        stShard * shard = ps->shards + i;
+        if (shard->started)
+            pthread_join(shard->thread, NULL);
+
+        pthread_mutex_destroy(&shard->lock);
+        pthread_cond_destroy(&shard->cond);
+        pthread_cond_destroy(&shard->done_cond);
+    }
+
+    free(ps->shards);
+    free(ps->user_callbacks);
+    free(ps);
+}
+
+rfs_shard * rfs_shard_create(stSysConfig sys_config, stUserConfig user_config, uint8_t type_count, stKeyCallback * user_callbacks, uint32_t shard_num)
+{
+    if (shard_num == 0)
+        return NULL;
+
+    rfs_shard * ps = calloc(1, sizeof(rfs_shard));
+    if (ps == NULL)
+        return NULL;
+
+    ps->sys_config     = sys_config;
+    ps->user_config    = user_config;
+    ps->type_count     = type_count;
+    ps->shard_num      = shard_num;
+    ps->user_callbacks = calloc(type_count, sizeof(stKeyCallback));
+    ps->shards         = calloc(shard_num, sizeof(stShard));
+    if (ps->user_callbacks == NULL || ps->shards == NULL)
+    {
+        free(ps->user_callbacks);
+        free(ps->shards);
+        free(ps);
+        return NULL;
+    }
+    memcpy(ps->user_callbacks, user_callbacks, type_count * sizeof(stKeyCallback));
+
+    uint32_t i = 0;
+    for (; i < shard_num; ++i)
+    {
+        stShard * shard = ps->shards + i;
+        shard->owner = ps;
+        shard->idx   = i;
+        pthread_mutex_init(&shard->lock, NULL);
+        pthread_cond_init(&shard->cond, NULL);
+        pthread_cond_init(&shard->done_cond, NULL);
+    }
+
+    int ok = 1;
+    for (i = 0; i < shard_num && ok; ++i)
+    {
+        stShard * shard = ps->shards + i;
+        if (pthread_create(&shard->thread, NULL, _shard_worker, shard) != 0)
+        {
+            printf("(%s:%s)\tfailed to create thread for shard %u, reason: %s\n",
+                    __FILE__, __FUNCTION__, i, strerror(errno));
+            ok = 0;
+            break;
+        }
+        shard->started = 1;
+    }
+
+    //各shard的rfs并行加载, 等全部创建完
+    for (i = 0; i < shard_num; ++i)
+    {
+        stShard * shard = ps->shards + i;
+        if (!shard->started)
+            continue;
+
+        pthread_mutex_lock(&shard->lock);
+        while (shard->state == 0)
+            pthread_cond_wait(&shard->done_cond, &shard->lock);
+        if (shard->state != 1)
+            ok = 0;
+        pthread_mutex_unlock(&shard->lock);
+    }
+
+    if (!ok)
+    {
+        _stop(ps);
+        return NULL;
+    }
+
+    return ps;
+}
+
+int rfs_shard_destroy(rfs_shard * ps)
+{
+    _stop(ps);
+    return 0;
+}
+
+uint32_t rfs_shard_of(rfs_shard * ps, uint8_t type, void * key)
+{
+    //用打散后的高位选shard, shard内的hash_table按低位取模时各个链表仍然都用得到
+    uint32_t hash = ps->user_callbacks[type].hash(key) * 2654435761u;
+    return (uint32_t) (((uint64_t) hash * ps->shard_num) >> 32);
+}
+
+int rfs_shard_submit(rfs_shard * ps, rfs_shard_req * req)
+{
+    if (req->type >= ps->type_count)
+        return -1;
+
+    stShard * shard = ps->shards + rfs_shard_of(ps, req->type, req->key);
+
+    req->next = NULL;
+    req->done = 0;
+    req->ret  = -1;
+
+    pthread_mutex_lock(&shard->lock);
+    if (shard->stop)
+    {
+        pthread_mutex_unlock(&shard->lock);
+        return -1;
+    }
+
+    if (shard->tail != NULL)
+        shard->tail->next = req;
+    else
+        shard->head = req;
+    shard->tail = req;
+
+    pthread_cond_signal(&shard->cond);
+    pthread_mutex_unlock(&shard->lock);
+
+    return 0;
+}
+
+static int64_t _call(rfs_shard * ps, rfs_shard_req * req)
+{
+    req->callback = NULL;
+    req->arg      = NULL;
+    if (rfs_shard_submit(ps, req) != 0)
+        return -1;
+
+    stShard * shard = ps->shards + rfs_shard_of(ps, req->type, req->key);
+
+    pthread_mutex_lock(&shard->lock);
+    while (!req->done)
+        pthread_cond_wait(&shard->done_cond, &shard->lock);
+    pthread_mutex_unlock(&shard->lock);
+
+    return req->ret;
+}
+
+int64_t rfs_shard_get(rfs_shard * ps, uint8_t type, void * key, char * value, uint16_t * vlen)
+{
+    rfs_shard_req req;
+    memset(&req, 0, sizeof(req));
+    req.op    = SHARD_OP_GET;
+    req.type  = type;
+    req.key   = key;
+    req.value = value;
+
+    int64_t ret = _call(ps, &req);
+    if (ret != -1)
+        *vlen = req.vlen;
+
+    return ret;
+}
+
+int64_t rfs_shard_set_ex(rfs_shard * ps, uint32_t now, uint32_t ttl, uint8_t type, void * key, char * value, uint16_t vlen)
+{
+    rfs_shard_req req;
+    memset(&req, 0, sizeof(req));
+    req.op    = SHARD_OP_SET;
+    req.type  = type;
+    req.key   = key;
+    req.value = value;
+    req.vlen  = vlen;
+    req.now   = now;
+    req.ttl   = ttl;
+
+    return _call(ps, &req);
+}
+
+int64_t rfs_shard_set(rfs_shard * ps, uint32_t now, uint8_t type, void * key, char * value, uint16_t vlen)
+{
+    return rfs_shard_set_ex(ps, now, 0, type, key, value, vlen);
+}
+
+int rfs_shard_del(rfs_shard * ps, uint8_t type, void * key)
+{
+    rfs_shard_req req;
+    memset(&req, 0, sizeof(req));
+    req.op   = SHARD_OP_DEL;
+    req.type = type;
+    req.key  = key;
+
+    return (int) _call(ps, &req);
+}
@@ -0,0 +1,57 @@
+#ifndef  RFS_SHARD_INC
+#define  RFS_SHARD_INC
+
+#include <stdint.h>
+#include "rfs.h"
+
+//按stKeyCallback::hash把key分到shard_num个互不共享的rfs, 第i个rfs的工作目录为working_dir/shard_i
+//每个rfs只由自己的线程(绑定到第i % CPU数个CPU)访问, 其他线程通过它的请求队列提交请求
+//各rfs在自己的线程中创建, 启动时并行加载
+struct _stRfsShard;
+typedef struct _stRfsShard rfs_shard;
+
+rfs_shard * rfs_shard_create(stSysConfig sys_config, stUserConfig user_config, uint8_t type_count, stKeyCallback * user_callbacks, uint32_t shard_num);
+
+//执行完已提交的请求后销毁
+int rfs_shard_destroy(rfs_shard * ps);
+
+uint32_t rfs_shard_of(rfs_shard * ps, uint8_t type, void * key);
+
+enum {
+    SHARD_OP_GET = 1,
+    SHARD_OP_SET = 2, //ttl不为0时同rfs_set_ex
+    SHARD_OP_DEL = 3,
+};
+
+//异步请求, 由调用者分配, 在callback之前必须保持有效
+//callback在shard的线程中调用, 其中不能等待同一个shard上的请求
+struct _stShardReq;
+typedef void (* rfs_shard_callback)(struct _stShardReq * req);
+
+typedef struct _stShardReq {
+    uint8_t  op;     //SHARD_OP_*
+    uint8_t  type;
+    void *   key;
+    char *   value;  //SHARD_OP_GET时为结果的空间
+    uint16_t vlen;   //SHARD_OP_GET时返回value的长度
+    uint32_t now;
+    uint32_t ttl;
+    int64_t  ret;    //编码同rfs_get/rfs_set, rfs_del成功时为0
+
+    rfs_shard_callback callback;
+    void *   arg;
+
+    struct _stShardReq * next; //内部使用
+    int                  done; //内部使用
+} rfs_shard_req;
+
+//放入key所在的shard的队列后立即返回
+int rfs_shard_submit(rfs_shard * ps, rfs_shard_req * req);
+
+//同步接口: 提交后等待执行完, 返回编码同rfs_get/rfs_set/rfs_set_ex/rfs_del
+int64_t rfs_shard_get(rfs_shard * ps, uint8_t type, void * key, char * value, uint16_t * vlen);
+int64_t rfs_shard_set(rfs_shard * ps, uint32_t now, uint8_t type, void * key, char * value, uint16_t vlen);
+int64_t rfs_shard_set_ex(rfs_shard * ps, uint32_t now, uint32_t ttl, uint8_t type, void * key, char * value, uint16_t vlen);
+int rfs_shard_del(rfs_shard * ps, uint8_t type, void * key);
+
+#endif
@@ -0,0 +1,189 @@
+#include "timing_wheel.h"
+#include <stdlib.h>
+#include <assert.h>
+
+#define TW_LEVEL_NUM (4)
+#define TW_SLOT_BITS (8)
+#define TW_SLOT_NUM  (1 << TW_SLOT_BITS)
+#define TW_SLOT_MASK (TW_SLOT_NUM - 1)
+
+typedef struct _stTwNode {
+    stTimer            timer;
+    struct _stTwNode * next;
+} stTwNode;
+
+struct _stTimingWheel {
+    uint32_t   cur;                        //当前时间, 第0层cur所在的槽中是所有expire <= cur的项
+    uint32_t   count;
+    uint32_t   level_count[TW_LEVEL_NUM];  //每层的项数, 低层都为空时可以直接跳过
+    stTwNode * slots[TW_LEVEL_NUM][TW_SLOT_NUM];
+    stTwNode * free_nodes;                 //取出的节点留着给下次tw_add用
+};
+
+stTimingWheel * tw_create(uint32_t now)
+{
+    stTimingWheel * tw = calloc(1, sizeof(stTimingWheel));
+    if (tw == NULL)
+        return NULL;
+
+    tw->cur = now;
+    return tw;
+}
+
+static void _tw_free_list(stTwNode * node)
+{
+    while (node != NULL)
+    {
+        stTwNode * next = node->next;
+        free(node);
+        node = next;
+    }
+}
+
+int tw_destroy(stTimingWheel * tw)
+{
+    assert(tw != NULL);
+
+    int level = 0;
+    for (; level < TW_LEVEL_NUM; ++level)
+    {
+        int slot = 0;
+        for (; slot < TW_SLOT_NUM; ++slot)
+            _tw_free_list(tw->slots[level][slot]);
+    }
+    _tw_free_list(tw->free_nodes);
+    free(tw);
+
+    return 0;
+}
+
+//放到与cur第一个相同的高位以下的那一层, 槽号为expire在这一层的8位
+static void _tw_place(stTimingWheel * tw, stTwNode * node)
+{
+    uint32_t expire = (node->timer.expire > tw->cur) ? node->timer.expire : tw->cur;
+
+    int level = 0;
+    while (level < TW_LEVEL_NUM - 1
+            && (expire >> (TW_SLOT_BITS * (level + 1))) != (tw->cur >> (TW_SLOT_BITS * (level + 1))))
+        ++level;
+
+    stTwNode ** slot = &tw->slots[level][(expire >> (TW_SLOT_BITS * level)) & TW_SLOT_MASK];
+    node->next = *slot;
+    *slot = node;
+    ++tw->level_count[level];
+}
+
+int tw_add(stTimingWheel * tw, uint32_t expire, uint64_t data)
+{
+    stTwNode * node = tw->free_nodes;
+    if (node != NULL)
+        tw->free_nodes = node->next;
+    else if ((node = malloc(sizeof(stTwNode))) == NULL)
+        return -1;
+
+    node->timer.expire = expire;
+    node->timer.data   = data;
+    _tw_place(tw, node);
+    ++tw->count;
+
+    return 0;
+}
+
+//cur进入高层的一个新槽时, 把这个槽中的项放到低层, 从高到低处理
+static void _tw_cascade(stTimingWheel * tw)
+{
+    int level = TW_LEVEL_NUM - 1;
+    for (; level > 0; --level)
+    {
+        if ((tw->cur & ((1u << (TW_SLOT_BITS * level)) - 1)) != 0)
+            continue;
+
+        stTwNode ** slot = &tw->slots[level][(tw->cur >> (TW_SLOT_BITS * level)) & TW_SLOT_MASK];
+        stTwNode * node = *slot;
+        *slot = NULL;
+
+        while (node != NULL)
+        {
+            stTwNode * next = node->next;
+            --tw->level_count[level];
+            _tw_place(tw, node);
+            node = next;
+        }
+    }
+}
+
+//cur < now时前进一步: 低层都为空时直接跳到下一个有项的层的下一个槽, 不超过now
+static void _tw_step(stTimingWheel * tw, uint32_t now)
+{
+    int empty = 0;
+    while (empty < TW_LEVEL_NUM && tw->level_count[empty] == 0)
+        ++empty;
+
+    uint64_t next = (uint64_t) tw->cur + 1;
+    if (empty == TW_LEVEL_NUM)
+        next = now;
+    else if (empty > 0)
+        next = (((uint64_t) tw->cur >> (TW_SLOT_BITS * empty)) + 1) << (TW_SLOT_BITS * empty);
+
+    //跳不到下一个有项的层的下一个槽时, 经过的时间不需要cascade
+    if (next > now)
+    {
+        tw->cur = now;
+        return;
+    }
+
+    tw->cur = next;
+    _tw_cascade(tw);
+}
+
+uint32_t tw_expire(stTimingWheel * tw, uint32_t now, stTimer * timers, uint32_t max)
+{
+    uint32_t n = 0;
+    while (n < max)
+    {
+        stTwNode ** slot = &tw->slots[0][tw->cur & TW_SLOT_MASK];
+        while (*slot != NULL && n < max)
+        {
+            stTwNode * node = *slot;
+            *slot = node->next;
+
+            timers[n++] = node->timer;
+            node->next = tw->free_nodes;
+            tw->free_nodes = node;
+            --tw->level_count[0];
+            --tw->count;
+        }
+
+        if (*slot != NULL || tw->cur >= now)
+            break;
+
+        _tw_step(tw, now);
+    }
+
+    return n;
+}
+
+int tw_foreach(stTimingWheel * tw, tw_handler handler, void * ctx)
+{
+    int level = 0;
+    for (; level < TW_LEVEL_NUM; ++level)
+    {
+        int slot = 0;
+        for (; slot < TW_SLOT_NUM; ++slot)
+        {
+            stTwNode * node = tw->slots[level][slot];
+            for (; node != NULL; node = node->next)
+            {
+                if (handler(ctx, &node->timer) != 0)
+                    return -1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+uint32_t tw_count(stTimingWheel * tw)
+{
+    return tw->count;
+}
@@ -0,0 +1,34 @@
+#ifndef  TIMING_WHEEL_INC
+#define  TIMING_WHEEL_INC
+
+#include <stdint.h>
+
+//分层时间轮, 时间单位为秒: 4层, 每层256个槽, 到期时间相差越远放在越高的层
+//时间推进到高层的一个槽时把其中的项重新放到低层, 加入和取出都是O(1)
+
+typedef struct {
+    uint64_t data;
+    uint32_t expire;
+} stTimer;
+
+struct _stTimingWheel;
+typedef struct _stTimingWheel stTimingWheel;
+
+typedef int (* tw_handler)(void * ctx, stTimer * timer);
+
+stTimingWheel * tw_create(uint32_t now);
+int tw_destroy(stTimingWheel * tw);
+
+//expire早于当前时间的项在下一次tw_expire时取出
+int tw_add(stTimingWheel * tw, uint32_t expire, uint64_t data);
+
+//把时间推进到now, 取出最多max个expire <= now的项, 返回取出的个数
+//没取完时时间停在没取完的槽, 下次调用继续取
+uint32_t tw_expire(stTimingWheel * tw, uint32_t now, stTimer * timers, uint32_t max);
+
+//依次对每个未到期的项调用handler, handler返回非0时停止并返回-1
+int tw_foreach(stTimingWheel * tw, tw_handler handler, void * ctx);
+
+uint32_t tw_count(stTimingWheel * tw);
+
+#endif
@@ -0,0 +1,310 @@
+#include "value_cache.h"
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#define VC_SMALL_PERCENT (10) //小队列占容量的百分比
+#define VC_MAX_FREQ      (3)
+#define VC_MIN_BUCKETS   (64)
+
+enum {
+    vcSmall = 0,
+    vcMain  = 1,
+    vcGhost = 2, //只有key, 没有数据
+    vcCount
+};
+
+typedef struct _stVcEntry {
+    uint64_t            key;
+    struct _stVcEntry * hnext;  //hash桶中的下一个
+    struct _stVcEntry * prev;   //队列中靠近头部的一个
+    struct _stVcEntry * next;   //队列中靠近尾部的一个
+    uint32_t            len;
+    uint8_t             queue;
+    uint8_t             freq;   //放入后被vc_get命中的次数, 最多VC_MAX_FREQ
+    char                data[];
+} stVcEntry;
+
+//新项放在头部, 从尾部淘汰
+typedef struct {
+    stVcEntry * head;
+    stVcEntry * tail;
+    uint64_t    bytes;
+    uint32_t    count;
+} stVcQueue;
+
+struct _stValueCache {
+    uint64_t     capacity;
+    uint64_t     small_capacity;
+    stVcEntry ** buckets;
+    uint32_t     bucket_num;    //2的幂
+    uint32_t     entry_num;     //hash中的项数, 含ghost
+    stVcQueue    queues[vcCount];
+};
+
+static inline uint64_t _vc_entry_size(uint32_t len)
+{
+    return sizeof(stVcEntry) + len;
+}
+
+static inline uint32_t _vc_bucket(stValueCache * vc, uint64_t key)
+{
+    return (uint32_t) ((key * 0x9E3779B97F4A7C15ULL) >> 32) & (vc->bucket_num - 1);
+}
+
+stValueCache * vc_create(uint64_t capacity)
+{
+    stValueCache * vc = calloc(1, sizeof(stValueCache));
+    if (vc == NULL)
+        return NULL;
+
+    vc->capacity       = capacity;
+    vc->small_capacity = capacity * VC_SMALL_PERCENT / 100;
+    vc->bucket_num     = VC_MIN_BUCKETS;
+    vc->buckets        = calloc(vc->bucket_num, sizeof(stVcEntry *));
+    if (vc->buckets == NULL)
+    {
+        free(vc);
+        return NULL;
+    }
+
+    return vc;
+}
+
+int vc_destroy(stValueCache * vc)
+{
+    assert(vc != NULL);
+
+    int q = 0;
+    for (; q < vcCount; ++q)
+    {
+        stVcEntry * e = vc->queues[q].head;
+        while (e != NULL)
+        {
+            stVcEntry * next = e->next;
+            free(e);
+            e = next;
+        }
+    }
+    free(vc->buckets);
+    free(vc);
+
+    return 0;
+}
+
+static stVcEntry * _vc_find(stValueCache * vc, uint64_t key, stVcEntry *** link)
+{
+    stVcEntry ** p = vc->buckets + _vc_bucket(vc, key);
+    for (; *p != NULL; p = &(*p)->hnext)
+    {
+        if ((*p)->key == key)
+        {
+            if (link != NULL)
+                *link = p;
+            return *p;
+        }
+    }
+
+    return NULL;
+}
+
+//项数超过桶数时桶数加倍, 失败时继续用原来的桶
+static void _vc_grow(stValueCache * vc)
+{
+    uint32_t num = vc->bucket_num * 2;
+    stVcEntry ** buckets = calloc(num, sizeof(stVcEntry *));
+    if (buckets == NULL)
+        return;
+
+    stVcEntry ** old = vc->buckets;
+    uint32_t old_num = vc->bucket_num;
+    vc->buckets    = buckets;
+    vc->bucket_num = num;
+
+    uint32_t i = 0;
+    for (; i < old_num; ++i)
+    {
+        stVcEntry * e = old[i];
+        while (e != NULL)
+        {
+            stVcEntry * next = e->hnext;
+            uint32_t b = _vc_bucket(vc, e->key);
+            e->hnext = buckets[b];
+            buckets[b] = e;
+            e = next;
+        }
+    }
+    free(old);
+}
+
+static void _vc_push(stValueCache * vc, int q, stVcEntry * e)
+{
+    stVcQueue * queue = vc->queues + q;
+    e->queue = q;
+    e->prev  = NULL;
+    e->next  = queue->head;
+    if (queue->head != NULL)
+        queue->head->prev = e;
+    else
+        queue->tail = e;
+    queue->head = e;
+
+    queue->bytes += _vc_entry_size(e->len);
+    ++queue->count;
+}
+
+static void _vc_unlink(stValueCache * vc, stVcEntry * e)
+{
+    stVcQueue * queue = vc->queues + e->queue;
+    if (e->prev != NULL)
+        e->prev->next = e->next;
+    else
+        queue->head = e->next;
+
+    if (e->next != NULL)
+        e->next->prev = e->prev;
+    else
+        queue->tail = e->prev;
+
+    queue->bytes -= _vc_entry_size(e->len);
+    --queue->count;
+}
+
+static void _vc_remove(stValueCache * vc, stVcEntry * e)
+{
+    stVcEntry ** link = NULL;
+    _vc_find(vc, e->key, &link);
+    assert(link != NULL && *link == e);
+    *link = e->hnext;
+    --vc->entry_num;
+
+    _vc_unlink(vc, e);
+    free(e);
+}
+
+static stVcEntry * _vc_insert(stValueCache * vc, int q, uint64_t key, uint32_t len)
+{
+    stVcEntry * e = malloc(_vc_entry_size(len));
+    if (e == NULL)
+        return NULL;
+
+    e->key  = key;
+    e->len  = len;
+    e->freq = 0;
+
+    uint32_t b = _vc_bucket(vc, key);
+    e->hnext = vc->buckets[b];
+    vc->buckets[b] = e;
+    ++vc->entry_num;
+    _vc_push(vc, q, e);
+
+    if (vc->entry_num > vc->bucket_num)
+        _vc_grow(vc);
+
+    return e;
+}
+
+//ghost中的key数不超过主队列的项数
+static void _vc_trim_ghost(stValueCache * vc)
+{
+    stVcQueue * ghost = vc->queues + vcGhost;
+    uint32_t limit = vc->queues[vcMain].count;
+    while (ghost->count > 0 && ghost->count > limit)
+        _vc_remove(vc, ghost->tail);
+}
+
+//小队列尾部的项: 被访问过的移到主队列, 否则丢掉数据, key放进ghost
+static void _vc_evict_small(stValueCache * vc)
+{
+    stVcEntry * e = vc->queues[vcSmall].tail;
+    if (e->freq > 0)
+    {
+        _vc_unlink(vc, e);
+        e->freq = 0;
+        _vc_push(vc, vcMain, e);
+        return;
+    }
+
+    uint64_t key = e->key;
+    _vc_remove(vc, e);
+    _vc_insert(vc, vcGhost, key, 0);
+    _vc_trim_ghost(vc);
+}
+
+//主队列尾部的项: 被访问过的减一次访问次数放回头部, 否则淘汰
+static void _vc_evict_main(stValueCache * vc)
+{
+    stVcEntry * e = vc->queues[vcMain].tail;
+    if (e->freq > 0)
+    {
+        _vc_unlink(vc, e);
+        --e->freq;
+        _vc_push(vc, vcMain, e);
+        return;
+    }
+
+    _vc_remove(vc, e);
+    _vc_trim_ghost(vc);
+}
+
+const char * vc_get(stValueCache * vc, uint64_t key, uint32_t * len)
+{
+    stVcEntry * e = _vc_find(vc, key, NULL);
+    if (e == NULL || e->queue == vcGhost)
+        return NULL;
+
+    if (e->freq < VC_MAX_FREQ)
+        ++e->freq;
+
+    *len = e->len;
+    return e->data;
+}
+
+char * vc_put(stValueCache * vc, uint64_t key, uint32_t len)
+{
+    int q = vcSmall;
+    stVcEntry * e = _vc_find(vc, key, NULL);
+    if (e != NULL)
+    {
+        if (e->queue == vcGhost)
+            q = vcMain;
+        _vc_remove(vc, e);
+    }
+
+    uint64_t size = _vc_entry_size(len);
+    if (size > vc->capacity - vc->small_capacity)
+        return NULL;
+
+    stVcQueue * small_q = vc->queues + vcSmall;
+    stVcQueue * main_q  = vc->queues + vcMain;
+    while (small_q->bytes + main_q->bytes + size > vc->capacity)
+    {
+        if (small_q->count > 0 && (small_q->bytes > vc->small_capacity || main_q->count == 0))
+            _vc_evict_small(vc);
+        else
+            _vc_evict_main(vc);
+    }
+
+    e = _vc_insert(vc, q, key, len);
+    return (e != NULL) ? e->data : NULL;
+}
+
+int vc_del(stValueCache * vc, uint64_t key)
+{
+    stVcEntry * e = _vc_find(vc, key, NULL);
+    if (e == NULL)
+        return -1;
+
+    _vc_remove(vc, e);
+    return 0;
+}
+
+uint64_t vc_size(stValueCache * vc)
+{
+    return vc->queues[vcSmall].bytes + vc->queues[vcMain].bytes;
+}
+
+uint32_t vc_count(stValueCache * vc)
+{
+    return vc->queues[vcSmall].count + vc->queues[vcMain].count;
+}
@@ -0,0 +1,27 @@
+#ifndef  VALUE_CACHE_INC
+#define  VALUE_CACHE_INC
+
+#include <stdint.h>
+
+//按uint64_t的key缓存一段数据, 总字节数(含每项的管理开销, 不含ghost)不超过capacity
+//S3-FIFO淘汰: 新数据先进小队列, 在小队列中被访问过的才进入主队列, 只访问一次的扫描不会挤掉热数据
+//没被访问过就淘汰的key记在ghost队列中, 很快再次放入时直接进入主队列
+
+struct _stValueCache;
+typedef struct _stValueCache stValueCache;
+
+stValueCache * vc_create(uint64_t capacity);
+int vc_destroy(stValueCache * vc);
+
+//命中时返回数据的地址, 下次调用vc_put/vc_del之前有效; 不在缓存中返回NULL
+const char * vc_get(stValueCache * vc, uint64_t key, uint32_t * len);
+
+//放入key(已存在时替换), 返回len字节的空间由调用者填写; 超过容量或没有内存时返回NULL
+char * vc_put(stValueCache * vc, uint64_t key, uint32_t len);
+
+int vc_del(stValueCache * vc, uint64_t key);
+
+uint64_t vc_size(stValueCache * vc); //当前占用的字节数
+uint32_t vc_count(stValueCache * vc); //缓存的项数, 不含ghost
+
+#endif
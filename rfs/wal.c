@@ -0,0 +1,395 @@
+#include "wal.h"
+#include "crc32c.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#define WAL_MAGIC       (0x4C415752) //"RWAL"
+#define WAL_VERSION     (1)
+#define WAL_MAX_REC_LEN (64*1024*1024)
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t base_lsn;   //文件中第一条记录的lsn
+} stWalHeader;
+
+/*
+   +-----+
+   | wal |
+   +--------------------------------------------------------------+
+   | stWalHeader | stWalFrame | record | stWalFrame | record | ... |
+   +--------------------------------------------------------------+
+*/
+
+typedef struct {
+    uint32_t len;        //record的长度
+    uint32_t crc;        //lsn和record的crc32c
+    uint64_t lsn;
+} stWalFrame;
+
+struct _stWal {
+    int      fd;
+    char     path[256];
+
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+    uint64_t base_lsn;     //文件中第一条记录的lsn
+    uint64_t next_lsn;     //下一条记录的lsn
+    uint64_t durable_lsn;  //已落盘的最大lsn
+    uint64_t file_size;    //文件中有效数据的长度
+    int      flushing;     //是否有线程正在写文件
+    int      failed;       //写文件失败过, 之后的记录可能已不连续, wal_reset之前不再接受记录
+    uint64_t syncs;        //wal_commit调用fdatasync的次数
+
+    char *   buf;          //已append还没有写入文件的记录
+    uint32_t buf_len;
+    uint32_t buf_cap;
+    char *   flush_buf;    //正在写入文件的记录
+    uint32_t flush_cap;
+};
+
+//依次读出文件中的记录, 返回最后一条完整记录之后的偏移
+static uint64_t _wal_scan(stWal * wal, uint64_t base_lsn, wal_handler handler, void * ctx, uint64_t * next_lsn)
+{
+    uint64_t offset = sizeof(stWalHeader);
+    uint64_t lsn    = base_lsn;
+
+    char *   rec = NULL;
+    uint32_t cap = 0;
+
+    while (1)
+    {
+        stWalFrame frame;
+        if (pread(wal->fd, &frame, sizeof(frame), offset) != sizeof(frame))
+            break;
+
+        if (frame.lsn != lsn || frame.len > WAL_MAX_REC_LEN)
+            break;
+
+        if (frame.len > cap)
+        {
+            char * p = realloc(rec, frame.len);
+            if (p == NULL)
+                break;
+            rec = p;
+            cap = frame.len;
+        }
+
+        if (pread(wal->fd, rec, frame.len, offset + sizeof(frame)) != frame.len)
+            break;
+
+        uint32_t crc = crc32c(crc32c(0, &frame.lsn, sizeof(frame.lsn)), rec, frame.len);
+        if (crc != frame.crc)
+            break;
+
+        if (handler != NULL && handler(ctx, lsn, rec, frame.len) != 0)
+            break;
+
+        offset += sizeof(frame) + frame.len;
+        ++lsn;
+    }
+
+    free(rec);
+    *next_lsn = lsn;
+    return offset;
+}
+
+static int _wal_write_header(stWal * wal, uint64_t base_lsn)
+{
+    stWalHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic    = WAL_MAGIC;
+    header.version  = WAL_VERSION;
+    header.base_lsn = base_lsn;
+
+    if (pwrite(wal->fd, &header, sizeof(header), 0) != sizeof(header))
+        return -1;
+    if (ftruncate(wal->fd, sizeof(header)) != 0)
+        return -1;
+
+    return fdatasync(wal->fd);
+}
+
+stWal * wal_open(const char * path)
+{
+    stWal * wal = calloc(1, sizeof(stWal));
+    if (wal == NULL)
+        return NULL;
+
+    strncpy(wal->path, path, sizeof(wal->path) - 1);
+    pthread_mutex_init(&wal->lock, NULL);
+    pthread_cond_init(&wal->cond, NULL);
+
+    wal->fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (wal->fd < 0)
+    {
+        printf("(%s:%s)\tfailed to open file %s, reason: %s\n",
+                __FILE__, __FUNCTION__, path, strerror(errno));
+        free(wal);
+        return NULL;
+    }
+
+    stWalHeader header;
+    if (pread(wal->fd, &header, sizeof(header), 0) != sizeof(header) || header.magic != WAL_MAGIC)
+    {
+        header.base_lsn = 1;
+        if (_wal_write_header(wal, header.base_lsn) != 0)
+        {
+            printf("(%s:%s)\tfailed to init file %s, reason: %s\n",
+                    __FILE__, __FUNCTION__, path, strerror(errno));
+            wal_close(wal);
+            return NULL;
+        }
+    }
+
+    wal->base_lsn  = header.base_lsn;
+    wal->file_size = _wal_scan(wal, header.base_lsn, NULL, NULL, &wal->next_lsn);
+    wal->durable_lsn = wal->next_lsn - 1;
+
+    //截掉尾部不完整的记录
+    if (ftruncate(wal->fd, wal->file_size) != 0)
+    {
+        printf("(%s:%s)\tfailed to truncate file %s, reason: %s\n",
+                __FILE__, __FUNCTION__, path, strerror(errno));
+        wal_close(wal);
+        return NULL;
+    }
+
+    return wal;
+}
+
+int wal_close(stWal * wal)
+{
+    assert(wal != NULL);
+
+    if (wal->fd >= 0)
+        close(wal->fd);
+
+    pthread_cond_destroy(&wal->cond);
+    pthread_mutex_destroy(&wal->lock);
+    free(wal->buf);
+    free(wal->flush_buf);
+    free(wal);
+
+    return 0;
+}
+
+int wal_replay(stWal * wal, wal_handler handler, void * ctx)
+{
+    stWalHeader header;
+    if (pread(wal->fd, &header, sizeof(header), 0) != sizeof(header))
+        return -1;
+
+    uint64_t next_lsn = 0;
+    _wal_scan(wal, header.base_lsn, handler, ctx, &next_lsn);
+
+    //handler中途返回非0
+    return (next_lsn == wal->durable_lsn + 1) ? 0 : -1;
+}
+
+uint64_t wal_append(stWal * wal, struct iovec * iov, int iovcnt)
+{
+    uint32_t len = 0;
+    int i = 0;
+    for (; i < iovcnt; ++i)
+        len += iov[i].iov_len;
+
+    if (len > WAL_MAX_REC_LEN)
+        return 0;
+
+    pthread_mutex_lock(&wal->lock);
+
+    if (wal->failed)
+    {
+        pthread_mutex_unlock(&wal->lock);
+        return 0;
+    }
+
+    uint32_t need = wal->buf_len + sizeof(stWalFrame) + len;
+    if (need > wal->buf_cap)
+    {
+        uint32_t cap = wal->buf_cap ? wal->buf_cap : 4096;
+        while (cap < need) cap *= 2;
+
+        char * p = realloc(wal->buf, cap);
+        if (p == NULL)
+        {
+            pthread_mutex_unlock(&wal->lock);
+            return 0;
+        }
+        wal->buf     = p;
+        wal->buf_cap = cap;
+    }
+
+    stWalFrame * frame = (stWalFrame *) (wal->buf + wal->buf_len);
+    frame->len = len;
+    frame->lsn = wal->next_lsn++;
+
+    char * p = (char *) (frame + 1);
+    uint32_t crc = crc32c(0, &frame->lsn, sizeof(frame->lsn));
+    for (i = 0; i < iovcnt; ++i)
+    {
+        memcpy(p, iov[i].iov_base, iov[i].iov_len);
+        crc = crc32c(crc, p, iov[i].iov_len);
+        p += iov[i].iov_len;
+    }
+    frame->crc = crc;
+
+    wal->buf_len = need;
+    uint64_t lsn = frame->lsn;
+
+    pthread_mutex_unlock(&wal->lock);
+
+    return lsn;
+}
+
+int wal_commit(stWal * wal, uint64_t lsn)
+{
+    int ret = 0;
+
+    pthread_mutex_lock(&wal->lock);
+
+    if (lsn == 0)
+        lsn = wal->next_lsn - 1;
+
+    while (wal->durable_lsn < lsn)
+    {
+        if (wal->failed)
+        {
+            ret = -1;
+            break;
+        }
+
+        //已经有线程在写, 等它写完后看是否已包含自己的记录
+        if (wal->flushing)
+        {
+            pthread_cond_wait(&wal->cond, &wal->lock);
+            continue;
+        }
+
+        //由当前线程把所有已append的记录一起写入
+        char *   buf = wal->buf;
+        uint32_t len = wal->buf_len;
+        uint32_t cap = wal->buf_cap;
+        uint64_t offset = wal->file_size;
+        uint64_t target = wal->next_lsn - 1;
+
+        wal->buf       = wal->flush_buf;
+        wal->buf_cap   = wal->flush_cap;
+        wal->buf_len   = 0;
+        wal->flushing  = 1;
+        pthread_mutex_unlock(&wal->lock);
+
+        ssize_t w = pwrite(wal->fd, buf, len, offset);
+        int sync  = (w == len) ? fdatasync(wal->fd) : -1;
+
+        pthread_mutex_lock(&wal->lock);
+        wal->flush_buf = buf;
+        wal->flush_cap = cap;
+        wal->flushing  = 0;
+        wal->syncs    += (w == len);
+        pthread_cond_broadcast(&wal->cond);
+
+        //这批记录已经不在缓冲区中, 之后的记录接上去lsn就不连续了, 也不能再认为它们已落盘
+        //截掉写了一部分的记录, 重启后不会重放这批记录
+        if (sync != 0)
+        {
+            printf("(%s:%s)\tfailed to write file %s, reason: %s\n",
+                    __FILE__, __FUNCTION__, wal->path, strerror(errno));
+            wal->failed = 1;
+            if (ftruncate(wal->fd, wal->file_size) != 0)
+            {
+                printf("(%s:%s)\tfailed to truncate file %s, reason: %s\n",
+                        __FILE__, __FUNCTION__, wal->path, strerror(errno));
+            }
+            ret = -1;
+            break;
+        }
+
+        wal->file_size  += len;
+        wal->durable_lsn = target;
+    }
+
+    pthread_mutex_unlock(&wal->lock);
+
+    return ret;
+}
+
+int wal_reset(stWal * wal, uint64_t next_lsn)
+{
+    pthread_mutex_lock(&wal->lock);
+
+    while (wal->flushing)
+        pthread_cond_wait(&wal->cond, &wal->lock);
+
+    if (next_lsn < wal->next_lsn)
+        next_lsn = wal->next_lsn;
+
+    int ret = _wal_write_header(wal, next_lsn);
+    if (ret == 0)
+    {
+        wal->base_lsn    = next_lsn;
+        wal->next_lsn    = next_lsn;
+        wal->durable_lsn = next_lsn - 1;
+        wal->file_size   = sizeof(stWalHeader);
+        wal->buf_len     = 0;
+        wal->failed      = 0;
+    }
+
+    pthread_mutex_unlock(&wal->lock);
+
+    return ret;
+}
+
+//wal_commit不在rfs的锁内执行, 读这些字段也要加锁
+uint64_t wal_next_lsn(stWal * wal)
+{
+    pthread_mutex_lock(&wal->lock);
+    uint64_t lsn = wal->next_lsn;
+    pthread_mutex_unlock(&wal->lock);
+
+    return lsn;
+}
+
+uint64_t wal_base_lsn(stWal * wal)
+{
+    pthread_mutex_lock(&wal->lock);
+    uint64_t lsn = wal->base_lsn;
+    pthread_mutex_unlock(&wal->lock);
+
+    return lsn;
+}
+
+uint64_t wal_size(stWal * wal)
+{
+    pthread_mutex_lock(&wal->lock);
+    uint64_t size = wal->file_size + wal->buf_len;
+    pthread_mutex_unlock(&wal->lock);
+
+    return size;
+}
+
+uint32_t wal_buffered(stWal * wal)
+{
+    pthread_mutex_lock(&wal->lock);
+    uint32_t len = wal->buf_len;
+    pthread_mutex_unlock(&wal->lock);
+
+    return len;
+}
+
+uint64_t wal_syncs(stWal * wal)
+{
+    pthread_mutex_lock(&wal->lock);
+    uint64_t syncs = wal->syncs;
+    pthread_mutex_unlock(&wal->lock);
+
+    return syncs;
+}
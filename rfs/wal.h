@@ -0,0 +1,40 @@
+#ifndef  WAL_INC
+#define  WAL_INC
+
+#include <stdint.h>
+#include <sys/uio.h>
+
+//预写日志: 记录内容由调用者定义, 每条记录分配一个递增的lsn
+//wal_append只写入内存缓冲区, wal_commit负责落盘;
+//多个线程同时wal_commit时由一个线程把所有已append的记录一起写入并fdatasync(group commit)
+
+struct _stWal;
+typedef struct _stWal stWal;
+
+typedef int (* wal_handler)(void * ctx, uint64_t lsn, char * rec, uint32_t len);
+
+//打开或创建日志文件, 文件尾部不完整的记录会被截掉
+stWal * wal_open(const char * path);
+int wal_close(stWal * wal);
+
+//依次对文件中的每条记录调用handler, handler返回非0时停止并返回-1
+int wal_replay(stWal * wal, wal_handler handler, void * ctx);
+
+//返回记录的lsn, 0表示失败; wal_commit失败过之后总是失败
+uint64_t wal_append(stWal * wal, struct iovec * iov, int iovcnt);
+
+//等到lsn及之前的记录都已落盘, lsn为0表示所有已append的记录
+//写文件或fdatasync失败时丢弃这批记录并进入失败状态, 之后的wal_append和wal_commit都返回失败, 直到wal_reset成功
+int wal_commit(stWal * wal, uint64_t lsn);
+
+//清空日志, 之后的记录从max(next_lsn, 当前的下一个lsn)开始编号
+//调用者需保证日志中的记录都已不再需要(数据文件已落盘), 且没有并发的wal_append; 成功后清除失败状态
+int wal_reset(stWal * wal, uint64_t next_lsn);
+
+uint64_t wal_next_lsn(stWal * wal);
+uint64_t wal_base_lsn(stWal * wal); //文件中第一条记录的lsn, 没有记录时等于wal_next_lsn
+uint64_t wal_size(stWal * wal);     //文件长度加上还未写入文件的记录长度
+uint32_t wal_buffered(stWal * wal); //还未写入文件的记录长度
+uint64_t wal_syncs(stWal * wal);    //wal_commit调用fdatasync的次数, 同时提交的记录共用一次
+
+#endif
@@ -1,14 +1,111 @@
 #include <gtest/gtest.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <signal.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <string>
 
 extern "C"
 {
     #include "doubly_list.h"
     #include "singly_list.h"
     #include "hash_table.h"
+    #include "aio.h"
+    #include "crc32c.h"
+    #include "wal.h"
+    #include "lz.h"
+    #include "bitmap.h"
+    #include "timing_wheel.h"
+    #include "value_cache.h"
+    #include "rfs.h"
+    #include "rfs_shard.h"
     #include "user.h"
 }
 
+static stKeyCallback g_callbacks[TYPE_COUNT] = {
+    {NULL, NULL, NULL, NULL, NULL, NULL},
+    {int_hash, int_type, int_print, int_cmp, int_serialize, int_deserialize},
+    {string_hash, string_type, string_print, string_cmp, string_serialize, string_deserialize}
+};
+
+//rfs的测试各自使用一个临时目录, 数据文件很小: 第0种文件16个256字节的格子, 第1种文件8个512字节的格子
+static std::string _rfs_dir()
+{
+    char dir[] = "/tmp/rfslib_rfs_XXXXXX";
+    if (mkdtemp(dir) == NULL)
+        return "";
+    return dir;
+}
+
+static void _rfs_config(const std::string & dir, stSysConfig * sys_config, stUserConfig * user_config)
+{
+    *sys_config  = g_default_sys_config;
+    *user_config = g_default_user_config;
+
+    snprintf(sys_config->working_dir, sizeof(sys_config->working_dir), "%s", dir.c_str());
+    sys_config->max_file_type_num       = 2;
+    sys_config->max_open_file_num       = 4;
+    sys_config->file_size               = 16 * 256;
+    sys_config->base_file_grid_size     = 256;
+    sys_config->grid_size_growth_factor = 2;
+    sys_config->hashtable_list_num      = 1024;
+    sys_config->hashtable_node_num      = 1024;
+}
+
+static void _rfs_remove(const std::string & dir)
+{
+    std::string cmd = "rm -rf " + dir;
+    EXPECT_EQ(system(cmd.c_str()), 0);
+}
+
+//int key的value, 不存在时返回"-"
+static std::string _rfs_value(rfs * pfs, int key)
+{
+    char value[4096];
+    uint16_t vlen = 0;
+    if (rfs_get(pfs, TYPE_INT, &key, value, &vlen, NULL, 0) == -1)
+        return "-";
+    return std::string(value, vlen);
+}
+
+static int64_t _rfs_set(rfs * pfs, int key, const std::string & value)
+{
+    return rfs_set(pfs, 0, TYPE_INT, &key, (char *) value.data(), value.size(), NULL, 0);
+}
+
+static int _rfs_del(rfs * pfs, int key)
+{
+    return rfs_del(pfs, TYPE_INT, &key, NULL, 0);
+}
+
+//数据文件头的长度: 每种文件的长度都是文件头加上16 * 256字节
+static off_t _rfs_header_size(const std::string & dir)
+{
+    off_t size = -1;
+
+    DIR * d = opendir(dir.c_str());
+    if (d == NULL)
+        return -1;
+
+    struct dirent * ent;
+    while ((ent = readdir(d)) != NULL)
+    {
+        struct stat st;
+        std::string path = dir + "/" + ent->d_name;
+        if (strncmp(ent->d_name, "rfs_", 4) == 0 && stat(path.c_str(), &st) == 0)
+            size = st.st_size - 16 * 256;
+    }
+    closedir(d);
+
+    return size;
+}
+
 TEST(rfslib, doubly_list)
 {
     enum {
@@ -133,5 +230,1346 @@ TEST(rfslib, hash_table)
         hashtable_del(pht, skey, user_callbacks + 2);
         EXPECT_EQ(hashtable_get(pht, skey, &new_index, NULL, user_callbacks + 2), -1);
     }
+
+    {
+        int ikey = 10717972;
+        stIndex index = {{2, 256}, 1024};
+        hashtable_set(pht, &ikey, &index, user_callbacks + 1);
+
+        char key[MAX_KEY_LEN];
+        uint8_t type = 0;
+        uint16_t klen = 0;
+        stIndex out;
+        int32_t idx = -1;
+        EXPECT_EQ(hashtable_next_entry(pht, &idx, &type, key, &klen, &out), 0);
+        EXPECT_EQ(type, (uint8_t) TYPE_INT);
+        EXPECT_EQ(klen, (uint16_t) sizeof(int));
+        EXPECT_EQ(memcmp(key, &ikey, sizeof(int)), 0);
+        EXPECT_EQ(out.grid_idx, (uint32_t) 1024);
+        EXPECT_EQ(hashtable_next_entry(pht, &idx, &type, key, &klen, &out), -1);
+
+        hashtable_del(pht, &ikey, user_callbacks + 1);
+    }
+
+    {
+        //节点用完后按CLOCK淘汰, 访问过的key有第二次机会
+        int ikeys[] = { 1, 2 };
+        for (int i = 0; i < 2; ++i)
+        {
+            stIndex index = {{0, 0}, (uint32_t) i};
+            EXPECT_EQ(hashtable_set(pht, ikeys + i, &index, user_callbacks + 1), 0);
+        }
+        EXPECT_EQ(hashtable_full(pht), 1);
+
+        char key[MAX_KEY_LEN];
+        uint8_t type = 0;
+        uint16_t klen = 0;
+        stIndex out;
+        ASSERT_EQ(hashtable_clock_next(pht, &type, key, &klen, &out), 0);
+        int victim;
+        memcpy(&victim, key, sizeof(int));
+        EXPECT_EQ(out.grid_idx, (uint32_t) (victim - 1));
+
+        //再次访问后下一个淘汰的是另一个key
+        EXPECT_EQ(hashtable_get(pht, &victim, &out, NULL, user_callbacks + 1), 0);
+        ASSERT_EQ(hashtable_clock_next(pht, &type, key, &klen, &out), 0);
+        int other;
+        memcpy(&other, key, sizeof(int));
+        EXPECT_EQ(other, 3 - victim);
+
+        EXPECT_EQ(hashtable_del(pht, &other, user_callbacks + 1), 0);
+        EXPECT_EQ(hashtable_full(pht), 0);
+        EXPECT_EQ(hashtable_del(pht, &victim, user_callbacks + 1), 0);
+        EXPECT_EQ(hashtable_clock_next(pht, &type, key, &klen, &out), -1);
+    }
+}
+
+TEST(rfslib, aio)
+{
+    int engines[] = { AIO_ENGINE_URING, AIO_ENGINE_THREAD };
+
+    for (int e = 0; e < 2; ++e)
+    {
+        char path[] = "/tmp/rfslib_aio_XXXXXX";
+        int fd = mkstemp(path);
+        ASSERT_GE(fd, 0);
+        unlink(path);
+
+        stAio * aio = aio_create(engines[e], 4, 2);
+        ASSERT_TRUE(aio != NULL);
+
+        char data[4][8];
+        struct iovec wiov[4];
+        for (int i = 0; i < 4; ++i)
+        {
+            snprintf(data[i], sizeof(data[i]), "block%02d", i);
+            wiov[i].iov_base = data[i];
+            wiov[i].iov_len  = sizeof(data[i]);
+            EXPECT_EQ(aio_submit(aio, fd, 1, wiov + i, 1, i * sizeof(data[i]), data[i]), 0);
+        }
+        EXPECT_EQ(aio_submit(aio, fd, 1, wiov, 1, 0, NULL), -1);
+        EXPECT_EQ(aio_inflight(aio), (uint32_t) 4);
+
+        stAioEvent events[4];
+        int n = 0;
+        while (n < 4)
+            n += aio_reap(aio, 4 - n, events + n, 4 - n);
+        EXPECT_EQ(aio_inflight(aio), (uint32_t) 0);
+        for (int i = 0; i < 4; ++i)
+            EXPECT_EQ(events[i].res, (int64_t) sizeof(data[i]));
+
+        char out[2][16];
+        struct iovec riov[2] = { { out[0], sizeof(out[0]) }, { out[1], sizeof(out[1]) } };
+        EXPECT_EQ(aio_submit(aio, fd, 0, riov, 2, 0, riov), 0);
+        EXPECT_EQ(aio_reap(aio, 1, events, 4), 1);
+        EXPECT_EQ(events[0].data, (void *) riov);
+        EXPECT_EQ(events[0].res, 32);
+        EXPECT_EQ(memcmp(out[0], "block00", 8), 0);
+        EXPECT_EQ(memcmp(out[1] + 8, "block03", 8), 0);
+
+        aio_destroy(aio);
+        close(fd);
+    }
+}
+
+TEST(rfslib, crc32c)
+{
+    EXPECT_EQ(crc32c(0, "123456789", 9), 0xE3069283u);
+    EXPECT_EQ(crc32c(crc32c(0, "1234", 4), "56789", 5), 0xE3069283u);
+    EXPECT_EQ(crc32c(0, "", 0), 0u);
+    EXPECT_EQ(crc32c_sw(0, "123456789", 9), 0xE3069283u);
+
+    //各种起始地址和长度下与查表的结果一致
+    unsigned char buf[1024];
+    for (size_t i = 0; i < sizeof(buf); ++i)
+        buf[i] = (unsigned char) (i * 131 + 7);
+    for (size_t off = 0; off < 8; ++off)
+    {
+        for (size_t len = 0; len < 64; ++len)
+            EXPECT_EQ(crc32c(0, buf + off, len), crc32c_sw(0, buf + off, len));
+        EXPECT_EQ(crc32c(0, buf + off, sizeof(buf) - off), crc32c_sw(0, buf + off, sizeof(buf) - off));
+    }
+}
+
+static int _collect(void * ctx, uint64_t lsn, char * rec, uint32_t len)
+{
+    std::string * out = (std::string *) ctx;
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%llu:", (unsigned long long) lsn);
+    out->append(buf).append(rec, len).append(";");
+    return 0;
+}
+
+TEST(rfslib, wal)
+{
+    char path[] = "/tmp/rfslib_wal_XXXXXX";
+    int fd = mkstemp(path);
+    ASSERT_GE(fd, 0);
+    close(fd);
+
+    stWal * wal = wal_open(path);
+    ASSERT_TRUE(wal != NULL);
+
+    char a[] = "ab", b[] = "cd";
+    struct iovec iov[2] = { { a, 2 }, { b, 2 } };
+    EXPECT_EQ(wal_append(wal, iov, 2), 1u);
+    EXPECT_EQ(wal_append(wal, iov, 1), 2u);
+    EXPECT_GT(wal_buffered(wal), 0u);
+    EXPECT_EQ(wal_commit(wal, 0), 0);
+    EXPECT_EQ(wal_buffered(wal), 0u);
+
+    //没有commit的记录不会出现在文件中
+    EXPECT_EQ(wal_append(wal, iov + 1, 1), 3u);
+    wal_close(wal);
+
+    wal = wal_open(path);
+    ASSERT_TRUE(wal != NULL);
+    std::string out;
+    EXPECT_EQ(wal_replay(wal, _collect, &out), 0);
+    EXPECT_EQ(out, "1:abcd;2:ab;");
+    EXPECT_EQ(wal_next_lsn(wal), 3u);
+
+    //截掉尾部不完整的记录
+    uint64_t size = wal_size(wal);
+    wal_close(wal);
+    ASSERT_EQ(truncate(path, size - 1), 0);
+
+    wal = wal_open(path);
+    ASSERT_TRUE(wal != NULL);
+    out.clear();
+    EXPECT_EQ(wal_replay(wal, _collect, &out), 0);
+    EXPECT_EQ(out, "1:abcd;");
+
+    EXPECT_EQ(wal_reset(wal, 10), 0);
+    EXPECT_EQ(wal_append(wal, iov, 1), 10u);
+    EXPECT_EQ(wal_commit(wal, 10), 0);
+    wal_close(wal);
+
+    wal = wal_open(path);
+    ASSERT_TRUE(wal != NULL);
+    out.clear();
+    EXPECT_EQ(wal_replay(wal, _collect, &out), 0);
+    EXPECT_EQ(out, "10:ab;");
+
+    //写文件失败后这批记录丢弃, 之后的append和commit都失败, 直到wal_reset
+    struct rlimit old_limit, limit;
+    ASSERT_EQ(getrlimit(RLIMIT_FSIZE, &old_limit), 0);
+    limit = old_limit;
+    limit.rlim_cur = wal_size(wal);
+    sighandler_t old_handler = signal(SIGXFSZ, SIG_IGN);
+    ASSERT_EQ(setrlimit(RLIMIT_FSIZE, &limit), 0);
+
+    EXPECT_EQ(wal_append(wal, iov, 1), 11u);
+    EXPECT_EQ(wal_commit(wal, 11), -1);
+
+    EXPECT_EQ(setrlimit(RLIMIT_FSIZE, &old_limit), 0);
+    signal(SIGXFSZ, old_handler);
+
+    EXPECT_EQ(wal_append(wal, iov, 1), 0u);
+    EXPECT_EQ(wal_commit(wal, 0), -1);
+    wal_close(wal);
+
+    wal = wal_open(path);
+    ASSERT_TRUE(wal != NULL);
+    out.clear();
+    EXPECT_EQ(wal_replay(wal, _collect, &out), 0);
+    EXPECT_EQ(out, "10:ab;");
+
+    EXPECT_EQ(wal_reset(wal, 0), 0);
+    EXPECT_EQ(wal_append(wal, iov + 1, 1), 11u);
+    EXPECT_EQ(wal_commit(wal, 0), 0);
+    wal_close(wal);
+
+    unlink(path);
+}
+
+TEST(rfslib, lz)
+{
+    char src[4096], dst[4096 + 64], out[4096];
+
+    //重复的数据能压缩, 包括与输出重叠的匹配
+    int n = 0;
+    for (int i = 0; n < 3000; ++i)
+        n += snprintf(src + n, sizeof(src) - n, "{\"id\":%d,\"name\":\"user-%d\",\"tags\":[\"a\",\"b\"]},", i, i % 7);
+    memset(src + n, 'x', 500);
+    n += 500;
+
+    int zlen = lz_compress(src, n, dst, sizeof(dst));
+    ASSERT_GT(zlen, 0);
+    EXPECT_LT(zlen, n / 2);
+    EXPECT_EQ(lz_decompress(dst, zlen, out, sizeof(out)), n);
+    EXPECT_EQ(memcmp(src, out, n), 0);
+
+    //输出空间不够
+    EXPECT_EQ(lz_compress(src, n, dst, zlen - 1), -1);
+    EXPECT_EQ(lz_decompress(dst, zlen, out, n - 1), -1);
+
+    //随机数据和短数据
+    srand(1);
+    for (int i = 0; i < (int) sizeof(src); ++i)
+        src[i] = rand();
+    for (int len = 0; len <= (int) sizeof(src); len += (len < 16) ? 1 : 509)
+    {
+        zlen = lz_compress(src, len, dst, sizeof(dst));
+        ASSERT_GE(zlen, 0);
+        EXPECT_EQ(lz_decompress(dst, zlen, out, sizeof(out)), len);
+        EXPECT_EQ(memcmp(src, out, len), 0);
+    }
+
+    //损坏的数据不会越界
+    for (int i = 0; i < 1000; ++i)
+    {
+        zlen = rand() % 64;
+        for (int j = 0; j < zlen; ++j)
+            dst[j] = rand();
+        int r = lz_decompress(dst, zlen, out, 256);
+        EXPECT_LE(r, 256);
+    }
+}
+
+TEST(rfslib, bitmap)
+{
+    const uint32_t sizes[] = { 1, 63, 64, 65, 4096, 64 * 64 * 64 + 1 };
+    srand(2);
+
+    for (int s = 0; s < (int) (sizeof(sizes) / sizeof(sizes[0])); ++s)
+    {
+        uint32_t n = sizes[s];
+        stBitmap * pbm = bm_create(n);
+        ASSERT_TRUE(pbm != NULL);
+        char * ref = (char *) calloc(n, 1);
+
+        EXPECT_EQ(bm_next_zero(pbm, 0), 0);
+        EXPECT_EQ(bm_next_set(pbm, 0), -1);
+
+        //全部置1后再清掉一部分
+        for (uint32_t i = 0; i < n; ++i)
+            EXPECT_EQ(bm_set(pbm, i), 0);
+        memset(ref, 1, n);
+        EXPECT_EQ(bm_next_zero(pbm, 0), -1);
+        EXPECT_EQ(bm_set(pbm, n - 1), -1);
+
+        for (int op = 0; op < 20000; ++op)
+        {
+            uint32_t i = rand() % n;
+            if (rand() % 2)
+                EXPECT_EQ(bm_set(pbm, i), ref[i] ? -1 : 0);
+            else
+                EXPECT_EQ(bm_clear(pbm, i), ref[i] ? 0 : -1);
+            ref[i] = rand() % 2;
+            if (ref[i])
+                bm_set(pbm, i);
+            else
+                bm_clear(pbm, i);
+
+            uint32_t from = rand() % n;
+            int64_t zero = -1, set = -1;
+            for (uint32_t j = from; j < n && (zero < 0 || set < 0); ++j)
+            {
+                if (!ref[j] && zero < 0) zero = j;
+                if (ref[j] && set < 0)   set = j;
+            }
+            ASSERT_EQ(bm_next_zero(pbm, from), zero);
+            ASSERT_EQ(bm_next_set(pbm, from), set);
+        }
+
+        uint32_t count = 0;
+        for (uint32_t i = 0; i < n; ++i)
+        {
+            EXPECT_EQ(bm_test(pbm, i), ref[i]);
+            count += ref[i];
+        }
+        EXPECT_EQ(bm_count(pbm), count);
+
+        bm_clear_all(pbm);
+        EXPECT_EQ(bm_count(pbm), 0u);
+        EXPECT_EQ(bm_next_set(pbm, 0), -1);
+        EXPECT_EQ(bm_next_zero(pbm, n - 1), n - 1);
+
+        free(ref);
+        bm_destroy(pbm);
+    }
+}
+
+static int count_timer(void * ctx, stTimer * timer)
+{
+    ++*(uint32_t *) ctx;
+    return 0;
+}
+
+TEST(rfslib, timing_wheel)
+{
+    enum { N = 5000 };
+    static uint32_t expires[N];
+    static char     fired[N];
+
+    uint32_t now = 0x00FFFF00;
+    stTimingWheel * tw = tw_create(now);
+    ASSERT_TRUE(tw != NULL);
+    srand(3);
+
+    //到期时间跨过各层, 包括已经过去的时间
+    uint32_t last = now;
+    for (int i = 0; i < N; ++i)
+    {
+        switch (i % 4)
+        {
+            case 0: expires[i] = now + rand() % 300; break;
+            case 1: expires[i] = now + rand() % 70000; break;
+            case 2: expires[i] = now + ((uint32_t) rand() << 8) % (1u << 25); break;
+            default: expires[i] = now - rand() % 10; break;
+        }
+        if (expires[i] > last)
+            last = expires[i];
+        ASSERT_EQ(tw_add(tw, expires[i], i), 0);
+    }
+    EXPECT_EQ(tw_count(tw), (uint32_t) N);
+
+    uint32_t counted = 0;
+    EXPECT_EQ(tw_foreach(tw, count_timer, &counted), 0);
+    EXPECT_EQ(counted, (uint32_t) N);
+
+    stTimer timers[64];
+    uint32_t total = 0;
+    for (;;)
+    {
+        uint32_t n;
+        while ((n = tw_expire(tw, now, timers, 64)) > 0)
+        {
+            for (uint32_t j = 0; j < n; ++j)
+            {
+                uint64_t i = timers[j].data;
+                ASSERT_LT(i, (uint64_t) N);
+                EXPECT_EQ(timers[j].expire, expires[i]);
+                EXPECT_LE(expires[i], now);
+                EXPECT_EQ(fired[i], 0);
+                fired[i] = 1;
+            }
+            total += n;
+        }
+
+        //到期的都已取出, 没到期的都没取出
+        for (int i = 0; i < N; ++i)
+            ASSERT_EQ(fired[i], expires[i] <= now) << "timer " << i << " expire " << expires[i] << " now " << now;
+
+        if (now >= last)
+            break;
+        now += (rand() % 3 == 0) ? 1 + rand() % 200 : 1 + rand() % 100000;
+    }
+    EXPECT_EQ(total, (uint32_t) N);
+    EXPECT_EQ(tw_count(tw), 0u);
+
+    //取出的节点重用
+    EXPECT_EQ(tw_add(tw, now + 1, 7), 0);
+    EXPECT_EQ(tw_expire(tw, now, timers, 64), 0u);
+    EXPECT_EQ(tw_expire(tw, now + 1, timers, 64), 1u);
+    EXPECT_EQ(timers[0].data, 7u);
+
+    tw_destroy(tw);
+}
+
+TEST(rfslib, value_cache)
+{
+    //每项100字节的数据, 容量大约放得下100项
+    const uint32_t len = 100;
+    stValueCache * vc = vc_create(100 * (len + 64));
+    ASSERT_TRUE(vc != NULL);
+
+    uint32_t out_len = 0;
+    EXPECT_TRUE(vc_get(vc, 1, &out_len) == NULL);
+
+    char * p = vc_put(vc, 1, len);
+    ASSERT_TRUE(p != NULL);
+    memset(p, 'a', len);
+    const char * got = vc_get(vc, 1, &out_len);
+    ASSERT_TRUE(got != NULL);
+    EXPECT_EQ(out_len, len);
+    EXPECT_EQ(got[len - 1], 'a');
+
+    //替换和删除
+    p = vc_put(vc, 1, 10);
+    ASSERT_TRUE(p != NULL);
+    memset(p, 'b', 10);
+    got = vc_get(vc, 1, &out_len);
+    ASSERT_TRUE(got != NULL);
+    EXPECT_EQ(out_len, 10u);
+    EXPECT_EQ(got[0], 'b');
+    EXPECT_EQ(vc_del(vc, 1), 0);
+    EXPECT_TRUE(vc_get(vc, 1, &out_len) == NULL);
+    EXPECT_EQ(vc_del(vc, 1), -1);
+
+    //超过容量的数据不缓存
+    EXPECT_TRUE(vc_put(vc, 2, 100 * (len + 64)) == NULL);
+
+    //热数据被多次访问后, 一次性扫描大量key不会把它们挤出去
+    for (uint64_t k = 100; k < 150; ++k)
+    {
+        memset(vc_put(vc, k, len), (char) k, len);
+        vc_get(vc, k, &out_len);
+        vc_get(vc, k, &out_len);
+    }
+    for (uint64_t k = 1000; k < 11000; ++k)
+    {
+        ASSERT_TRUE(vc_put(vc, k, len) != NULL);
+        EXPECT_LE(vc_size(vc), 100u * (len + 64));
+    }
+
+    uint32_t hot = 0;
+    for (uint64_t k = 100; k < 150; ++k)
+    {
+        got = vc_get(vc, k, &out_len);
+        if (got != NULL && out_len == len && got[0] == (char) k)
+            ++hot;
+    }
+    EXPECT_GE(hot, 45u);
+    EXPECT_LE(vc_count(vc), 100u * (len + 64) / len);
+
+    vc_destroy(vc);
+}
+
+TEST(rfslib, mset)
+{
+    std::string dir = _rfs_dir();
+    ASSERT_NE(dir, "");
+
+    stSysConfig sys_config;
+    stUserConfig user_config;
+    _rfs_config(dir, &sys_config, &user_config);
+
+    rfs * pfs = rfs_create(sys_config, user_config, TYPE_COUNT, g_callbacks);
+    ASSERT_TRUE(pfs != NULL);
+
+    //同一个key出现多次时留下最后一次的value, 各次的结果相同
+    int keys[4] = { 1, 2, 1, 1 };
+    std::string values[4] = { "a", "b", "c", std::string(300, 'd') };
+    void *   pkeys[4];
+    char *   pvalues[4];
+    uint16_t vlens[4];
+    int64_t  rets[4];
+    for (int i = 0; i < 4; ++i)
+    {
+        pkeys[i]   = keys + i;
+        pvalues[i] = (char *) values[i].data();
+        vlens[i]   = values[i].size();
+    }
+
+    EXPECT_EQ(rfs_mset(pfs, 0, TYPE_INT, pkeys, pvalues, vlens, 4, rets), 4);
+    EXPECT_EQ(rets[0], rets[3]);
+    EXPECT_EQ(rets[2], rets[3]);
+    EXPECT_EQ(_rfs_value(pfs, 1), values[3]);
+    EXPECT_EQ(_rfs_value(pfs, 2), "b");
+    EXPECT_EQ(_rfs_del(pfs, 1), 0);
+    EXPECT_EQ(_rfs_del(pfs, 2), 0);
+
+    //占满两个文件, 只空出第0种文件的最后一个格子和第1种文件的第一个格子
+    int64_t small[16], large[8];
+    for (int k = 0; k < 16; ++k)
+        ASSERT_NE(small[k] = _rfs_set(pfs, 100 + k, "small"), -1);
+    for (int k = 0; k < 8; ++k)
+        ASSERT_NE(large[k] = _rfs_set(pfs, 200 + k, std::string(300, 'l')), -1);
+    for (int k = 0; k < 16; ++k)
+    {
+        if ((small[k] & 0xffffffff) == 15)
+        {
+            EXPECT_EQ(_rfs_del(pfs, 100 + k), 0);
+        }
+    }
+    for (int k = 0; k < 8; ++k)
+    {
+        if ((large[k] & 0xffffffff) == 0)
+        {
+            EXPECT_EQ(_rfs_del(pfs, 200 + k), 0);
+        }
+    }
+
+    //写到第0种文件的格子会失败, 写到第1种文件的会成功
+    off_t header_size = _rfs_header_size(dir);
+    ASSERT_GT(header_size, 0);
+
+    struct rlimit old_limit, limit;
+    ASSERT_EQ(getrlimit(RLIMIT_FSIZE, &old_limit), 0);
+    limit = old_limit;
+    limit.rlim_cur = header_size + 2048;
+    sighandler_t old_handler = signal(SIGXFSZ, SIG_IGN);
+    ASSERT_EQ(setrlimit(RLIMIT_FSIZE, &limit), 0);
+
+    //第一次的小value在失败的批次中, 不能撤销最后一次已经写成功的大value
+    keys[0] = 3, keys[1] = 3;
+    pvalues[1] = pvalues[3];
+    vlens[1]   = vlens[3];
+    EXPECT_EQ(rfs_mset(pfs, 0, TYPE_INT, pkeys, pvalues, vlens, 2, rets), 2);
+    EXPECT_EQ(rets[0], rets[1]);
+    EXPECT_EQ(rets[1] >> 48, 1);
+    EXPECT_EQ(_rfs_value(pfs, 3), values[3]);
+
+    //写失败的key保持原样
+    keys[0] = 4;
+    EXPECT_EQ(rfs_mset(pfs, 0, TYPE_INT, pkeys, pvalues, vlens, 1, rets), 0);
+    EXPECT_EQ(rets[0], -1);
+    EXPECT_EQ(_rfs_value(pfs, 4), "-");
+
+    EXPECT_EQ(setrlimit(RLIMIT_FSIZE, &old_limit), 0);
+    signal(SIGXFSZ, old_handler);
+
+    //失败时释放的格子可以再用
+    EXPECT_NE(_rfs_set(pfs, 4, "small"), -1);
+    EXPECT_EQ(rfs_destroy(pfs), 0);
+
+    pfs = rfs_create(sys_config, user_config, TYPE_COUNT, g_callbacks);
+    ASSERT_TRUE(pfs != NULL);
+    EXPECT_EQ(_rfs_value(pfs, 3), values[3]);
+    EXPECT_EQ(_rfs_value(pfs, 4), "small");
+    for (int k = 0; k < 16; ++k)
+        EXPECT_EQ(_rfs_value(pfs, 100 + k), ((small[k] & 0xffffffff) == 15) ? "-" : "small");
+    EXPECT_EQ(rfs_destroy(pfs), 0);
+
+    _rfs_remove(dir);
+}
+
+static void _async_done(stAsyncResult * result, void * arg)
+{
+    *(int64_t *) arg = result->ret;
+}
+
+TEST(rfslib, async_busy)
+{
+    std::string dir = _rfs_dir();
+    ASSERT_NE(dir, "");
+
+    stSysConfig sys_config;
+    stUserConfig user_config;
+    _rfs_config(dir, &sys_config, &user_config);
+
+    rfs * pfs = rfs_create(sys_config, user_config, TYPE_COUNT, g_callbacks);
+    ASSERT_TRUE(pfs != NULL);
+
+    int key = 1;
+    void * pkey = &key;
+    int64_t ret = -1;
+    ASSERT_NE(_rfs_set(pfs, key, "old"), -1);
+    ASSERT_EQ(rfs_set_async(pfs, 0, TYPE_INT, &key, (char *) "new", 3, _async_done, &ret), 0);
+
+    //回调之前这个key的写操作都失败
+    int64_t rets[1];
+    int     drets[1];
+    char *  pvalue = (char *) "x";
+    uint16_t vlen  = 1;
+    EXPECT_EQ(_rfs_set(pfs, key, "x"), -1);
+    EXPECT_EQ(rfs_set_ex(pfs, 0, 10, TYPE_INT, &key, pvalue, vlen), -1);
+    EXPECT_EQ(_rfs_del(pfs, key), -1);
+    EXPECT_EQ(rfs_mset(pfs, 0, TYPE_INT, &pkey, &pvalue, &vlen, 1, rets), 0);
+    EXPECT_EQ(rfs_mdel(pfs, TYPE_INT, &pkey, 1, drets), 0);
+    EXPECT_EQ(rfs_set_async(pfs, 0, TYPE_INT, &key, pvalue, vlen, _async_done, &ret), -1);
+
+    EXPECT_EQ(rfs_poll(pfs, 1), 1);
+    EXPECT_NE(ret, -1);
+    EXPECT_EQ(_rfs_value(pfs, key), "new");
+    EXPECT_EQ(_rfs_del(pfs, key), 0);
+
+    EXPECT_EQ(rfs_destroy(pfs), 0);
+    _rfs_remove(dir);
+}
+
+typedef struct {
+    rfs * pfs;
+    int   begin;
+    int   end;
+} stSetRange;
+
+static void * _set_range(void * arg)
+{
+    stSetRange * range = (stSetRange *) arg;
+    for (int k = range->begin; k < range->end; ++k)
+    {
+        char value[32];
+        int len = snprintf(value, sizeof(value), "v%d", k);
+        if (rfs_set(range->pfs, 0, TYPE_INT, &k, value, len, NULL, 0) == -1)
+            return (void *) 1;
+    }
+    return NULL;
 }
 
+//把数据文件中文件头之后的内容清零, 模拟掉电时没有落盘的数据
+static void _rfs_drop_data(const std::string & dir)
+{
+    off_t header_size = _rfs_header_size(dir);
+    ASSERT_GT(header_size, 0);
+
+    DIR * d = opendir(dir.c_str());
+    ASSERT_TRUE(d != NULL);
+
+    struct dirent * ent;
+    while ((ent = readdir(d)) != NULL)
+    {
+        if (strncmp(ent->d_name, "rfs_", 4) != 0)
+            continue;
+
+        std::string path = dir + "/" + ent->d_name;
+        int fd = open(path.c_str(), O_RDWR);
+        ASSERT_GE(fd, 0);
+        std::string zero(16 * 256, '\0');
+        EXPECT_EQ(pwrite(fd, zero.data(), zero.size(), header_size), (ssize_t) zero.size());
+        close(fd);
+    }
+    closedir(d);
+}
+
+TEST(rfslib, wal_recovery)
+{
+    std::string dir = _rfs_dir();
+    ASSERT_NE(dir, "");
+
+    stSysConfig sys_config;
+    stUserConfig user_config;
+    _rfs_config(dir, &sys_config, &user_config);
+    user_config.wal_mode = WAL_SYNC;
+
+    //子进程中多个线程同时写, 共用日志的group commit, 没有rfs_destroy就退出
+    pid_t pid = fork();
+    ASSERT_GE(pid, 0);
+    if (pid == 0)
+    {
+        rfs * pfs = rfs_create(sys_config, user_config, TYPE_COUNT, g_callbacks);
+        if (pfs == NULL)
+            _exit(1);
+
+        pthread_t threads[4];
+        stSetRange ranges[4];
+        for (int t = 0; t < 4; ++t)
+        {
+            ranges[t].pfs   = pfs;
+            ranges[t].begin = t * 25;
+            ranges[t].end   = (t + 1) * 25;
+            pthread_create(threads + t, NULL, _set_range, ranges + t);
+        }
+
+        int failed = 0;
+        for (int t = 0; t < 4; ++t)
+        {
+            void * ret = NULL;
+            pthread_join(threads[t], &ret);
+            failed |= (ret != NULL);
+        }
+
+        //覆盖和删除也要按日志恢复
+        failed |= (_rfs_set(pfs, 0, std::string(300, 'x')) == -1);
+        failed |= (_rfs_del(pfs, 1) != 0);
+        _exit(failed);
+    }
+
+    int status = 0;
+    ASSERT_EQ(waitpid(pid, &status, 0), pid);
+    ASSERT_TRUE(WIFEXITED(status));
+    ASSERT_EQ(WEXITSTATUS(status), 0);
+
+    _rfs_drop_data(dir);
+
+    rfs * pfs = rfs_create(sys_config, user_config, TYPE_COUNT, g_callbacks);
+    ASSERT_TRUE(pfs != NULL);
+    EXPECT_EQ(_rfs_value(pfs, 0), std::string(300, 'x'));
+    EXPECT_EQ(_rfs_value(pfs, 1), "-");
+    for (int k = 2; k < 100; ++k)
+        EXPECT_EQ(_rfs_value(pfs, k), "v" + std::to_string(k));
+    EXPECT_EQ(rfs_destroy(pfs), 0);
+
+    //正常退出后再打开
+    pfs = rfs_create(sys_config, user_config, TYPE_COUNT, g_callbacks);
+    ASSERT_TRUE(pfs != NULL);
+    EXPECT_EQ(_rfs_value(pfs, 99), "v99");
+    EXPECT_EQ(rfs_destroy(pfs), 0);
+
+    _rfs_remove(dir);
+}
+
+TEST(rfslib, group_commit)
+{
+    std::string dir = _rfs_dir();
+    ASSERT_NE(dir, "");
+
+    stSysConfig sys_config;
+    stUserConfig user_config;
+    _rfs_config(dir, &sys_config, &user_config);
+    user_config.wal_mode = WAL_SYNC;
+
+    rfs * pfs = rfs_create(sys_config, user_config, TYPE_COUNT, g_callbacks);
+    ASSERT_TRUE(pfs != NULL);
+
+    stRfsStat before;
+    ASSERT_EQ(rfs_get_stat(pfs, &before), 0);
+
+    //等日志落盘时不占着rfs, 其他线程的日志赶上同一次fdatasync
+    pthread_t threads[8];
+    stSetRange ranges[8];
+    for (int t = 0; t < 8; ++t)
+    {
+        ranges[t].pfs   = pfs;
+        ranges[t].begin = t * 50;
+        ranges[t].end   = (t + 1) * 50;
+        pthread_create(threads + t, NULL, _set_range, ranges + t);
+    }
+
+    for (int t = 0; t < 8; ++t)
+    {
+        void * ret = NULL;
+        pthread_join(threads[t], &ret);
+        EXPECT_TRUE(ret == NULL);
+    }
+
+    stRfsStat after;
+    ASSERT_EQ(rfs_get_stat(pfs, &after), 0);
+    EXPECT_GT(after.wal_syncs, before.wal_syncs);
+    EXPECT_LT(after.wal_syncs - before.wal_syncs, 400u);
+
+    for (int k = 0; k < 400; ++k)
+        EXPECT_EQ(_rfs_value(pfs, k), "v" + std::to_string(k));
+
+    EXPECT_EQ(rfs_destroy(pfs), 0);
+    _rfs_remove(dir);
+}
+
+TEST(rfslib, wal_undo)
+{
+    std::string dir = _rfs_dir();
+    ASSERT_NE(dir, "");
+
+    stSysConfig sys_config;
+    stUserConfig user_config;
+    _rfs_config(dir, &sys_config, &user_config);
+    user_config.wal_mode = WAL_SYNC;
+
+    //第0种文件的前8个格子和第1种文件的前4个格子有数据, key 1在第0种文件的第8个格子
+    rfs * pfs = rfs_create(sys_config, user_config, TYPE_COUNT, g_callbacks);
+    ASSERT_TRUE(pfs != NULL);
+    for (int k = 0; k < 8; ++k)
+        ASSERT_NE(_rfs_set(pfs, 100 + k, "small"), -1);
+    ASSERT_EQ(_rfs_set(pfs, 1, "old") & 0xffffffff, 8);
+    for (int k = 0; k < 4; ++k)
+        ASSERT_NE(_rfs_set(pfs, 200 + k, std::string(300, 'l')), -1);
+    EXPECT_EQ(rfs_destroy(pfs), 0);
+
+    off_t header_size = _rfs_header_size(dir);
+    ASSERT_GT(header_size, 0);
+
+    //子进程中之后的格子都写不进去, 日志还写得进去; 写失败后没有rfs_destroy就退出
+    pid_t pid = fork();
+    ASSERT_GE(pid, 0);
+    if (pid == 0)
+    {
+        pfs = rfs_create(sys_config, user_config, TYPE_COUNT, g_callbacks);
+        if (pfs == NULL)
+            _exit(1);
+
+        struct rlimit limit;
+        getrlimit(RLIMIT_FSIZE, &limit);
+        limit.rlim_cur = header_size + 2048;
+        signal(SIGXFSZ, SIG_IGN);
+        if (setrlimit(RLIMIT_FSIZE, &limit) != 0)
+            _exit(1);
+
+        int failed = 0;
+
+        //覆盖原来的格子, 挪到新的格子, 新的key
+        failed |= (_rfs_set(pfs, 1, "new") != -1);
+        failed |= (_rfs_set(pfs, 1, std::string(300, 'x')) != -1);
+
+        int key = 2;
+        void *   pkeys[1]   = { &key };
+        char *   pvalues[1] = { (char *) "small" };
+        uint16_t vlens[1]   = { 5 };
+        int64_t  rets[1];
+        failed |= (rfs_mset(pfs, 0, TYPE_INT, pkeys, pvalues, vlens, 1, rets) != 0);
+
+        failed |= (_rfs_value(pfs, 1) != "old");
+        failed |= (_rfs_value(pfs, 2) != "-");
+        _exit(failed);
+    }
+
+    int status = 0;
+    ASSERT_EQ(waitpid(pid, &status, 0), pid);
+    ASSERT_TRUE(WIFEXITED(status));
+    ASSERT_EQ(WEXITSTATUS(status), 0);
+
+    //按日志补写时不能把写失败的value写回去
+    pfs = rfs_create(sys_config, user_config, TYPE_COUNT, g_callbacks);
+    ASSERT_TRUE(pfs != NULL);
+    EXPECT_EQ(_rfs_value(pfs, 1), "old");
+    EXPECT_EQ(_rfs_value(pfs, 2), "-");
+    for (int k = 0; k < 8; ++k)
+        EXPECT_EQ(_rfs_value(pfs, 100 + k), "small");
+    for (int k = 0; k < 4; ++k)
+        EXPECT_EQ(_rfs_value(pfs, 200 + k), std::string(300, 'l'));
+    EXPECT_EQ(rfs_destroy(pfs), 0);
+
+    _rfs_remove(dir);
+}
+
+TEST(rfslib, wal_replay_failure)
+{
+    std::string dir = _rfs_dir();
+    ASSERT_NE(dir, "");
+
+    stSysConfig sys_config;
+    stUserConfig user_config;
+    _rfs_config(dir, &sys_config, &user_config);
+    user_config.wal_mode = WAL_SYNC;
+
+    //子进程写入第1种文件后没有rfs_destroy就退出, 日志中留着这条记录
+    pid_t pid = fork();
+    ASSERT_GE(pid, 0);
+    if (pid == 0)
+    {
+        rfs * pfs = rfs_create(sys_config, user_config, TYPE_COUNT, g_callbacks);
+        if (pfs == NULL)
+            _exit(1);
+        _exit(_rfs_set(pfs, 1, std::string(300, 'x')) == -1);
+    }
+
+    int status = 0;
+    ASSERT_EQ(waitpid(pid, &status, 0), pid);
+    ASSERT_TRUE(WIFEXITED(status));
+    ASSERT_EQ(WEXITSTATUS(status), 0);
+
+    //少了一种文件时这条记录补写不了, 不能不写日志就打开
+    stSysConfig one_type = sys_config;
+    one_type.max_file_type_num = 1;
+    EXPECT_TRUE(rfs_create(one_type, user_config, TYPE_COUNT, g_callbacks) == NULL);
+
+    //日志留着, 配置改回来后照常恢复
+    rfs * pfs = rfs_create(sys_config, user_config, TYPE_COUNT, g_callbacks);
+    ASSERT_TRUE(pfs != NULL);
+    EXPECT_EQ(_rfs_value(pfs, 1), std::string(300, 'x'));
+    EXPECT_EQ(rfs_destroy(pfs), 0);
+
+    _rfs_remove(dir);
+}
+
+TEST(rfslib, index_checkpoint)
+{
+    std::string dir = _rfs_dir();
+    ASSERT_NE(dir, "");
+
+    stSysConfig sys_config;
+    stUserConfig user_config;
+    _rfs_config(dir, &sys_config, &user_config);
+    user_config.wal_mode         = WAL_ASYNC;
+    user_config.index_checkpoint = 1;
+
+    rfs * pfs = rfs_create(sys_config, user_config, TYPE_COUNT, g_callbacks);
+    ASSERT_TRUE(pfs != NULL);
+    for (int k = 0; k < 10; ++k)
+        ASSERT_NE(_rfs_set(pfs, k, "old"), -1);
+    EXPECT_EQ(rfs_destroy(pfs), 0);
+
+    //正常退出后用检查点加载
+    pfs = rfs_create(sys_config, user_config, TYPE_COUNT, g_callbacks);
+    ASSERT_TRUE(pfs != NULL);
+    EXPECT_EQ(_rfs_value(pfs, 9), "old");
+    EXPECT_EQ(rfs_destroy(pfs), 0);
+
+    //子进程挪走和删除一些key后异常退出, 最后一批日志没有落盘, 数据文件中的格子比检查点新
+    pid_t pid = fork();
+    ASSERT_GE(pid, 0);
+    if (pid == 0)
+    {
+        pfs = rfs_create(sys_config, user_config, TYPE_COUNT, g_callbacks);
+        if (pfs == NULL)
+            _exit(1);
+
+        int failed = 0;
+        for (int k = 0; k < 5; ++k)
+            failed |= (_rfs_set(pfs, k, std::string(300, 'a' + k)) == -1);
+        failed |= (_rfs_del(pfs, 5) != 0);
+        failed |= (_rfs_set(pfs, 10, "new") == -1);
+        _exit(failed);
+    }
+
+    int status = 0;
+    ASSERT_EQ(waitpid(pid, &status, 0), pid);
+    ASSERT_TRUE(WIFEXITED(status));
+    ASSERT_EQ(WEXITSTATUS(status), 0);
+
+    //不能再用检查点, 扫描数据文件得到子进程写的结果
+    pfs = rfs_create(sys_config, user_config, TYPE_COUNT, g_callbacks);
+    ASSERT_TRUE(pfs != NULL);
+    for (int k = 0; k < 5; ++k)
+        EXPECT_EQ(_rfs_value(pfs, k), std::string(300, 'a' + k));
+    EXPECT_EQ(_rfs_value(pfs, 5), "-");
+    for (int k = 6; k < 10; ++k)
+        EXPECT_EQ(_rfs_value(pfs, k), "old");
+    EXPECT_EQ(_rfs_value(pfs, 10), "new");
+    EXPECT_EQ(rfs_destroy(pfs), 0);
+
+    _rfs_remove(dir);
+}
+
+TEST(rfslib, index_wal_tail)
+{
+    std::string dir = _rfs_dir();
+    ASSERT_NE(dir, "");
+
+    stSysConfig sys_config;
+    stUserConfig user_config;
+    _rfs_config(dir, &sys_config, &user_config);
+    user_config.wal_mode            = WAL_SYNC;
+    user_config.wal_checkpoint_size = 512;
+    user_config.index_checkpoint    = 1;
+
+    //子进程写到中途清空过几次日志, 最后几个写操作只在日志中, 没有rfs_destroy就退出
+    pid_t pid = fork();
+    ASSERT_GE(pid, 0);
+    if (pid == 0)
+    {
+        rfs * pfs = rfs_create(sys_config, user_config, TYPE_COUNT, g_callbacks);
+        if (pfs == NULL)
+            _exit(1);
+
+        int failed = 0;
+        for (int k = 0; k < 40; ++k)
+            failed |= (_rfs_set(pfs, k, "v" + std::to_string(k)) == -1);
+
+        failed |= (_rfs_set(pfs, 0, std::string(300, 'x')) == -1);
+        failed |= (_rfs_del(pfs, 1) != 0);
+        failed |= (_rfs_set(pfs, 2, "new") == -1);
+        failed |= (_rfs_set(pfs, 40, "v40") == -1);
+        _exit(failed);
+    }
+
+    int status = 0;
+    ASSERT_EQ(waitpid(pid, &status, 0), pid);
+    ASSERT_TRUE(WIFEXITED(status));
+    ASSERT_EQ(WEXITSTATUS(status), 0);
+
+    //异常退出后检查点还在, 日志中有检查点之后的记录
+    struct stat st;
+    ASSERT_EQ(stat((dir + "/rfs.index").c_str(), &st), 0);
+    ASSERT_EQ(stat((dir + "/rfs.wal").c_str(), &st), 0);
+    off_t wal_size = st.st_size;
+
+    rfs * pfs = rfs_create(sys_config, user_config, TYPE_COUNT, g_callbacks);
+    ASSERT_TRUE(pfs != NULL);
+    EXPECT_EQ(_rfs_value(pfs, 0), std::string(300, 'x'));
+    EXPECT_EQ(_rfs_value(pfs, 1), "-");
+    EXPECT_EQ(_rfs_value(pfs, 2), "new");
+    for (int k = 3; k <= 40; ++k)
+        EXPECT_EQ(_rfs_value(pfs, k), "v" + std::to_string(k));
+
+    //启动时按日志补上之后重新写了检查点并清空日志
+    ASSERT_EQ(stat((dir + "/rfs.wal").c_str(), &st), 0);
+    EXPECT_LT(st.st_size, wal_size);
+    EXPECT_EQ(rfs_destroy(pfs), 0);
+
+    _rfs_remove(dir);
+}
+
+typedef struct {
+    int64_t     ret;
+    std::string value;
+} stAsyncGot;
+
+static void _async_got(stAsyncResult * result, void * arg)
+{
+    stAsyncGot * got = (stAsyncGot *) arg;
+    got->ret = result->ret;
+    if (result->ret != -1)
+        got->value.assign(result->value, result->vlen);
+}
+
+TEST(rfslib, compact_async_read)
+{
+    std::string dir = _rfs_dir();
+    ASSERT_NE(dir, "");
+
+    stSysConfig sys_config;
+    stUserConfig user_config;
+    _rfs_config(dir, &sys_config, &user_config);
+    user_config.compact_threshold = 50;
+
+    rfs * pfs = rfs_create(sys_config, user_config, TYPE_COUNT, g_callbacks);
+    ASSERT_TRUE(pfs != NULL);
+
+    //两个第0种文件, 第二个文件只留下两个key, 第一个文件空出两个格子
+    int64_t rets[32];
+    for (int k = 0; k < 32; ++k)
+        ASSERT_NE(rets[k] = _rfs_set(pfs, k, "v" + std::to_string(k)), -1);
+
+    int kept = -1;
+    int num[2] = { 0, 0 };
+    for (int k = 0; k < 32; ++k)
+    {
+        int file_no = (int) ((rets[k] >> 32) & 0xffff);
+        ASSERT_LT(file_no, 2);
+        if (file_no == 1 && kept == -1)
+            kept = k;
+
+        if ((file_no == 0 && num[0] < 2) || (file_no == 1 && num[1] >= 2))
+        {
+            EXPECT_EQ(_rfs_del(pfs, k), 0);
+        }
+        ++num[file_no];
+    }
+    ASSERT_NE(kept, -1);
+
+    //读还没有完成时不搬格子, 也不删除文件
+    stAsyncGot got = { -1, "" };
+    ASSERT_EQ(rfs_get_async(pfs, TYPE_INT, &kept, _async_got, &got), 0);
+    EXPECT_EQ(rfs_compact(pfs, 100), 0);
+    EXPECT_EQ(rfs_poll(pfs, 1), 1);
+    EXPECT_EQ(got.ret, rets[kept]);
+    EXPECT_EQ(got.value, "v" + std::to_string(kept));
+
+    EXPECT_GT(rfs_compact(pfs, 100), 0);
+    for (int k = 0; k < 32; ++k)
+    {
+        char value[4096];
+        uint16_t vlen = 0;
+        int key = k;
+        if (rfs_get(pfs, TYPE_INT, &key, value, &vlen, NULL, 0) != -1)
+        {
+            EXPECT_EQ(std::string(value, vlen), "v" + std::to_string(k));
+            EXPECT_EQ((rfs_get(pfs, TYPE_INT, &key, value, &vlen, NULL, 0) >> 32) & 0xffff, 0);
+        }
+    }
+    EXPECT_EQ(_rfs_value(pfs, kept), "v" + std::to_string(kept));
+
+    EXPECT_EQ(rfs_destroy(pfs), 0);
+    _rfs_remove(dir);
+}
+
+TEST(rfslib, expire_clock)
+{
+    std::string dir = _rfs_dir();
+    ASSERT_NE(dir, "");
+
+    stSysConfig sys_config;
+    stUserConfig user_config;
+    _rfs_config(dir, &sys_config, &user_config);
+    user_config.value_cache_size = 64 * 1024;
+
+    rfs * pfs = rfs_create(sys_config, user_config, TYPE_COUNT, g_callbacks);
+    ASSERT_TRUE(pfs != NULL);
+
+    //过期时间按当前时间计算, 和读接口用同一个时钟
+    uint32_t t = time(0);
+    int key = 1;
+    ASSERT_NE(rfs_set_ex(pfs, t - 1000, 100, TYPE_INT, &key, (char *) "a", 1), -1);
+    EXPECT_EQ(_rfs_value(pfs, key), "a");
+    EXPECT_EQ(_rfs_value(pfs, key), "a");
+
+    //rfs_expire不会删除读接口还认为没有过期的key
+    EXPECT_EQ(rfs_expire(pfs, t + 1000, 100), 0);
+    EXPECT_EQ(_rfs_value(pfs, key), "a");
+
+    EXPECT_EQ(rfs_destroy(pfs), 0);
+    _rfs_remove(dir);
+}
+
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+    int             done;
+    int             in_caller;  //回调在提交请求的线程中执行的次数
+    pthread_t       caller;
+} stShardWait;
+
+static void _shard_done(rfs_shard_req * req)
+{
+    stShardWait * wait = (stShardWait *) req->arg;
+
+    pthread_mutex_lock(&wait->lock);
+    if (pthread_equal(pthread_self(), wait->caller))
+        ++wait->in_caller;
+    ++wait->done;
+    pthread_cond_signal(&wait->cond);
+    pthread_mutex_unlock(&wait->lock);
+}
+
+TEST(rfslib, shard)
+{
+    std::string dir = _rfs_dir();
+    ASSERT_NE(dir, "");
+
+    stSysConfig sys_config;
+    stUserConfig user_config;
+    _rfs_config(dir, &sys_config, &user_config);
+
+    const uint32_t shard_num = 3;
+    rfs_shard * ps = rfs_shard_create(sys_config, user_config, TYPE_COUNT, g_callbacks, shard_num);
+    ASSERT_TRUE(ps != NULL);
+
+    //同一个key总是分到同一个shard, 所有shard都用得到
+    uint32_t per[shard_num] = { 0 };
+    for (int k = 0; k < 300; ++k)
+    {
+        uint32_t i = rfs_shard_of(ps, TYPE_INT, &k);
+        ASSERT_LT(i, shard_num);
+        EXPECT_EQ(rfs_shard_of(ps, TYPE_INT, &k), i);
+        ++per[i];
+    }
+    for (uint32_t i = 0; i < shard_num; ++i)
+        EXPECT_GT(per[i], 0u);
+
+    //同步接口
+    char value[4096];
+    uint16_t vlen = 0;
+    for (int k = 0; k < 30; ++k)
+    {
+        std::string v = "v" + std::to_string(k);
+        EXPECT_NE(rfs_shard_set(ps, 0, TYPE_INT, &k, (char *) v.data(), v.size()), -1);
+    }
+    for (int k = 0; k < 30; ++k)
+    {
+        ASSERT_NE(rfs_shard_get(ps, TYPE_INT, &k, value, &vlen), -1);
+        EXPECT_EQ(std::string(value, vlen), "v" + std::to_string(k));
+    }
+    int key = 0;
+    EXPECT_EQ(rfs_shard_del(ps, TYPE_INT, &key), 0);
+    EXPECT_EQ(rfs_shard_get(ps, TYPE_INT, &key, value, &vlen), -1);
+    EXPECT_EQ(rfs_shard_del(ps, TYPE_INT, &key), -1);
+    EXPECT_NE(rfs_shard_set_ex(ps, 0, 100, TYPE_INT, &key, (char *) "ex", 2), -1);
+    ASSERT_NE(rfs_shard_get(ps, TYPE_INT, &key, value, &vlen), -1);
+    EXPECT_EQ(std::string(value, vlen), "ex");
+
+    //异步请求的回调在shard的线程中执行, 带着提交时的arg
+    stShardWait wait;
+    pthread_mutex_init(&wait.lock, NULL);
+    pthread_cond_init(&wait.cond, NULL);
+    wait.done      = 0;
+    wait.in_caller = 0;
+    wait.caller    = pthread_self();
+
+    const int n = 30;
+    rfs_shard_req reqs[n];
+    int  keys[n];
+    char values[n][8];
+    for (int i = 0; i < n; ++i)
+    {
+        keys[i] = 100 + i;
+        memset(reqs + i, 0, sizeof(rfs_shard_req));
+        reqs[i].op       = SHARD_OP_SET;
+        reqs[i].type     = TYPE_INT;
+        reqs[i].key      = keys + i;
+        reqs[i].vlen     = snprintf(values[i], sizeof(values[i]), "a%d", i);
+        reqs[i].value    = values[i];
+        reqs[i].callback = _shard_done;
+        reqs[i].arg      = &wait;
+        ASSERT_EQ(rfs_shard_submit(ps, reqs + i), 0);
+    }
+
+    pthread_mutex_lock(&wait.lock);
+    while (wait.done < n)
+        pthread_cond_wait(&wait.cond, &wait.lock);
+    pthread_mutex_unlock(&wait.lock);
+
+    EXPECT_EQ(wait.in_caller, 0);
+    for (int i = 0; i < n; ++i)
+        EXPECT_NE(reqs[i].ret, -1);
+
+    uint32_t owner[100 + n];
+    for (int k = 0; k < 100 + n; ++k)
+        owner[k] = rfs_shard_of(ps, TYPE_INT, &k);
+
+    EXPECT_EQ(rfs_shard_destroy(ps), 0);
+    pthread_cond_destroy(&wait.cond);
+    pthread_mutex_destroy(&wait.lock);
+
+    //每个key只写在它所在的shard的目录中
+    for (uint32_t i = 0; i < shard_num; ++i)
+    {
+        std::string sub = dir + "/shard_" + std::to_string(i);
+        snprintf(sys_config.working_dir, sizeof(sys_config.working_dir), "%s", sub.c_str());
+        rfs * pfs = rfs_create(sys_config, user_config, TYPE_COUNT, g_callbacks);
+        ASSERT_TRUE(pfs != NULL);
+        for (int k = 0; k < 30; ++k)
+            EXPECT_EQ(_rfs_value(pfs, k) != "-", owner[k] == i);
+        for (int k = 0; k < n; ++k)
+            EXPECT_EQ(_rfs_value(pfs, keys[k]) == values[k], owner[keys[k]] == i);
+        EXPECT_EQ(rfs_destroy(pfs), 0);
+    }
+
+    _rfs_remove(dir);
+}
+
+//fd_lru用的value: 0~79在第0种文件, 100~139在第1种文件
+static std::string _fd_lru_value(int key)
+{
+    if (key < 100)
+        return "v" + std::to_string(key);
+    return std::string(300, 'a' + key % 26);
+}
+
+static void * _get_loop(void * arg)
+{
+    rfs * pfs = (rfs *) arg;
+    for (int round = 0; round < 50; ++round)
+    {
+        for (int k = 0; k < 140; ++k)
+        {
+            if ((k >= 80 && k < 100) || _rfs_value(pfs, k) == _fd_lru_value(k))
+                continue;
+            return (void *) 1;
+        }
+    }
+    return NULL;
+}
+
+TEST(rfslib, fd_lru)
+{
+    std::string dir = _rfs_dir();
+    ASSERT_NE(dir, "");
+
+    stSysConfig sys_config;
+    stUserConfig user_config;
+    _rfs_config(dir, &sys_config, &user_config);
+    user_config.io_engine       = IO_ENGINE_DIRECT;
+    user_config.max_open_fd_num = 2;
+
+    rfs * pfs = rfs_create(sys_config, user_config, TYPE_COUNT, g_callbacks);
+    ASSERT_TRUE(pfs != NULL);
+
+    for (int k = 0; k < 140; ++k)
+    {
+        if (k < 80 || k >= 100)
+        {
+            ASSERT_NE(_rfs_set(pfs, k, _fd_lru_value(k)), -1);
+        }
+    }
+
+    //多个线程同时读, 描述符缓存只留2个, 读接口不断重新打开并关掉别的文件; 同时写新的key
+    pthread_t threads[4];
+    for (int t = 0; t < 4; ++t)
+        pthread_create(threads + t, NULL, _get_loop, pfs);
+
+    for (int k = 200; k < 260; ++k)
+        EXPECT_NE(_rfs_set(pfs, k, "w" + std::to_string(k)), -1);
+
+    for (int t = 0; t < 4; ++t)
+    {
+        void * ret = NULL;
+        pthread_join(threads[t], &ret);
+        EXPECT_TRUE(ret == NULL);
+    }
+
+    for (int k = 200; k < 260; ++k)
+        EXPECT_EQ(_rfs_value(pfs, k), "w" + std::to_string(k));
+    EXPECT_EQ(rfs_destroy(pfs), 0);
+
+    _rfs_remove(dir);
+}
+
+TEST(rfslib, scan_compact)
+{
+    std::string dir = _rfs_dir();
+    ASSERT_NE(dir, "");
+
+    stSysConfig sys_config;
+    stUserConfig user_config;
+    _rfs_config(dir, &sys_config, &user_config);
+    user_config.io_engine         = IO_ENGINE_PIO;
+    user_config.compact_threshold = 50;
+
+    rfs * pfs = rfs_create(sys_config, user_config, TYPE_COUNT, g_callbacks);
+    ASSERT_TRUE(pfs != NULL);
+
+    //第0个文件只留下key 0和5, 第1个文件空出两个格子
+    for (int k = 0; k < 32; ++k)
+        ASSERT_EQ(_rfs_set(pfs, k, "v" + std::to_string(k)), ((int64_t) (k / 16) << 32) | (k % 16));
+    for (int k = 1; k < 18; ++k)
+    {
+        if (k != 5)
+        {
+            EXPECT_EQ(_rfs_del(pfs, k), 0);
+        }
+    }
+
+    rfs_scan * scan = rfs_scan_open(pfs);
+    ASSERT_TRUE(scan != NULL);
+
+    uint8_t type = 0;
+    int key = -1;
+    char value[4096];
+    uint16_t vlen = 0;
+    uint32_t write_time = 0;
+    ASSERT_EQ(rfs_scan_next(scan, &type, &key, value, &vlen, &write_time), 1);
+    EXPECT_EQ(key, 0);
+
+    //游标停在第0个文件中间时它被搬空删除, 又新建了同编号的文件, key 5正好写在原来的格子上
+    EXPECT_EQ(rfs_compact(pfs, 100), 2);
+    EXPECT_EQ(_rfs_set(pfs, 100, "v100"), (int64_t) 0);
+    EXPECT_EQ(_rfs_del(pfs, 5), 0);
+    for (int k = 101; k < 105; ++k)
+        EXPECT_EQ(_rfs_set(pfs, k, "v" + std::to_string(k)), (int64_t) (k - 100));
+    EXPECT_EQ(_rfs_set(pfs, 5, "new5"), (int64_t) 5);
+
+    //不能从打开时读到的旧内容中取出key 5
+    int n = 0;
+    while (rfs_scan_next(scan, &type, &key, value, &vlen, &write_time) == 1)
+    {
+        EXPECT_EQ(std::string(value, vlen), _rfs_value(pfs, key));
+        ++n;
+    }
+    EXPECT_GT(n, 0);
+    rfs_scan_close(scan);
+
+    EXPECT_EQ(rfs_destroy(pfs), 0);
+    _rfs_remove(dir);
+}